@@ -0,0 +1,32 @@
+#include <algorithm>
+
+#include "backgroundjob.h"
+
+//-------------------------------------------------------------------------------------------------
+// JobProgress
+//-------------------------------------------------------------------------------------------------
+
+float JobProgress::fraction() const {
+  const uint64_t total = total_;
+
+  if (total == 0)
+    return 0.0f;
+
+  return std::min(1.0f, static_cast<float>(done_) / total);
+}
+
+//-------------------------------------------------------------------------------------------------
+// BackgroundJob
+//-------------------------------------------------------------------------------------------------
+
+BackgroundJob::BackgroundJob(Work work) {
+  thread_ = std::thread([this, work]() {
+    hasSucceeded_ = work(progress_);
+    isFinished_ = true; // publishes hasSucceeded_
+  });
+}
+
+BackgroundJob::~BackgroundJob() {
+  cancel();
+  thread_.join();
+}
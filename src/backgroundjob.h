@@ -0,0 +1,57 @@
+#ifndef _BACKGROUND_JOB_H
+#define _BACKGROUND_JOB_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+//-------------------------------------------------------------------------------------------------
+// JobProgress
+//-------------------------------------------------------------------------------------------------
+
+// Progress and cancellation state, shared between a job and whoever is waiting for it. All methods
+// may be called from any thread.
+class JobProgress {
+public:
+  void setTotal(uint64_t total)                    { total_ = total; }
+  void advance(uint64_t amount)                    { done_ += amount; }
+  float fraction() const;
+
+  void cancel()                                    { isCanceled_ = true; }
+  bool isCanceled() const                          { return isCanceled_; }
+
+private:
+  std::atomic<uint64_t> total_{0};
+  std::atomic<uint64_t> done_{0};
+  std::atomic<bool> isCanceled_{false};
+};
+
+//-------------------------------------------------------------------------------------------------
+// BackgroundJob
+//-------------------------------------------------------------------------------------------------
+
+// Runs a single piece of work on its own thread. The work reports its progress, polls for
+// cancellation and returns whether it has succeeded.
+class BackgroundJob {
+public:
+  using Work = std::function<bool(JobProgress& progress)>;
+
+  BackgroundJob(Work work);
+  BackgroundJob(const BackgroundJob&) = delete;
+  BackgroundJob& operator = (const BackgroundJob&) = delete;
+  ~BackgroundJob();
+
+  const JobProgress& progress() const              { return progress_; }
+  void cancel()                                    { progress_.cancel(); }
+  bool isFinished() const                          { return isFinished_; }
+  bool hasSucceeded() const                        { return isFinished_ && hasSucceeded_; }
+
+private:
+  JobProgress progress_;
+  bool hasSucceeded_{false};
+  std::atomic<bool> isFinished_{false};
+  std::thread thread_;
+};
+
+#endif // _BACKGROUND_JOB_H
@@ -0,0 +1,537 @@
+// Headless batch conversion. Imports, analyzes and optionally exports a list of MIDI files on a
+// thread pool without initializing any GUI, so it can run on build servers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "floppybytecode.h"
+#include "floppysink.h"
+#include "headsimulator.h"
+#include "playability.h"
+#include "playbackengine.h"
+#include "song.h"
+#include "songrenderer.h"
+#include "threadpool.h"
+#include "voiceallocator.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct BatchOptions {
+  std::vector<std::string> paths;
+  std::string outputDirectory;
+  std::string wavDirectory;
+  std::string bytecodeDirectory;
+  std::string playbackOutput;
+  std::string timingCsvPath;
+  StreamSink::Format playbackFormat{StreamSink::Format::Text};
+  size_t numFloppyDrives{0};
+  bool isHeadSimulated{false};
+  bool isVoiceAllocated{false};
+  bool hasPoolPerTrack{false};
+  VoiceAllocationOptions::Policy allocationPolicy{VoiceAllocationOptions::Policy::StealOldest};
+  size_t numThreads{0};
+};
+
+struct FileReport {
+  bool hasSucceeded{false};
+  uint64_t fileSize{0};
+  double importMs{0};
+  double analysisMs{0};
+  double exportMs{0};
+  double renderMs{0};
+  double simulationMs{0};
+  double bytecodeMs{0};
+
+  size_t numTracks{0};
+  size_t numNotes{0};
+  uint64_t durationUs{0};
+  int lowestNote{127};
+  int highestNote{0};
+  size_t maxVoices{0}; // most notes sounding at the same time on a single track
+  size_t numIssues[PlayabilityAnalysis::NumIssueTypes]{}; // notes per kind of playability issue
+
+  bool isHeadSimulated{false};
+  HeadSimulation heads;
+
+  bool isBytecodeExported{false};
+  FloppyBytecodeStats bytecode;
+};
+
+static double millisecondsSince(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static std::string fileNameOf(const std::string& path) {
+  const size_t startOfFileName = path.find_last_of("/\\");
+
+  return startOfFileName == std::string::npos ? path : path.substr(startOfFileName + 1);
+}
+
+static std::string replaceExtension(const std::string& fileName, const std::string& extension) {
+  const size_t startOfExtension = fileName.find_last_of('.');
+
+  return fileName.substr(0, startOfExtension) + extension;
+}
+
+// Rounds to whole milliseconds before splitting, so 59.9996 s carries over to 01:00:000:
+static std::string formatDuration(uint64_t us) {
+  const uint64_t ms = (us + 500) / 1000;
+  char text[32];
+
+  snprintf(text, sizeof(text), "%02llu:%02d:%03d", static_cast<unsigned long long>(ms / 60000),
+      static_cast<int>(ms / 1000 % 60), static_cast<int>(ms % 1000));
+
+  return text;
+}
+
+static uint64_t fileSizeOf(const std::string& path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+
+  return file ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+// A floppy drive plays a single note at a time, so overlapping notes of a track need to be spread:
+static size_t maxVoicesOf(const NoteArray& notes) {
+  std::vector<uint32_t> endTicks;
+  endTicks.reserve(notes.size());
+
+  for (size_t i = 0; i < notes.size(); ++i) {
+    if (notes.numTicks(i) > 0)
+      endTicks.push_back(notes.endTick(i));
+  }
+
+  std::sort(endTicks.begin(), endTicks.end());
+
+  // Start ticks are sorted already, a note ending where the next one starts doesn't overlap it:
+  size_t numSounding = 0;
+  size_t maxVoices = 0;
+  size_t endNo = 0;
+
+  for (size_t i = 0; i < notes.size(); ++i) {
+    if (notes.numTicks(i) == 0)
+      continue;
+
+    while (endNo < endTicks.size() && endTicks[endNo] <= notes.startTick(i)) {
+      ++endNo;
+      --numSounding;
+    }
+
+    maxVoices = std::max(maxVoices, ++numSounding);
+  }
+
+  return maxVoices;
+}
+
+static VoiceAllocationOptions allocationOptionsFor(const BatchOptions& options, const Song& song) {
+  VoiceAllocationOptions allocationOptions;
+  allocationOptions.numVoices = options.numFloppyDrives;
+  allocationOptions.policy = options.allocationPolicy;
+
+  if (options.hasPoolPerTrack)
+    allocationOptions.trackPools = VoiceAllocationOptions::evenPools(song.numberOfTracks(), options.numFloppyDrives);
+
+  return allocationOptions;
+}
+
+static void analyze(const Song& song, FileReport& report) {
+  report.numTracks = song.numberOfTracks();
+  report.durationUs = song.durationUs();
+
+  for (size_t trackNo = 0; trackNo < song.numberOfTracks(); ++trackNo) {
+    const ChannelTrack* pTrack = song.track(static_cast<int>(trackNo));
+    const EventStoreStats& stats = pTrack->stats();
+
+    if (stats.numNotes == 0)
+      continue;
+
+    report.numNotes += stats.numNotes;
+    report.lowestNote = std::min<int>(report.lowestNote, stats.lowestNote);
+    report.highestNote = std::max<int>(report.highestNote, stats.highestNote);
+    report.maxVoices = std::max(report.maxVoices, maxVoicesOf(pTrack->events().notes()));
+  }
+
+  if (report.numNotes == 0)
+    report.lowestNote = report.highestNote = 0;
+
+  // Files are analyzed on the workers of the batch already, so the tracks are checked one by one:
+  PlayabilityAnalysis playability;
+  playability.update(song);
+
+  for (size_t trackNo = 0; trackNo < song.numberOfTracks(); ++trackNo) {
+    const ChannelTrack* pTrack = song.track(static_cast<int>(trackNo));
+    const PlayabilityAnalysis::TrackResult* pResult = playability.trackResult(static_cast<int>(trackNo), pTrack->revision());
+
+    for (size_t type = 0; pResult && type < PlayabilityAnalysis::NumIssueTypes; ++type)
+      report.numIssues[type] += pResult->numIssues[type];
+  }
+}
+
+static void convertFile(const BatchOptions& options, const std::string& path, FileReport& report) {
+  report.fileSize = fileSizeOf(path);
+
+  Song song;
+  Clock::time_point start = Clock::now();
+
+  // Files are converted in parallel already, so every import decodes its track chunks on a single thread:
+  if (!song.importFromMidi(path, nullptr, 1))
+    return;
+
+  report.importMs = millisecondsSince(start);
+  start = Clock::now();
+
+  analyze(song, report);
+
+  report.analysisMs = millisecondsSince(start);
+
+  if (!options.outputDirectory.empty()) {
+    start = Clock::now();
+
+    if (!song.exportAsMidi0(options.outputDirectory + "/" + fileNameOf(path)))
+      return;
+
+    report.exportMs = millisecondsSince(start);
+  }
+
+  // Files are converted in parallel already, so every rendering uses a single thread:
+  if (!options.wavDirectory.empty()) {
+    start = Clock::now();
+
+    RenderOptions renderOptions;
+    renderOptions.numThreads = 1;
+
+    SongRenderer renderer(song, renderOptions);
+
+    if (!renderer.renderToWav(options.wavDirectory + "/" + replaceExtension(fileNameOf(path), ".wav")))
+      return;
+
+    report.renderMs = millisecondsSince(start);
+  }
+
+  if (!options.isHeadSimulated && options.bytecodeDirectory.empty()) {
+    report.hasSucceeded = true;
+    return;
+  }
+
+  // Heads and bytecode follow the notes exactly as played, so the drives get allocated the same way:
+  start = Clock::now();
+
+  PlaybackSchedule schedule;
+  VoiceAllocation allocation;
+
+  if (options.isVoiceAllocated)
+    allocation.allocate(song, allocationOptionsFor(options, song));
+
+  schedule.build(song, options.isVoiceAllocated ? &allocation : nullptr);
+
+  // Without -d, every track gets a drive of its own:
+  const size_t numDrives = options.numFloppyDrives > 0 ? options.numFloppyDrives
+      : std::min(song.numberOfTracks(), FloppySink::MaxDrives);
+
+  if (options.isHeadSimulated) {
+    HeadSimulationOptions simulationOptions;
+    simulationOptions.numDrives = numDrives;
+
+    report.heads.simulate(schedule, simulationOptions);
+    report.isHeadSimulated = true;
+    report.simulationMs = millisecondsSince(start);
+  }
+
+  if (!options.bytecodeDirectory.empty()) {
+    start = Clock::now();
+
+    const std::string bytecodePath = options.bytecodeDirectory + "/" + replaceExtension(fileNameOf(path), ".flpb");
+
+    if (!FloppyBytecode::write(bytecodePath, schedule, numDrives, &report.bytecode))
+      return;
+
+    report.isBytecodeExported = true;
+    report.bytecodeMs = millisecondsSince(start);
+  }
+
+  report.hasSucceeded = true;
+}
+
+static void printReport(size_t fileNo, size_t numFiles, const std::string& path, const FileReport& report) {
+  if (!report.hasSucceeded) {
+    printf("[%zu/%zu] %s: failed!\n", fileNo, numFiles, path.c_str());
+    return;
+  }
+
+  printf("[%zu/%zu] %s: import %.1f ms, analysis %.1f ms, export %.1f ms, render %.1f ms | %zu track(s), "
+      "%zu note(s), %s, notes %d-%d, max. %zu voice(s) per track\n", fileNo, numFiles, path.c_str(),
+      report.importMs, report.analysisMs, report.exportMs, report.renderMs, report.numTracks, report.numNotes,
+      formatDuration(report.durationUs).c_str(), report.lowestNote, report.highestNote, report.maxVoices);
+
+  std::string issues;
+
+  for (size_t type = 0; type < PlayabilityAnalysis::NumIssueTypes; ++type) {
+    if (report.numIssues[type] > 0)
+      issues += (issues.empty() ? "" : ", ") + std::to_string(report.numIssues[type]) + " " + PlayabilityAnalysis::issueName(type);
+  }
+
+  if (!issues.empty())
+    printf("[%zu/%zu] %s: unplayable note(s) on a single drive: %s\n", fileNo, numFiles, path.c_str(), issues.c_str());
+
+  if (report.isBytecodeExported) {
+    printf("[%zu/%zu] %s: bytecode %.1f ms | %llu byte(s), %u record(s), %u wait record(s), up to %u record(s) "
+        "at once, peak %u record(s)/s\n", fileNo, numFiles, path.c_str(), report.bytecodeMs,
+        static_cast<unsigned long long>(report.bytecode.fileSize), report.bytecode.numRecords,
+        report.bytecode.numWaitRecords, report.bytecode.maxBurst, report.bytecode.peakRecordsPerSecond);
+  }
+
+  if (!report.isHeadSimulated)
+    return;
+
+  printf("[%zu/%zu] %s: head simulation %.1f ms | drive time %s, %zu reset collision(s)\n", fileNo, numFiles,
+      path.c_str(), report.simulationMs, formatDuration(report.heads.driveTimeUs()).c_str(),
+      report.heads.numResetCollisions());
+
+  for (size_t driveNo = 0; driveNo < report.heads.drives().size(); ++driveNo) {
+    const HeadSimulation::Drive& drive = report.heads.drives()[driveNo];
+
+    printf("  drive %zu: %llu note(s), %llu step(s), %llu reversal(s), %.0f steps/s average, %u steps/s max., "
+        "%zu reset collision(s)\n", driveNo, static_cast<unsigned long long>(drive.numNotes),
+        static_cast<unsigned long long>(drive.numSteps), static_cast<unsigned long long>(drive.numReversals),
+        drive.averageStepsPerSecond(), drive.maxStepsPerSecond(), drive.resetCollisions.size());
+  }
+}
+
+// Writes p50/p99/max of both timing histograms of every sink used by the engine, "-" selects stdout:
+static bool writeTimingCsv(const PlaybackEngine& engine, const std::string& path) {
+  FILE* pFile = path == "-" ? stdout : fopen(path.c_str(), "w");
+
+  if (!pFile) {
+    printf("Error on opening timing output '%s'!\n", path.c_str());
+    return false;
+  }
+
+  fprintf(pFile, "sink,metric,count,p50_us,p99_us,max_us\n");
+
+  for (const std::unique_ptr<SinkTiming>& pTiming : engine.sinkTimings()) {
+    const LatencyStats lateness = pTiming->lateness.stats();
+    const LatencyStats sendDuration = pTiming->sendDuration.stats();
+
+    fprintf(pFile, "%s,lateness,%llu,%llu,%llu,%llu\n", pTiming->sinkName.c_str(),
+        static_cast<unsigned long long>(lateness.count), static_cast<unsigned long long>(lateness.p50Us),
+        static_cast<unsigned long long>(lateness.p99Us), static_cast<unsigned long long>(lateness.maxUs));
+    fprintf(pFile, "%s,send,%llu,%llu,%llu,%llu\n", pTiming->sinkName.c_str(),
+        static_cast<unsigned long long>(sendDuration.count), static_cast<unsigned long long>(sendDuration.p50Us),
+        static_cast<unsigned long long>(sendDuration.p99Us), static_cast<unsigned long long>(sendDuration.maxUs));
+  }
+
+  if (pFile != stdout)
+    fclose(pFile);
+
+  return true;
+}
+
+// Plays all converted files one after another in real time:
+static bool playFiles(const BatchOptions& options, const std::vector<FileReport>& reports) {
+  std::unique_ptr<PlaybackSink> pSink;
+
+  if (options.playbackOutput == "null") {
+    pSink.reset(new NullSink);
+  }
+  else if (options.numFloppyDrives > 0) {
+    FloppySink* pFloppySink = new FloppySink(options.numFloppyDrives);
+    pSink.reset(pFloppySink);
+
+    if (!pFloppySink->open(options.playbackOutput)) {
+      printf("Error on opening serial port '%s'!\n", options.playbackOutput.c_str());
+      return false;
+    }
+  }
+  else {
+    StreamSink* pStreamSink = new StreamSink(options.playbackFormat);
+    pSink.reset(pStreamSink);
+
+    if (!pStreamSink->open(options.playbackOutput)) {
+      printf("Error on opening playback output '%s'!\n", options.playbackOutput.c_str());
+      return false;
+    }
+  }
+
+  PlaybackEngine engine(std::move(pSink));
+
+  for (size_t fileNo = 0; fileNo < options.paths.size(); ++fileNo) {
+    Song song;
+
+    if (!reports[fileNo].hasSucceeded || !song.importFromMidi(options.paths[fileNo]))
+      continue;
+
+    std::shared_ptr<PlaybackSchedule> pSchedule = std::make_shared<PlaybackSchedule>();
+    VoiceAllocation allocation;
+
+    if (options.isVoiceAllocated) {
+      const Clock::time_point allocationStart = Clock::now();
+      allocation.allocate(song, allocationOptionsFor(options, song));
+
+      fprintf(stderr, "Allocated %zu notes onto %zu drives in %.3f ms: %zu stolen, %zu dropped\n",
+          allocation.numNotes(), allocation.numVoices(), millisecondsSince(allocationStart), allocation.numStolen(),
+          allocation.numDropped());
+    }
+
+    pSchedule->build(song, options.isVoiceAllocated ? &allocation : nullptr);
+
+    fprintf(stderr, "Playing %s...\n", options.paths[fileNo].c_str());
+
+    engine.setSchedule(pSchedule);
+    engine.seek(0);
+    engine.play();
+
+    while (engine.isPlaying())
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  return options.timingCsvPath.empty() || writeTimingCsv(engine, options.timingCsvPath);
+}
+
+static bool readFileList(const std::string& listPath, std::vector<std::string>& paths) {
+  std::ifstream list(listPath);
+
+  if (!list) {
+    printf("Error on opening file list '%s'!\n", listPath.c_str());
+    return false;
+  }
+
+  for (std::string line; std::getline(list, line);) {
+    line.erase(line.find_last_not_of(" \t\r\n") + 1);
+
+    if (!line.empty() && line[0] != '#')
+      paths.push_back(line);
+  }
+
+  return true;
+}
+
+static void printUsage(const char* pProgramName) {
+  printf("Usage: %s [-j threads] [-o output directory] [-w WAV directory] [-b bytecode directory] [-m]\n"
+         "       [-p playback output [-r | -d drives [-a allocation]] [-t timing CSV]]\n"
+         "       [-l file list] [MIDI files...]\n\n"
+         "Imports and analyzes all given MIDI files. With -o, every file is exported as MIDI type 0\n"
+         "file into the output directory. With -w, every file is rendered into a WAV file, which\n"
+         "approximates its sound on floppy drives. With -b, every file is compiled into floppy\n"
+         "bytecode, which floppy controllers play without parsing. With -p, all files are played in\n"
+         "real time into a file or pipe, \"-\" for stdout or \"null\", as text or as raw MIDI bytes with\n"
+         "-r. With -d, the playback output is the serial port of a floppy controller with the given\n"
+         "number of drives. With -a, the notes of all tracks are spread over the drives: \"oldest\"\n"
+         "steals the drive playing the longest, \"highest\" keeps the highest notes, \"drop\" drops new\n"
+         "notes and \"pools\" gives every track its own share of drives. With -t, the timing statistics\n"
+         "of the playback are written as CSV file, \"-\" for stdout. With -m, the heads of the drives\n"
+         "are simulated to estimate the drive time, the stepping rates and where a reset of a drive\n"
+         "would delay its next note. Bytecode and simulation use the drives and allocation of -d and\n"
+         "-a. A file list contains one path per line.\n",
+         pProgramName);
+}
+
+static bool parseArguments(int argc, char** argv, BatchOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    const bool hasValue = i + 1 < argc;
+
+    if (strcmp(argv[i], "-j") == 0 && hasValue)
+      options.numThreads = static_cast<size_t>(std::max(0, atoi(argv[++i])));
+    else if (strcmp(argv[i], "-o") == 0 && hasValue)
+      options.outputDirectory = argv[++i];
+    else if (strcmp(argv[i], "-w") == 0 && hasValue)
+      options.wavDirectory = argv[++i];
+    else if (strcmp(argv[i], "-p") == 0 && hasValue)
+      options.playbackOutput = argv[++i];
+    else if (strcmp(argv[i], "-b") == 0 && hasValue)
+      options.bytecodeDirectory = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0)
+      options.isHeadSimulated = true;
+    else if (strcmp(argv[i], "-r") == 0)
+      options.playbackFormat = StreamSink::Format::Raw;
+    else if (strcmp(argv[i], "-t") == 0 && hasValue)
+      options.timingCsvPath = argv[++i];
+    else if (strcmp(argv[i], "-d") == 0 && hasValue)
+      options.numFloppyDrives = static_cast<size_t>(std::max(0, atoi(argv[++i])));
+    else if (strcmp(argv[i], "-a") == 0 && hasValue) {
+      const char* pPolicy = argv[++i];
+      options.isVoiceAllocated = true;
+      options.hasPoolPerTrack = strcmp(pPolicy, "pools") == 0;
+
+      if (strcmp(pPolicy, "oldest") == 0 || options.hasPoolPerTrack)
+        options.allocationPolicy = VoiceAllocationOptions::Policy::StealOldest;
+      else if (strcmp(pPolicy, "highest") == 0)
+        options.allocationPolicy = VoiceAllocationOptions::Policy::HighestNote;
+      else if (strcmp(pPolicy, "drop") == 0)
+        options.allocationPolicy = VoiceAllocationOptions::Policy::Drop;
+      else
+        return false;
+    }
+    else if (strcmp(argv[i], "-l") == 0 && hasValue) {
+      if (!readFileList(argv[++i], options.paths))
+        return false;
+    }
+    else if (argv[i][0] == '-')
+      return false;
+    else
+      options.paths.push_back(argv[i]);
+  }
+
+  // Voices are floppy drives, so there is nothing to allocate without them:
+  if (options.isVoiceAllocated && options.numFloppyDrives == 0)
+    return false;
+
+  return !options.paths.empty();
+}
+
+int main(int argc, char** argv) {
+  BatchOptions options;
+
+  if (!parseArguments(argc, argv, options)) {
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  std::vector<FileReport> reports(options.paths.size());
+  std::mutex printMutex;
+  size_t numFinished = 0;
+
+  const Clock::time_point start = Clock::now();
+  ThreadPool pool(options.numThreads);
+
+  // Every file gets its own report slot, only printing needs to be serialized:
+  for (size_t fileNo = 0; fileNo < options.paths.size(); ++fileNo) {
+    pool.submit([&, fileNo]() {
+      convertFile(options, options.paths[fileNo], reports[fileNo]);
+
+      std::lock_guard<std::mutex> lock(printMutex);
+      printReport(++numFinished, options.paths.size(), options.paths[fileNo], reports[fileNo]);
+    });
+  }
+
+  pool.wait();
+
+  const double totalSeconds = millisecondsSince(start) / 1000;
+  size_t numSucceeded = 0;
+  uint64_t totalBytes = 0;
+  uint64_t totalNotes = 0;
+
+  for (const FileReport& report : reports) {
+    if (!report.hasSucceeded)
+      continue;
+
+    ++numSucceeded;
+    totalBytes += report.fileSize;
+    totalNotes += report.numNotes;
+  }
+
+  printf("\nConverted %zu of %zu file(s) in %.3f s using %zu thread(s): %.1f files/s, %.1f MB/s, %.0f notes/s\n",
+      numSucceeded, reports.size(), totalSeconds, pool.numThreads(), numSucceeded / totalSeconds,
+      totalBytes / (1024.0 * 1024.0) / totalSeconds, totalNotes / totalSeconds);
+
+  if (!options.playbackOutput.empty() && !playFiles(options, reports))
+    return 1;
+
+  return numSucceeded == reports.size() ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <functional>
+
+#include "eventmerger.h"
+
+//-------------------------------------------------------------------------------------------------
+// SongEventMerger
+//-------------------------------------------------------------------------------------------------
+
+bool SongEventMerger::Head::operator > (const Head& rhs) const {
+  if (tick != rhs.tick)
+    return tick > rhs.tick;
+
+  if (type != rhs.type)
+    return type > rhs.type;
+
+  if (trackNo != rhs.trackNo)
+    return trackNo > rhs.trackNo;
+
+  return index > rhs.index;
+}
+
+SongEventMerger::SongEventMerger(const Song& song, const VoiceAllocation* pAllocation)
+    : song_(song), pAllocation_(pAllocation) {
+  heap_.reserve(song_.numberOfTracks() * 4 + 1);
+
+  pushNext(MergedEvent::Type::SetTempo, -1, 0);
+
+  for (int trackNo = 0; trackNo < static_cast<int>(song_.numberOfTracks()); ++trackNo) {
+    pushNext(MergedEvent::Type::NoteOn, trackNo, 0);
+    pushNext(MergedEvent::Type::ProgramChange, trackNo, 0);
+    pushNext(MergedEvent::Type::PitchBend, trackNo, 0);
+  }
+}
+
+void SongEventMerger::push(const Head& head) {
+  heap_.push_back(head);
+  std::push_heap(heap_.begin(), heap_.end(), std::greater<Head>());
+}
+
+void SongEventMerger::pushNext(MergedEvent::Type type, int trackNo, uint32_t index) {
+  const TrackEventStore& events = trackNo < 0 ? song_.metaTrack()->events() : song_.track(trackNo)->events();
+
+  switch (type) {
+    case MergedEvent::Type::SetTempo:
+      if (index < events.tempoChanges().size())
+        push({events.tempoChanges()[index].startTick, type, trackNo, index});
+
+      break;
+
+    case MergedEvent::Type::NoteOn:
+      if (index < events.notes().size())
+        push({events.notes().startTick(index), type, trackNo, index});
+
+      break;
+
+    case MergedEvent::Type::ProgramChange:
+      if (index < events.programChanges().size())
+        push({events.programChanges()[index].startTick, type, trackNo, index});
+
+      break;
+
+    case MergedEvent::Type::PitchBend:
+      if (index < events.pitchBends().size())
+        push({events.pitchBends()[index].startTick, type, trackNo, index});
+
+      break;
+
+    case MergedEvent::Type::NoteOff:
+      break;
+  }
+}
+
+bool SongEventMerger::isDropped(const Head& head) const {
+  return pAllocation_ && head.type == MergedEvent::Type::NoteOn &&
+      pAllocation_->voice(head.trackNo, head.index) == VoiceAllocation::NoVoice;
+}
+
+bool SongEventMerger::next(MergedEvent& event) {
+  Head head;
+
+  for (;;) {
+    if (heap_.empty())
+      return false;
+
+    std::pop_heap(heap_.begin(), heap_.end(), std::greater<Head>());
+    head = heap_.back();
+    heap_.pop_back();
+
+    // Notes without a voice are skipped along with their note off:
+    if (!isDropped(head))
+      break;
+
+    pushNext(head.type, head.trackNo, head.index + 1);
+  }
+
+  event = MergedEvent();
+  event.tick = head.tick;
+  event.type = head.type;
+  event.trackNo = head.trackNo;
+
+  if (head.trackNo < 0) {
+    event.usPerQuarterNote = song_.metaTrack()->events().tempoChanges()[head.index].usPerQuarterNote;
+    pushNext(head.type, head.trackNo, head.index + 1);
+
+    return true;
+  }
+
+  const ChannelTrack* pTrack = song_.track(head.trackNo);
+  const TrackEventStore& events = pTrack->events();
+  event.midiChannel = static_cast<uint8_t>(pTrack->midiChannel());
+
+  switch (head.type) {
+    case MergedEvent::Type::NoteOn: {
+      const uint32_t endTick = pAllocation_ ? pAllocation_->endTick(head.trackNo, head.index) : events.notes().endTick(head.index);
+      event.note = events.notes().note(head.index);
+      event.voice = pAllocation_ ? pAllocation_->voice(head.trackNo, head.index) : VoiceAllocation::NoVoice;
+
+      // The note off is generated right away, it becomes a source of its own until it is due:
+      push({endTick, MergedEvent::Type::NoteOff, head.trackNo, head.index});
+      pushNext(head.type, head.trackNo, head.index + 1);
+      break;
+    }
+
+    case MergedEvent::Type::NoteOff:
+      event.note = events.notes().note(head.index);
+      event.voice = pAllocation_ ? pAllocation_->voice(head.trackNo, head.index) : VoiceAllocation::NoVoice;
+      break;
+
+    case MergedEvent::Type::ProgramChange:
+      event.programNumber = events.programChanges()[head.index].programNumber;
+      pushNext(head.type, head.trackNo, head.index + 1);
+      break;
+
+    case MergedEvent::Type::PitchBend:
+      event.pitchBendValue = events.pitchBends()[head.index].pitchBendValue;
+      pushNext(head.type, head.trackNo, head.index + 1);
+      break;
+
+    case MergedEvent::Type::SetTempo:
+      break;
+  }
+
+  return true;
+}
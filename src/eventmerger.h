@@ -0,0 +1,72 @@
+#ifndef _EVENT_MERGER_H
+#define _EVENT_MERGER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "song.h"
+#include "voiceallocator.h"
+
+//-------------------------------------------------------------------------------------------------
+// MergedEvent
+//-------------------------------------------------------------------------------------------------
+
+struct MergedEvent {
+  // Events sharing the same tick are emitted in this order:
+  enum class Type : uint8_t {
+    SetTempo,
+    NoteOff,
+    ProgramChange,
+    PitchBend,
+    NoteOn
+  };
+
+  uint32_t tick{0};
+  Type type{Type::SetTempo};
+  int trackNo{-1};           // -1 for events of the meta track
+  uint8_t midiChannel{0};
+  uint8_t note{0};           // NoteOn, NoteOff
+  int8_t voice{VoiceAllocation::NoVoice}; // NoteOn, NoteOff when merged with a voice allocation
+  uint8_t programNumber{0};  // ProgramChange
+  uint16_t pitchBendValue{0};// PitchBend
+  uint32_t usPerQuarterNote{0}; // SetTempo
+};
+
+//-------------------------------------------------------------------------------------------------
+// SongEventMerger
+//-------------------------------------------------------------------------------------------------
+
+// Streams all playable events of a song in tick order. Every event array of every track is a tick
+// sorted source, note offs are generated from the note blocks as their note ons pass by. The
+// sources are merged through a heap, which only holds the head of every source and the note offs
+// of currently sounding notes, so memory use doesn't grow with the length of the song.
+//
+// With a voice allocation, notes are played on their voice: dropped notes are skipped and stolen
+// notes end early. The song must not be modified while it is being merged.
+class SongEventMerger {
+public:
+  SongEventMerger(const Song& song, const VoiceAllocation* pAllocation = nullptr);
+
+  // Returns false once all events have been emitted:
+  bool next(MergedEvent& event);
+
+private:
+  struct Head {
+    bool operator > (const Head& rhs) const;
+
+    uint32_t tick;
+    MergedEvent::Type type;
+    int trackNo;
+    uint32_t index;  // position of the event inside its array
+  };
+
+  void push(const Head& head);
+  void pushNext(MergedEvent::Type type, int trackNo, uint32_t index);
+  bool isDropped(const Head& head) const;
+
+  const Song& song_;
+  const VoiceAllocation* const pAllocation_;
+  std::vector<Head> heap_;
+};
+
+#endif // _EVENT_MERGER_H
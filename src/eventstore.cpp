@@ -0,0 +1,590 @@
+#include <atomic>
+
+#include "eventstore.h"
+
+//-------------------------------------------------------------------------------------------------
+// EventHandle
+//-------------------------------------------------------------------------------------------------
+
+const uint32_t EventHandle::InvalidId;
+
+//-------------------------------------------------------------------------------------------------
+// HandleTable
+//-------------------------------------------------------------------------------------------------
+
+bool HandleTable::contains(EventHandle handle) const {
+  return handle.isValid() && handle.id < idToIndex_.size() && idToIndex_[handle.id] != EventHandle::InvalidId;
+}
+
+void HandleTable::clear() {
+  idToIndex_.clear();
+  indexToId_.clear();
+  freeIds_.clear();
+}
+
+void HandleTable::reserve(size_t size) {
+  idToIndex_.reserve(size);
+  indexToId_.reserve(size);
+}
+
+void HandleTable::assign(size_t size) {
+  idToIndex_.resize(size);
+  indexToId_.resize(size);
+  freeIds_.clear();
+
+  for (size_t index = 0; index < size; ++index) {
+    idToIndex_[index] = static_cast<uint32_t>(index);
+    indexToId_[index] = static_cast<uint32_t>(index);
+  }
+}
+
+EventHandle HandleTable::insert(size_t index) {
+  uint32_t id;
+
+  if (!freeIds_.empty()) {
+    id = freeIds_.back();
+    freeIds_.pop_back();
+  }
+  else {
+    id = static_cast<uint32_t>(idToIndex_.size());
+    idToIndex_.push_back(EventHandle::InvalidId);
+  }
+
+  indexToId_.insert(indexToId_.begin() + index, id);
+  reindex(index, indexToId_.size());
+
+  return EventHandle(id);
+}
+
+void HandleTable::erase(size_t index) {
+  const uint32_t id = indexToId_[index];
+
+  idToIndex_[id] = EventHandle::InvalidId;
+  freeIds_.push_back(id);
+
+  indexToId_.erase(indexToId_.begin() + index);
+  reindex(index, indexToId_.size());
+}
+
+void HandleTable::move(size_t from, size_t to) {
+  moveElement(indexToId_, from, to);
+  reindex(std::min(from, to), std::max(from, to) + 1);
+}
+
+void HandleTable::permute(size_t first, const std::vector<uint32_t>& order) {
+  std::vector<uint32_t> ids(order.size());
+
+  for (size_t i = 0; i < order.size(); ++i)
+    ids[i] = indexToId_[first + order[i]];
+
+  std::copy(ids.begin(), ids.end(), indexToId_.begin() + first);
+  reindex(first, first + order.size());
+}
+
+void HandleTable::reindex(size_t first, size_t last) {
+  for (size_t index = first; index < last; ++index)
+    idToIndex_[indexToId_[index]] = static_cast<uint32_t>(index);
+}
+
+uint64_t nextRevision() {
+  static std::atomic<uint64_t> lastRevision{0};
+
+  return ++lastRevision;
+}
+
+std::vector<uint32_t> sortedOrder(const std::vector<uint32_t>& ticks) {
+  std::vector<uint32_t> order(ticks.size());
+
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = static_cast<uint32_t>(i);
+
+  std::stable_sort(order.begin(), order.end(), [&ticks](uint32_t lhs, uint32_t rhs) { return ticks[lhs] < ticks[rhs]; });
+
+  return order;
+}
+
+size_t sortedPosition(const std::vector<uint32_t>& ticks, size_t index, uint32_t newTick) {
+  if (newTick > ticks[index])
+    return std::upper_bound(ticks.begin() + index + 1, ticks.end(), newTick) - ticks.begin() - 1;
+  else if (newTick < ticks[index])
+    return std::upper_bound(ticks.begin(), ticks.begin() + index, newTick) - ticks.begin();
+
+  return index;
+}
+
+//-------------------------------------------------------------------------------------------------
+// HandleSet
+//-------------------------------------------------------------------------------------------------
+
+void HandleSet::insert(EventHandle handle) {
+  if (contains(handle))
+    return;
+
+  if (handle.id / 64 >= bits_.size())
+    bits_.resize(handle.id / 64 + 1, 0);
+
+  bits_[handle.id / 64] |= uint64_t(1) << (handle.id % 64);
+  handles_.push_back(handle);
+}
+
+void HandleSet::erase(EventHandle handle) {
+  if (!contains(handle))
+    return;
+
+  bits_[handle.id / 64] &= ~(uint64_t(1) << (handle.id % 64));
+
+  // The order of the members doesn't matter, so the last one fills the gap:
+  auto it = std::find(handles_.begin(), handles_.end(), handle);
+  *it = handles_.back();
+  handles_.pop_back();
+}
+
+void HandleSet::clear() {
+  // Every word holding a member gets cleared as a whole, so the size of the array never matters:
+  for (EventHandle handle : handles_)
+    bits_[handle.id / 64] = 0;
+
+  handles_.clear();
+}
+
+//-------------------------------------------------------------------------------------------------
+// NoteIntervalIndex
+//-------------------------------------------------------------------------------------------------
+
+void NoteIntervalIndex::clear() {
+  for (Bucket& bucket : buckets_) {
+    bucket.entries.clear();
+    bucket.maxLength = 0;
+  }
+}
+
+void NoteIntervalIndex::insert(uint8_t note, uint32_t startTick, uint32_t endTick, EventHandle handle) {
+  Bucket& bucket = buckets_[note & 0x7F];
+
+  auto tickLess = [](uint32_t tick, const Entry& entry) { return tick < entry.startTick; };
+  auto it = std::upper_bound(bucket.entries.begin(), bucket.entries.end(), startTick, tickLess);
+
+  bucket.entries.insert(it, {startTick, endTick, handle});
+  bucket.maxLength = std::max(bucket.maxLength, endTick - startTick);
+}
+
+std::vector<NoteIntervalIndex::Entry>::iterator NoteIntervalIndex::find(Bucket& bucket, uint32_t startTick,
+    EventHandle handle) {
+
+  auto tickLess = [](const Entry& entry, uint32_t tick) { return entry.startTick < tick; };
+  auto it = std::lower_bound(bucket.entries.begin(), bucket.entries.end(), startTick, tickLess);
+
+  while (it != bucket.entries.end() && it->handle != handle)
+    ++it;
+
+  return it;
+}
+
+void NoteIntervalIndex::erase(uint8_t note, uint32_t startTick, EventHandle handle) {
+  Bucket& bucket = buckets_[note & 0x7F];
+  auto it = find(bucket, startTick, handle);
+
+  if (it != bucket.entries.end())
+    bucket.entries.erase(it);
+}
+
+void NoteIntervalIndex::setEndTick(uint8_t note, uint32_t startTick, uint32_t endTick, EventHandle handle) {
+  Bucket& bucket = buckets_[note & 0x7F];
+  auto it = find(bucket, startTick, handle);
+
+  if (it != bucket.entries.end()) {
+    it->endTick = endTick;
+    bucket.maxLength = std::max(bucket.maxLength, endTick - startTick);
+  }
+}
+
+void NoteIntervalIndex::query(uint32_t firstTick, uint32_t lastTick, uint8_t lowestNote, uint8_t highestNote,
+    std::vector<EventHandle>& result) const {
+
+  auto tickLess = [](const Entry& entry, uint32_t tick) { return entry.startTick < tick; };
+
+  for (int note = lowestNote; note <= highestNote && note < 128; ++note) {
+    const Bucket& bucket = buckets_[note];
+
+    if (bucket.entries.empty())
+      continue;
+
+    // No block starting before this tick can reach into the queried range:
+    const uint32_t earliestStart = firstTick > bucket.maxLength ? firstTick - bucket.maxLength : 0;
+    auto it = std::lower_bound(bucket.entries.begin(), bucket.entries.end(), earliestStart, tickLess);
+
+    for (; it != bucket.entries.end() && it->startTick <= lastTick; ++it) {
+      if (it->endTick > firstTick)
+        result.push_back(it->handle);
+    }
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+// NoteArray
+//-------------------------------------------------------------------------------------------------
+
+void NoteArray::clear() {
+  startTicks_.clear();
+  numTicks_.clear();
+  notes_.clear();
+  selection_.clear();
+  handles_.clear();
+  revision_ = nextRevision();
+
+  index_.clear();
+  isIndexValid_ = false;
+}
+
+void NoteArray::reserve(size_t size) {
+  startTicks_.reserve(size);
+  numTicks_.reserve(size);
+  notes_.reserve(size);
+  handles_.reserve(size);
+}
+
+void NoteArray::assign(std::vector<uint32_t> startTicks, std::vector<uint32_t> numTicks, std::vector<uint8_t> notes) {
+  if (!std::is_sorted(startTicks.begin(), startTicks.end())) {
+    const std::vector<uint32_t> order = sortedOrder(startTicks);
+
+    auto permute = [&order](auto& column) {
+      std::remove_reference_t<decltype(column)> sorted(column.size());
+
+      for (size_t i = 0; i < order.size(); ++i)
+        sorted[i] = column[order[i]];
+
+      column.swap(sorted);
+    };
+
+    permute(startTicks);
+    permute(numTicks);
+    permute(notes);
+  }
+
+  startTicks_ = std::move(startTicks);
+  numTicks_ = std::move(numTicks);
+  notes_ = std::move(notes);
+  selection_.clear();
+  handles_.assign(startTicks_.size());
+  revision_ = nextRevision();
+
+  index_.clear();
+  isIndexValid_ = false;
+}
+
+EventHandle NoteArray::insert(uint32_t startTick, uint32_t numTicks, uint8_t note) {
+  const size_t index = std::upper_bound(startTicks_.begin(), startTicks_.end(), startTick) - startTicks_.begin();
+
+  startTicks_.insert(startTicks_.begin() + index, startTick);
+  numTicks_.insert(numTicks_.begin() + index, numTicks);
+  notes_.insert(notes_.begin() + index, note);
+  revision_ = nextRevision();
+
+  const EventHandle handle = handles_.insert(index);
+
+  if (isIndexValid_)
+    index_.insert(note, startTick, startTick + numTicks, handle);
+
+  return handle;
+}
+
+void NoteArray::erase(EventHandle handle) {
+  const size_t index = handles_.indexOf(handle);
+
+  if (isIndexValid_)
+    index_.erase(notes_[index], startTicks_[index], handle);
+
+  startTicks_.erase(startTicks_.begin() + index);
+  numTicks_.erase(numTicks_.begin() + index);
+  notes_.erase(notes_.begin() + index);
+  handles_.erase(index);
+
+  // Ids of erased handles get recycled, so they must not stay selected:
+  selection_.erase(handle);
+  revision_ = nextRevision();
+}
+
+void NoteArray::setStartTick(EventHandle handle, uint32_t startTick) {
+  const size_t index = handles_.indexOf(handle);
+  const size_t newIndex = sortedPosition(startTicks_, index, startTick);
+
+  if (isIndexValid_) {
+    index_.erase(notes_[index], startTicks_[index], handle);
+    index_.insert(notes_[index], startTick, startTick + numTicks_[index], handle);
+  }
+
+  startTicks_[index] = startTick;
+  revision_ = nextRevision();
+
+  if (newIndex == index)
+    return;
+
+  moveElement(startTicks_, index, newIndex);
+  moveElement(numTicks_, index, newIndex);
+  moveElement(notes_, index, newIndex);
+  handles_.move(index, newIndex);
+}
+
+void NoteArray::setNumTicks(EventHandle handle, uint32_t numTicks) {
+  const size_t index = handles_.indexOf(handle);
+
+  if (isIndexValid_)
+    index_.setEndTick(notes_[index], startTicks_[index], startTicks_[index] + numTicks, handle);
+
+  numTicks_[index] = numTicks;
+  revision_ = nextRevision();
+}
+
+void NoteArray::setNote(EventHandle handle, uint8_t note) {
+  const size_t index = handles_.indexOf(handle);
+
+  if (isIndexValid_ && note != notes_[index]) {
+    index_.erase(notes_[index], startTicks_[index], handle);
+    index_.insert(note, startTicks_[index], endTick(index), handle);
+  }
+
+  notes_[index] = note;
+  revision_ = nextRevision();
+}
+
+void NoteArray::select(EventHandle handle) {
+  selection_.insert(handle);
+}
+
+void NoteArray::unselect(EventHandle handle) {
+  selection_.erase(handle);
+}
+
+void NoteArray::unselectAll() {
+  selection_.clear();
+}
+
+void NoteArray::selectRange(uint32_t firstTick, uint32_t lastTick, uint8_t lowestNote, uint8_t highestNote) {
+  std::vector<EventHandle> blocks;
+  query(firstTick, lastTick, lowestNote, highestNote, blocks);
+
+  for (EventHandle handle : blocks)
+    selection_.insert(handle);
+}
+
+void NoteArray::moveSelection(int32_t deltaTicks, int deltaNotes) {
+  int64_t lowestStartTick = INT64_MAX;
+  int lowestNote = 127;
+  int highestNote = 0;
+
+  for (EventHandle handle : selection_.handles()) {
+    const size_t index = handles_.indexOf(handle);
+    lowestStartTick = std::min<int64_t>(lowestStartTick, startTicks_[index]);
+    lowestNote = std::min<int>(lowestNote, notes_[index]);
+    highestNote = std::max<int>(highestNote, notes_[index]);
+  }
+
+  deltaTicks = static_cast<int32_t>(std::max<int64_t>(deltaTicks, -lowestStartTick));
+  deltaNotes = std::min(std::max(deltaNotes, -lowestNote), 127 - highestNote);
+
+  editSelection(deltaTicks, deltaTicks, deltaNotes);
+}
+
+void NoteArray::resizeSelection(int32_t deltaStartTicks, int32_t deltaEndTicks) {
+  int64_t lowestStartTick = INT64_MAX;
+  int64_t shortestNumTicks = INT64_MAX;
+
+  for (EventHandle handle : selection_.handles()) {
+    const size_t index = handles_.indexOf(handle);
+    lowestStartTick = std::min<int64_t>(lowestStartTick, startTicks_[index]);
+    shortestNumTicks = std::min<int64_t>(shortestNumTicks, numTicks_[index]);
+  }
+
+  // Blocks of zero ticks, e.g. imported from a note on and off at the same tick, must not shrink
+  // any further, but don't force the others to move either:
+  shortestNumTicks = std::max<int64_t>(shortestNumTicks, 1);
+
+  deltaStartTicks = static_cast<int32_t>(std::min<int64_t>(std::max<int64_t>(deltaStartTicks, -lowestStartTick), shortestNumTicks - 1));
+  deltaEndTicks = static_cast<int32_t>(std::max<int64_t>(deltaEndTicks, deltaStartTicks + 1 - shortestNumTicks));
+
+  editSelection(deltaStartTicks, deltaEndTicks, 0);
+}
+
+void NoteArray::editSelection(int32_t deltaStartTicks, int32_t deltaEndTicks, int deltaNotes) {
+  if (selection_.empty() || (deltaStartTicks == 0 && deltaEndTicks == 0 && deltaNotes == 0))
+    return;
+
+  // Large selections are cheaper to index again from scratch than entry by entry:
+  if (isIndexValid_ && selection_.size() * 8 > size()) {
+    index_.clear();
+    isIndexValid_ = false;
+  }
+
+  if (isIndexValid_) {
+    for (EventHandle handle : selection_.handles()) {
+      const size_t index = handles_.indexOf(handle);
+      index_.erase(notes_[index], startTicks_[index], handle);
+    }
+  }
+
+  std::vector<uint32_t> indices;
+  indices.reserve(selection_.size());
+
+  for (EventHandle handle : selection_.handles())
+    indices.push_back(static_cast<uint32_t>(handles_.indexOf(handle)));
+
+  std::sort(indices.begin(), indices.end());
+
+  // All selected blocks move by the same offset, so they stay sorted among each other, just like
+  // the unselected ones. Only the range between both positions of the selection needs a merge:
+  size_t first = indices.front();
+  size_t last = indices.back() + 1;
+
+  if (deltaStartTicks != 0) {
+    const uint32_t newFirstTick = startTicks_[indices.front()] + deltaStartTicks;
+    const uint32_t newLastTick = startTicks_[indices.back()] + deltaStartTicks;
+
+    first = std::min<size_t>(first, std::lower_bound(startTicks_.begin(), startTicks_.end(), newFirstTick) - startTicks_.begin());
+    last = std::max<size_t>(last, std::upper_bound(startTicks_.begin(), startTicks_.end(), newLastTick) - startTicks_.begin());
+  }
+
+  // One pass over the columns:
+  for (uint32_t index : indices) {
+    startTicks_[index] += deltaStartTicks;
+    numTicks_[index] += deltaEndTicks - deltaStartTicks;
+    notes_[index] = static_cast<uint8_t>(notes_[index] + deltaNotes);
+  }
+
+  if (deltaStartTicks != 0) {
+    // Blocks moved onto the tick of unselected ones go behind them, like a single moved block does:
+    std::vector<uint32_t> order;
+    order.reserve(last - first);
+
+    size_t selectedNo = 0;
+    size_t unselectedIndex = first;
+
+    auto skipSelected = [&]() {
+      while (selectedNo < indices.size() && unselectedIndex == indices[selectedNo]) {
+        ++unselectedIndex;
+        ++selectedNo;
+      }
+    };
+
+    size_t mergedNo = 0;
+    skipSelected();
+
+    while (order.size() < last - first) {
+      const bool isUnselectedNext = unselectedIndex < last &&
+          (mergedNo == indices.size() || startTicks_[unselectedIndex] <= startTicks_[indices[mergedNo]]);
+
+      if (isUnselectedNext) {
+        order.push_back(static_cast<uint32_t>(unselectedIndex - first));
+        ++unselectedIndex;
+        skipSelected();
+      }
+      else
+        order.push_back(indices[mergedNo++] - static_cast<uint32_t>(first));
+    }
+
+    auto permute = [first, &order](auto& column) {
+      std::remove_reference_t<decltype(column)> window(order.size());
+
+      for (size_t i = 0; i < order.size(); ++i)
+        window[i] = column[first + order[i]];
+
+      std::copy(window.begin(), window.end(), column.begin() + first);
+    };
+
+    permute(startTicks_);
+    permute(numTicks_);
+    permute(notes_);
+    handles_.permute(first, order);
+  }
+
+  if (isIndexValid_) {
+    for (EventHandle handle : selection_.handles()) {
+      const size_t index = handles_.indexOf(handle);
+      index_.insert(notes_[index], startTicks_[index], endTick(index), handle);
+    }
+  }
+
+  revision_ = nextRevision();
+}
+
+void NoteArray::query(uint32_t firstTick, uint32_t lastTick, uint8_t lowestNote, uint8_t highestNote,
+    std::vector<EventHandle>& result) const {
+
+  if (!isIndexValid_)
+    buildIndex();
+
+  index_.query(firstTick, lastTick, lowestNote, highestNote, result);
+}
+
+void NoteArray::buildIndex() const {
+  index_.clear();
+
+  // Notes are visited in tick order, so every bucket insertion is an append:
+  for (size_t i = 0; i < startTicks_.size(); ++i)
+    index_.insert(notes_[i], startTicks_[i], endTick(i), handles_.handleAt(i));
+
+  isIndexValid_ = true;
+}
+
+//-------------------------------------------------------------------------------------------------
+// TrackEventStore
+//-------------------------------------------------------------------------------------------------
+
+void TrackEventStore::clear() {
+  notes_.clear();
+  programChanges_.clear();
+  pitchBends_.clear();
+  tempoChanges_.clear();
+  notImplemented_.clear();
+}
+
+bool TrackEventStore::empty() const {
+  return size() == 0;
+}
+
+size_t TrackEventStore::size() const {
+  return notes_.size() + programChanges_.size() + pitchBends_.size() + tempoChanges_.size() +
+      notImplemented_.size();
+}
+
+uint64_t TrackEventStore::revision() const {
+  uint64_t revision = notes_.revision();
+
+  revision = std::max(revision, programChanges_.revision());
+  revision = std::max(revision, pitchBends_.revision());
+  revision = std::max(revision, tempoChanges_.revision());
+  revision = std::max(revision, notImplemented_.revision());
+
+  return revision;
+}
+
+const EventStoreStats& TrackEventStore::stats() const {
+  const uint64_t currentRevision = revision();
+
+  if (statsRevision_ == currentRevision)
+    return stats_;
+
+  EventStoreStats stats;
+  stats.numNotes = notes_.size();
+  stats.lowestNote = 127;
+
+  for (size_t i = 0; i < notes_.size(); ++i) {
+    stats.audibleEndTick = std::max(stats.audibleEndTick, notes_.endTick(i));
+    stats.lowestNote = std::min(stats.lowestNote, notes_.note(i));
+    stats.highestNote = std::max(stats.highestNote, notes_.note(i));
+  }
+
+  if (notes_.empty())
+    stats.lowestNote = 0;
+
+  stats.audibleEndTick = std::max(stats.audibleEndTick, notImplemented_.endTick());
+
+  stats.endTick = stats.audibleEndTick;
+  stats.endTick = std::max(stats.endTick, programChanges_.endTick());
+  stats.endTick = std::max(stats.endTick, pitchBends_.endTick());
+  stats.endTick = std::max(stats.endTick, tempoChanges_.endTick());
+
+  stats_ = stats;
+  statsRevision_ = currentRevision;
+
+  return stats_;
+}
@@ -0,0 +1,371 @@
+#ifndef _EVENT_STORE_H
+#define _EVENT_STORE_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+//-------------------------------------------------------------------------------------------------
+// EventHandle
+//-------------------------------------------------------------------------------------------------
+
+// Stable reference to a single event of an event array. It stays valid while the event changes its
+// position inside the array due to edits and becomes invalid once the event gets removed. A handle
+// is only meaningful for the array which has issued it.
+struct EventHandle {
+  static const uint32_t InvalidId = 0xFFFFFFFF;
+
+  EventHandle() {}
+  explicit EventHandle(uint32_t id) : id(id) {}
+
+  bool isValid() const                            { return id != InvalidId; }
+  bool operator == (const EventHandle& rhs) const { return id == rhs.id; }
+  bool operator != (const EventHandle& rhs) const { return id != rhs.id; }
+
+  uint32_t id{InvalidId};
+};
+
+//-------------------------------------------------------------------------------------------------
+// HandleTable
+//-------------------------------------------------------------------------------------------------
+
+// Bidirectional mapping between stable handle ids and the current positions of events inside a
+// sorted array. Removed ids are recycled.
+class HandleTable {
+public:
+  size_t size() const                              { return indexToId_.size(); }
+  EventHandle handleAt(size_t index) const         { return EventHandle(indexToId_[index]); }
+  size_t indexOf(EventHandle handle) const         { return idToIndex_[handle.id]; }
+  bool contains(EventHandle handle) const;
+
+  void clear();
+  void reserve(size_t size);
+  void assign(size_t size);
+  EventHandle insert(size_t index);
+  void erase(size_t index);
+  void move(size_t from, size_t to);
+
+  // Rearranges the range starting at 'first', its new element i is its old element order[i]:
+  void permute(size_t first, const std::vector<uint32_t>& order);
+
+private:
+  void reindex(size_t first, size_t last);
+
+  std::vector<uint32_t> idToIndex_;
+  std::vector<uint32_t> indexToId_;
+  std::vector<uint32_t> freeIds_;
+};
+
+// Moves a single element of a vector to a new position, shifting everything in between by one.
+template <typename T>
+void moveElement(std::vector<T>& v, size_t from, size_t to) {
+  if (from < to)
+    std::rotate(v.begin() + from, v.begin() + from + 1, v.begin() + to + 1);
+  else if (from > to)
+    std::rotate(v.begin() + to, v.begin() + from, v.begin() + from + 1);
+}
+
+// Returns a new, globally unique revision stamp. Stamps are strictly increasing, so the newest
+// stamp of a set of event arrays changes whenever any of them is modified.
+uint64_t nextRevision();
+
+// Returns the order in which the elements of 'ticks' have to be visited to be sorted ascending.
+// Elements sharing the same tick keep their relative order.
+std::vector<uint32_t> sortedOrder(const std::vector<uint32_t>& ticks);
+
+// Returns the position an element at 'index' has to be moved to, so 'ticks' stays sorted after its
+// value has been changed to 'newTick'. Events sharing the same tick keep their insertion order.
+size_t sortedPosition(const std::vector<uint32_t>& ticks, size_t index, uint32_t newTick);
+
+//-------------------------------------------------------------------------------------------------
+// HandleSet
+//-------------------------------------------------------------------------------------------------
+
+// Set of handles of a single event array, e.g. its selection. Membership is one bit per handle id,
+// and the members are listed as well, so they can be visited and cleared in O(members) instead of
+// O(events). Handles are stable, so the set stays valid while its events get sorted around.
+class HandleSet {
+public:
+  size_t size() const                              { return handles_.size(); }
+  bool empty() const                               { return handles_.empty(); }
+  const std::vector<EventHandle>& handles() const  { return handles_; }
+
+  bool contains(EventHandle handle) const {
+    return handle.id / 64 < bits_.size() && ((bits_[handle.id / 64] >> (handle.id % 64)) & 1) != 0;
+  }
+
+  void insert(EventHandle handle);
+  void erase(EventHandle handle); // O(members)
+  void clear();                   // O(members)
+
+private:
+  std::vector<uint64_t> bits_;
+  std::vector<EventHandle> handles_;
+};
+
+//-------------------------------------------------------------------------------------------------
+// NoteIntervalIndex
+//-------------------------------------------------------------------------------------------------
+
+// Spatial index over note blocks, keyed by note and tick range. Every note has its own bucket of
+// blocks sorted by start tick, so a lookup is a binary search inside a single bucket followed by a
+// short scan bounded by the longest block of that bucket.
+class NoteIntervalIndex {
+public:
+  void clear();
+  void insert(uint8_t note, uint32_t startTick, uint32_t endTick, EventHandle handle);
+  void erase(uint8_t note, uint32_t startTick, EventHandle handle);
+  void setEndTick(uint8_t note, uint32_t startTick, uint32_t endTick, EventHandle handle);
+
+  // Appends all blocks of the given notes which overlap the inclusive tick range to 'result'.
+  // Blocks of the same note are returned in ascending order of their start tick.
+  void query(uint32_t firstTick, uint32_t lastTick, uint8_t lowestNote, uint8_t highestNote,
+      std::vector<EventHandle>& result) const;
+
+private:
+  struct Entry {
+    uint32_t startTick;
+    uint32_t endTick;
+    EventHandle handle;
+  };
+
+  struct Bucket {
+    std::vector<Entry> entries;
+    uint32_t maxLength{0}; // only grows until the next clear(), which keeps lookups conservative
+  };
+
+  std::vector<Entry>::iterator find(Bucket& bucket, uint32_t startTick, EventHandle handle);
+
+  Bucket buckets_[128];
+};
+
+//-------------------------------------------------------------------------------------------------
+// NoteArray
+//-------------------------------------------------------------------------------------------------
+
+// Tick sorted note blocks, stored as structure of arrays so hot loops only touch the columns they
+// actually need.
+class NoteArray {
+public:
+  size_t size() const                                  { return startTicks_.size(); }
+  bool empty() const                                   { return startTicks_.empty(); }
+  const std::vector<uint32_t>& startTicks() const      { return startTicks_; }
+  const std::vector<uint32_t>& numTicks() const        { return numTicks_; }
+  const std::vector<uint8_t>& notes() const            { return notes_; }
+
+  uint32_t startTick(size_t index) const               { return startTicks_[index]; }
+  uint32_t numTicks(size_t index) const                { return numTicks_[index]; }
+  uint32_t endTick(size_t index) const                 { return startTicks_[index] + numTicks_[index]; }
+  uint8_t note(size_t index) const                     { return notes_[index]; }
+  bool isSelected(size_t index) const                  { return selection_.contains(handles_.handleAt(index)); }
+  const HandleSet& selection() const                   { return selection_; }
+
+  EventHandle handle(size_t index) const               { return handles_.handleAt(index); }
+  size_t index(EventHandle handle) const               { return handles_.indexOf(handle); }
+  bool contains(EventHandle handle) const              { return handles_.contains(handle); }
+  uint64_t revision() const                            { return revision_; }
+
+  void clear();
+  void reserve(size_t size);
+
+  // Replaces all note blocks at once. Columns don't need to be sorted, blocks sharing the same start
+  // tick keep their relative order:
+  void assign(std::vector<uint32_t> startTicks, std::vector<uint32_t> numTicks, std::vector<uint8_t> notes);
+
+  EventHandle insert(uint32_t startTick, uint32_t numTicks, uint8_t note);
+  void erase(EventHandle handle);
+  void setStartTick(EventHandle handle, uint32_t startTick);
+  void setNumTicks(EventHandle handle, uint32_t numTicks);
+  void setNote(EventHandle handle, uint8_t note);
+  void select(EventHandle handle);
+  void unselect(EventHandle handle);
+  void unselectAll();
+
+  // Adds all blocks of the given notes overlapping the inclusive tick range to the selection:
+  void selectRange(uint32_t firstTick, uint32_t lastTick, uint8_t lowestNote, uint8_t highestNote);
+
+  // Edit all selected blocks at once, keeping them in shape: Deltas are clamped, so no block would
+  // start before tick 0, leave the range of notes or shrink below a single tick (or below zero
+  // ticks, if it is that short already). The array is
+  // re-sorted once per call, only within the range of ticks the selection has covered or covers now:
+  void moveSelection(int32_t deltaTicks, int deltaNotes);
+  void resizeSelection(int32_t deltaStartTicks, int32_t deltaEndTicks);
+
+  // Appends handles of all blocks of the given notes overlapping the inclusive tick range:
+  void query(uint32_t firstTick, uint32_t lastTick, uint8_t lowestNote, uint8_t highestNote,
+      std::vector<EventHandle>& result) const;
+
+private:
+  void buildIndex() const;
+  void editSelection(int32_t deltaStartTicks, int32_t deltaEndTicks, int deltaNotes);
+
+  std::vector<uint32_t> startTicks_;
+  std::vector<uint32_t> numTicks_;
+  std::vector<uint8_t> notes_;
+  HandleSet selection_;
+  HandleTable handles_;
+  uint64_t revision_{0};
+
+  // The index is built on the first query and kept up to date by all later edits:
+  mutable NoteIntervalIndex index_;
+  mutable bool isIndexValid_{false};
+};
+
+//-------------------------------------------------------------------------------------------------
+// SortedEventArray
+//-------------------------------------------------------------------------------------------------
+
+// Tick sorted array of small, fixed size event records. A record type needs a 'startTick' member.
+template <typename Record>
+class SortedEventArray {
+public:
+  size_t size() const                                  { return records_.size(); }
+  bool empty() const                                   { return records_.empty(); }
+  const std::vector<Record>& records() const           { return records_; }
+  const Record& operator [] (size_t index) const       { return records_[index]; }
+  const Record& record(EventHandle handle) const       { return records_[handles_.indexOf(handle)]; }
+
+  EventHandle handle(size_t index) const               { return handles_.handleAt(index); }
+  size_t index(EventHandle handle) const               { return handles_.indexOf(handle); }
+  bool contains(EventHandle handle) const              { return handles_.contains(handle); }
+  uint64_t revision() const                            { return revision_; }
+
+  uint32_t endTick() const                             { return records_.empty() ? 0 : records_.back().startTick; }
+
+  void clear() {
+    records_.clear();
+    handles_.clear();
+    revision_ = nextRevision();
+  }
+
+  void reserve(size_t size) {
+    records_.reserve(size);
+    handles_.reserve(size);
+  }
+
+  // Replaces all records at once. Records don't need to be sorted, records sharing the same tick
+  // keep their relative order:
+  void assign(std::vector<Record> records) {
+    auto recordLess = [](const Record& lhs, const Record& rhs) { return lhs.startTick < rhs.startTick; };
+
+    if (!std::is_sorted(records.begin(), records.end(), recordLess))
+      std::stable_sort(records.begin(), records.end(), recordLess);
+
+    records_ = std::move(records);
+    handles_.assign(records_.size());
+    revision_ = nextRevision();
+  }
+
+  EventHandle insert(const Record& record) {
+    auto tickLess = [](uint32_t tick, const Record& r) { return tick < r.startTick; };
+    const size_t index = std::upper_bound(records_.begin(), records_.end(), record.startTick, tickLess) - records_.begin();
+
+    records_.insert(records_.begin() + index, record);
+    revision_ = nextRevision();
+
+    return handles_.insert(index);
+  }
+
+  void erase(EventHandle handle) {
+    const size_t index = handles_.indexOf(handle);
+
+    records_.erase(records_.begin() + index);
+    handles_.erase(index);
+    revision_ = nextRevision();
+  }
+
+  void update(EventHandle handle, const Record& record) {
+    const size_t index = handles_.indexOf(handle);
+    size_t newIndex = index;
+
+    auto tickLess = [](uint32_t tick, const Record& r) { return tick < r.startTick; };
+
+    if (record.startTick > records_[index].startTick)
+      newIndex = std::upper_bound(records_.begin() + index + 1, records_.end(), record.startTick, tickLess) - records_.begin() - 1;
+    else if (record.startTick < records_[index].startTick)
+      newIndex = std::upper_bound(records_.begin(), records_.begin() + index, record.startTick, tickLess) - records_.begin();
+
+    records_[index] = record;
+    moveElement(records_, index, newIndex);
+    handles_.move(index, newIndex);
+    revision_ = nextRevision();
+  }
+
+private:
+  std::vector<Record> records_;
+  HandleTable handles_;
+  uint64_t revision_{0};
+};
+
+//-------------------------------------------------------------------------------------------------
+// Event records
+//-------------------------------------------------------------------------------------------------
+
+struct ProgramChangeRecord {
+  uint32_t startTick;
+  uint8_t programNumber;
+};
+
+struct PitchBendRecord {
+  uint32_t startTick;
+  uint16_t pitchBendValue;
+};
+
+// Stored exactly as a standard MIDI file carries it, the tempo in bpm is derived for display only:
+struct SetTempoRecord {
+  uint32_t startTick;
+  uint32_t usPerQuarterNote;
+};
+
+struct NotImplementedRecord {
+  uint32_t startTick;
+  uint8_t midiEventId;
+  bool isMetaEvent;
+};
+
+//-------------------------------------------------------------------------------------------------
+// TrackEventStore
+//-------------------------------------------------------------------------------------------------
+
+struct EventStoreStats {
+  uint32_t endTick{0};        // end of the last event of any type
+  uint32_t audibleEndTick{0}; // end of the last event which is actually played back
+  size_t numNotes{0};
+  uint8_t lowestNote{0};
+  uint8_t highestNote{0};
+};
+
+// Contiguous, tick sorted storage of all events of a single track. Every event type lives in its
+// own array, so iterating e.g. all note blocks never touches any other event.
+class TrackEventStore {
+public:
+  const NoteArray& notes() const                                    { return notes_; }
+  NoteArray& notes()                                                { return notes_; }
+  const SortedEventArray<ProgramChangeRecord>& programChanges() const { return programChanges_; }
+  SortedEventArray<ProgramChangeRecord>& programChanges()           { return programChanges_; }
+  const SortedEventArray<PitchBendRecord>& pitchBends() const       { return pitchBends_; }
+  SortedEventArray<PitchBendRecord>& pitchBends()                   { return pitchBends_; }
+  const SortedEventArray<SetTempoRecord>& tempoChanges() const      { return tempoChanges_; }
+  SortedEventArray<SetTempoRecord>& tempoChanges()                  { return tempoChanges_; }
+  const SortedEventArray<NotImplementedRecord>& notImplemented() const { return notImplemented_; }
+  SortedEventArray<NotImplementedRecord>& notImplemented()          { return notImplemented_; }
+
+  void clear();
+  bool empty() const;
+  size_t size() const;
+  uint32_t endTick() const                                          { return stats().endTick; }
+  uint64_t revision() const;
+  const EventStoreStats& stats() const;
+
+private:
+  NoteArray notes_;
+  SortedEventArray<ProgramChangeRecord> programChanges_;
+  SortedEventArray<PitchBendRecord> pitchBends_;
+  SortedEventArray<SetTempoRecord> tempoChanges_;
+  SortedEventArray<NotImplementedRecord> notImplemented_;
+
+  mutable EventStoreStats stats_;
+  mutable uint64_t statsRevision_{0};
+};
+
+#endif // _EVENT_STORE_H
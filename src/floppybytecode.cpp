@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "backgroundjob.h"
+#include "floppybytecode.h"
+#include "floppysink.h"
+#include "mappedfile.h"
+#include "playbackschedule.h"
+
+static_assert(sizeof(FloppyBytecodeHeader) == 24, "unexpected floppy bytecode header size");
+static_assert(sizeof(FloppyBytecodeRecord) == 6, "unexpected floppy bytecode record size");
+
+static const char FloppyBytecodeMagic[4] = {'F', 'L', 'P', 'B'};
+
+const uint8_t FloppyBytecodeRecord::WaitOnly;
+const uint16_t FloppyBytecode::Version;
+const uint64_t FloppyBytecode::PeakWindowUs;
+
+//-------------------------------------------------------------------------------------------------
+// FloppyBytecode
+//-------------------------------------------------------------------------------------------------
+
+bool FloppyBytecode::write(const std::string& path, const PlaybackSchedule& schedule, size_t numDrives,
+    FloppyBytecodeStats* pStats, JobProgress* pProgress) {
+
+  const std::vector<PlaybackMessage>& messages = schedule.messages();
+  FloppyDriveStates drives(std::min(numDrives, FloppySink::MaxDrives));
+
+  if (pProgress)
+    pProgress->setTotal(messages.size());
+
+  std::vector<FloppyBytecodeRecord> records;
+  std::vector<uint64_t> recordTimes; // absolute, only needed for the statistics
+  uint64_t lastUs = 0;
+  uint32_t numUnreportedMessages = 0;
+
+  // Batches of messages sharing the same time are compiled like a FloppySink sends them, so only
+  // drives whose period has changed get a record:
+  for (size_t batchStart = 0; batchStart < messages.size();) {
+    const uint64_t us = messages[batchStart].timeUs;
+    size_t batchEnd = batchStart + 1;
+
+    while (batchEnd < messages.size() && messages[batchEnd].timeUs == us)
+      ++batchEnd;
+
+    drives.apply(&messages[batchStart], batchEnd - batchStart);
+
+    drives.takeChanges(false, [&](size_t driveNo, uint16_t period) {
+      // Deltas are taken from absolute times, so rounding never accumulates:
+      uint64_t deltaUs = us - lastUs;
+
+      while (deltaUs > 0xFFFF) {
+        records.push_back({0xFFFF, 0, FloppyBytecodeRecord::WaitOnly, 0});
+        lastUs += 0xFFFF;
+        recordTimes.push_back(lastUs);
+        deltaUs -= 0xFFFF;
+      }
+
+      records.push_back({static_cast<uint16_t>(deltaUs), period, static_cast<uint8_t>(driveNo), 0});
+      recordTimes.push_back(us);
+      lastUs = us;
+    });
+
+    numUnreportedMessages += static_cast<uint32_t>(batchEnd - batchStart);
+    batchStart = batchEnd;
+
+    if (pProgress && numUnreportedMessages >= 0x10000) {
+      pProgress->advance(numUnreportedMessages);
+      numUnreportedMessages = 0;
+
+      if (pProgress->isCanceled())
+        return false;
+    }
+  }
+
+  // A failed or canceled export keeps the previous bytecode file, it only gets replaced as a whole:
+  const std::string tempPath = path + ".tmp";
+  FILE* pFile = fopen(tempPath.c_str(), "wb");
+
+  if (!pFile) {
+    printf("Error on creating floppy bytecode file!\n");
+    return false;
+  }
+
+  FloppyBytecodeHeader header = {};
+  memcpy(header.magic, FloppyBytecodeMagic, sizeof(FloppyBytecodeMagic));
+  header.version = Version;
+  header.numDrives = static_cast<uint8_t>(drives.numDrives());
+  header.recordSize = sizeof(FloppyBytecodeRecord);
+  header.numRecords = static_cast<uint32_t>(records.size());
+  header.durationUs = schedule.durationUs();
+
+  bool hasSucceeded = fwrite(&header, sizeof(header), 1, pFile) == 1 &&
+      fwrite(records.data(), sizeof(FloppyBytecodeRecord), records.size(), pFile) == records.size();
+
+  if (fclose(pFile) != 0)
+    hasSucceeded = false;
+
+  if (!hasSucceeded) {
+    remove(tempPath.c_str());
+    return false;
+  }
+
+  if (!replaceFile(tempPath, path))
+    return false;
+
+  if (pProgress)
+    pProgress->advance(numUnreportedMessages);
+
+  if (pStats) {
+    *pStats = FloppyBytecodeStats();
+    pStats->fileSize = sizeof(header) + records.size() * sizeof(FloppyBytecodeRecord);
+    pStats->numRecords = header.numRecords;
+
+    // Record times never decrease, so both the bursts and the busiest window are found in one pass:
+    size_t burstStart = 0;
+    size_t windowStart = 0;
+    uint32_t peakInWindow = 0;
+
+    for (size_t i = 0; i < records.size(); ++i) {
+      if (records[i].drive == FloppyBytecodeRecord::WaitOnly)
+        ++pStats->numWaitRecords;
+
+      if (recordTimes[i] != recordTimes[burstStart])
+        burstStart = i;
+
+      while (recordTimes[i] - recordTimes[windowStart] >= PeakWindowUs)
+        ++windowStart;
+
+      pStats->maxBurst = std::max(pStats->maxBurst, static_cast<uint32_t>(i - burstStart + 1));
+      peakInWindow = std::max(peakInWindow, static_cast<uint32_t>(i - windowStart + 1));
+    }
+
+    pStats->peakRecordsPerSecond = static_cast<uint32_t>(peakInWindow * (1000000 / PeakWindowUs));
+  }
+
+  return true;
+}
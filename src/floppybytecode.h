@@ -0,0 +1,63 @@
+#ifndef _FLOPPY_BYTECODE_H
+#define _FLOPPY_BYTECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+class JobProgress;
+class PlaybackSchedule;
+
+//-------------------------------------------------------------------------------------------------
+// Floppy bytecode layout
+//-------------------------------------------------------------------------------------------------
+
+// A song compiled for floppy controllers, which stream it from flash without any parsing. All
+// fields are stored little endian. The header is followed by fixed width records, every one
+// setting the period of a single drive after waiting for its delta time. Tempo changes are resolved
+// already and all periods come from the note period table, so the firmware only waits and writes.
+
+struct FloppyBytecodeHeader {
+  char magic[4];
+  uint16_t version;
+  uint8_t numDrives;
+  uint8_t recordSize;
+  uint32_t numRecords;
+  uint32_t reserved;
+  uint64_t durationUs;
+};
+
+// Every field is 2 byte aligned, as long as the records start at an even offset:
+struct FloppyBytecodeRecord {
+  static const uint8_t WaitOnly = 0xFF; // drive of records which only wait
+
+  uint16_t deltaUs;   // since the previous record, longer waits are split by WaitOnly records
+  uint16_t periodUs;  // 0 stops the drive
+  uint8_t drive;
+  uint8_t reserved;
+};
+
+struct FloppyBytecodeStats {
+  uint64_t fileSize{0};
+  uint32_t numRecords{0};
+  uint32_t numWaitRecords{0};
+  uint32_t maxBurst{0};              // most records sharing the same time
+  uint32_t peakRecordsPerSecond{0};  // most records within any window of PeakWindowUs, scaled to a second
+};
+
+//-------------------------------------------------------------------------------------------------
+// FloppyBytecode
+//-------------------------------------------------------------------------------------------------
+
+class FloppyBytecode {
+public:
+  static const uint16_t Version = 1;
+  static const uint64_t PeakWindowUs = 10000;
+
+  // Compiles a schedule for the given number of drives, notes are assigned to drives just like a
+  // FloppySink does it. Writes a temporary file, which replaces 'path' once it is complete:
+  static bool write(const std::string& path, const PlaybackSchedule& schedule, size_t numDrives,
+      FloppyBytecodeStats* pStats = nullptr, JobProgress* pProgress = nullptr);
+};
+
+#endif // _FLOPPY_BYTECODE_H
@@ -0,0 +1,51 @@
+#ifndef _FLOPPY_NOTES_H
+#define _FLOPPY_NOTES_H
+
+#include <stdint.h>
+
+//-------------------------------------------------------------------------------------------------
+// Floppy note periods
+//-------------------------------------------------------------------------------------------------
+
+// Range of notes most drives reproduce cleanly. Lower notes make the head rattle, higher ones need
+// step rates the drives can't follow:
+const uint8_t FloppyLowestNote = 24;  // C1
+const uint8_t FloppyHighestNote = 71; // B4
+
+// Moves a note by whole octaves into the range a drive can play:
+constexpr uint8_t foldIntoFloppyRange(uint8_t note) {
+  return note < FloppyLowestNote ? foldIntoFloppyRange(note + 12)
+      : note > FloppyHighestNote ? foldIntoFloppyRange(note - 12)
+      : note;
+}
+
+struct NotePeriodTable {
+  uint32_t periodUs[128]; // duration of a full step cycle, the step pin toggles twice per period
+};
+
+// Equal temperament, computed at compile time. Octaves are exact doublings and semitones are only
+// stacked within an octave, so rounding errors don't accumulate over the whole range:
+constexpr NotePeriodTable makeNotePeriodTable() {
+  NotePeriodTable table = {};
+
+  for (int note = 0; note < 128; ++note) {
+    double frequency = 6.875; // the A three semitones below note 0
+
+    for (int i = 0; i < (note + 3) / 12; ++i)
+      frequency *= 2;
+
+    for (int i = 0; i < (note + 3) % 12; ++i)
+      frequency *= 1.0594630943592953; // 2^(1/12)
+
+    table.periodUs[note] = static_cast<uint32_t>(1000000.0 / frequency + 0.5);
+  }
+
+  return table;
+}
+
+constexpr NotePeriodTable NotePeriods = makeNotePeriodTable();
+
+static_assert(NotePeriods.periodUs[69] == 2273, "A4 must be 440 Hz");
+static_assert(NotePeriods.periodUs[foldIntoFloppyRange(0)] <= 0xFFFF, "periods of playable notes must fit 16 bit");
+
+#endif // _FLOPPY_NOTES_H
@@ -0,0 +1,118 @@
+#include <algorithm>
+
+extern "C" {
+#include "lib/eMIDI/src/midifile.h"
+}
+
+#include "floppynotes.h"
+#include "floppysink.h"
+
+//-------------------------------------------------------------------------------------------------
+// FloppyDriveStates
+//-------------------------------------------------------------------------------------------------
+
+void FloppyDriveStates::reset() {
+  for (Drive& drive : drives_)
+    drive = Drive();
+}
+
+void FloppyDriveStates::stopAll() {
+  for (Drive& drive : drives_)
+    drive.period = 0;
+}
+
+void FloppyDriveStates::apply(const PlaybackMessage* pMessages, size_t numMessages) {
+  for (size_t i = 0; i < numMessages; ++i) {
+    const PlaybackMessage& message = pMessages[i];
+    const uint8_t type = message.status & 0xF0;
+    const uint8_t midiChannel = message.status & 0x0F;
+    const bool isNoteOff = type == MIDI_EVENT_NOTE_OFF || (type == MIDI_EVENT_NOTE_ON && message.data2 == 0);
+
+    // Voice allocated notes bring their drive along, all others play on the drive of their track:
+    const int driveOfMessage = message.voice >= 0 ? message.voice : message.trackNo;
+
+    if (isNoteOff) {
+      // Note offs without a track silence every drive playing that note:
+      for (size_t driveNo = 0; driveNo < drives_.size(); ++driveNo) {
+        Drive& drive = drives_[driveNo];
+        const bool isTrackDrive = driveOfMessage < 0 || static_cast<size_t>(driveOfMessage) == driveNo;
+
+        if (isTrackDrive && drive.period && drive.midiChannel == midiChannel && drive.note == message.data1)
+          drive.period = 0;
+      }
+    }
+    else if (type == MIDI_EVENT_NOTE_ON && driveOfMessage >= 0 && static_cast<size_t>(driveOfMessage) < drives_.size()) {
+      // The newest note wins, just like on a monophonic synthesizer:
+      Drive& drive = drives_[driveOfMessage];
+      drive.midiChannel = midiChannel;
+      drive.note = message.data1;
+      drive.period = static_cast<uint16_t>(NotePeriods.periodUs[foldIntoFloppyRange(message.data1 & 0x7F)]);
+    }
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+// FloppySink
+//-------------------------------------------------------------------------------------------------
+
+const uint8_t FloppySink::FrameSync;
+const size_t FloppySink::MaxDrives;
+
+FloppySink::FloppySink(size_t numDrives)
+    : drives_(std::min(numDrives, MaxDrives)) {
+
+  frame_.reserve(3 + 3 * MaxDrives);
+}
+
+FloppySink::~FloppySink() {
+  close();
+}
+
+bool FloppySink::open(const std::string& path, uint32_t baudRate) {
+  if (!port_.open(path, baudRate))
+    return false;
+
+  drives_.reset();
+  sendChangedDrives(true);
+
+  return true;
+}
+
+void FloppySink::close() {
+  if (!port_.isOpen())
+    return;
+
+  drives_.stopAll();
+  sendChangedDrives(true);
+  port_.close();
+}
+
+void FloppySink::send(const PlaybackMessage* pMessages, size_t numMessages) {
+  drives_.apply(pMessages, numMessages);
+  sendChangedDrives(false);
+}
+
+void FloppySink::sendChangedDrives(bool isForced) {
+  frame_.assign({FrameSync, 0});
+
+  drives_.takeChanges(isForced, [this](size_t driveNo, uint16_t period) {
+    frame_.push_back(static_cast<uint8_t>(driveNo));
+    frame_.push_back(static_cast<uint8_t>(period >> 8));
+    frame_.push_back(static_cast<uint8_t>(period));
+  });
+
+  frame_[1] = static_cast<uint8_t>((frame_.size() - 2) / 3);
+
+  if (frame_[1] == 0 || !port_.isOpen())
+    return;
+
+  uint8_t checksum = 0;
+
+  for (size_t i = 1; i < frame_.size(); ++i)
+    checksum ^= frame_[i];
+
+  frame_.push_back(checksum);
+
+  if (port_.write(frame_.data(), frame_.size()))
+    ++numFrames_;
+}
@@ -0,0 +1,93 @@
+#ifndef _FLOPPY_SINK_H
+#define _FLOPPY_SINK_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "playbacksink.h"
+#include "serialport.h"
+
+//-------------------------------------------------------------------------------------------------
+// FloppyDriveStates
+//-------------------------------------------------------------------------------------------------
+
+// The note every drive plays, as told by batches of playback messages. Notes of a voice allocated
+// schedule play on the drive of their voice. Otherwise every channel track plays on the drive with
+// the same number and tracks without a drive stay silent. A drive plays one note at a time, given
+// as the period of its step pulses, so only changed periods need to reach the drives.
+class FloppyDriveStates {
+public:
+  explicit FloppyDriveStates(size_t numDrives) : drives_(numDrives) {}
+
+  size_t numDrives() const                         { return drives_.size(); }
+
+  // Forgets all notes, the drives are considered unknown until the next changes have been taken:
+  void reset();
+  void stopAll();
+  void apply(const PlaybackMessage* pMessages, size_t numMessages);
+
+  // Calls 'onChange(driveNo, period)' for every drive whose period has changed since the last call,
+  // or for all drives if forced. A period of 0 stops a drive:
+  template <typename OnChange>
+  void takeChanges(bool isForced, OnChange onChange) {
+    for (size_t driveNo = 0; driveNo < drives_.size(); ++driveNo) {
+      Drive& drive = drives_[driveNo];
+
+      if (!isForced && drive.period == drive.sentPeriod)
+        continue;
+
+      drive.sentPeriod = drive.period;
+      onChange(driveNo, drive.period);
+    }
+  }
+
+private:
+  struct Drive {
+    uint8_t midiChannel{0};
+    uint8_t note{0};
+    uint16_t period{0};      // 0 if silent
+    uint16_t sentPeriod{0};
+  };
+
+  std::vector<Drive> drives_;
+};
+
+//-------------------------------------------------------------------------------------------------
+// FloppySink
+//-------------------------------------------------------------------------------------------------
+
+// Drives an array of floppy drives behind a microcontroller on a serial port, assigning notes to
+// drives like FloppyDriveStates. All drive changes of a batch are sent as a single frame:
+//
+//   0xA5 | count | count x (drive, period high byte, period low byte) | checksum
+//
+// A period of 0 stops a drive. The checksum is the XOR of all bytes between sync and checksum.
+class FloppySink : public PlaybackSink {
+public:
+  static const uint8_t FrameSync = 0xA5;
+  static const size_t MaxDrives = 16;
+
+  FloppySink(size_t numDrives);
+  FloppySink(const FloppySink&) = delete;
+  FloppySink& operator = (const FloppySink&) = delete;
+  ~FloppySink();
+
+  // Opens the port and stops all drives:
+  bool open(const std::string& path, uint32_t baudRate = 115200);
+  void close();
+
+  const char* name() const final                   { return "Floppy"; }
+  void send(const PlaybackMessage* pMessages, size_t numMessages) final;
+  uint64_t numFrames() const                       { return numFrames_; }
+
+private:
+  void sendChangedDrives(bool isForced);
+
+  FloppyDriveStates drives_;
+  std::vector<uint8_t> frame_;
+  SerialPort port_;
+  uint64_t numFrames_{0};
+};
+
+#endif // _FLOPPY_SINK_H
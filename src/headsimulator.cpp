@@ -0,0 +1,126 @@
+#include <algorithm>
+
+#include "floppysink.h"
+#include "headsimulator.h"
+#include "playbackschedule.h"
+
+//-------------------------------------------------------------------------------------------------
+// HeadSimulation
+//-------------------------------------------------------------------------------------------------
+
+namespace {
+  struct DriveState {
+    uint32_t periodUs{0};      // 0 if silent
+    uint64_t periodStartUs{0}; // steps of the current period are counted from here
+    uint64_t playStartUs{0};
+    uint64_t silenceStartUs{0};
+
+    // The head going back and forth over the tracks, unfolded into a single forward movement over
+    // twice the travel. Positions up to the last track move inwards, all others outwards:
+    uint64_t unfoldedTrack{0};
+  };
+}
+
+void HeadSimulation::simulate(const PlaybackSchedule& schedule, const HeadSimulationOptions& options) {
+  const uint64_t lastTrack = std::max<uint16_t>(options.numTracks, 2) - 1;
+  const uint64_t cycleLength = 2 * lastTrack;
+
+  songRevision_ = schedule.songRevision();
+  drives_.assign(options.numDrives, Drive());
+
+  std::vector<DriveState> states(options.numDrives);
+
+  // Moves the head by all steps of the current period up to 'us':
+  auto advance = [&](size_t driveNo, uint64_t us) {
+    DriveState& state = states[driveNo];
+
+    if (state.periodUs == 0)
+      return;
+
+    const uint64_t numSteps = (us - state.periodStartUs) / state.periodUs;
+    const uint64_t unfoldedTrack = state.unfoldedTrack + numSteps;
+    Drive& drive = drives_[driveNo];
+
+    // The head turns around whenever it reaches a multiple of the travel:
+    drive.numSteps += numSteps;
+    drive.numReversals += unfoldedTrack / lastTrack - state.unfoldedTrack / lastTrack;
+    state.unfoldedTrack = unfoldedTrack % cycleLength;
+    state.periodStartUs += numSteps * state.periodUs;
+  };
+
+  auto headTrackOf = [&](const DriveState& state) {
+    return static_cast<uint16_t>(state.unfoldedTrack <= lastTrack ? state.unfoldedTrack : cycleLength - state.unfoldedTrack);
+  };
+
+  auto changePeriod = [&](size_t driveNo, uint64_t us, uint32_t periodUs) {
+    DriveState& state = states[driveNo];
+    Drive& drive = drives_[driveNo];
+
+    advance(driveNo, us);
+
+    if (periodUs == 0) {
+      drive.playingUs += us - state.playStartUs;
+      drive.lastStopUs = us;
+      state.silenceStartUs = us;
+    }
+    else if (state.periodUs == 0) {
+      const uint64_t resetUs = headTrackOf(state) * uint64_t(options.resetStepUs);
+
+      if (drive.numNotes > 0 && us - state.silenceStartUs < resetUs)
+        drive.resetCollisions.push_back({state.silenceStartUs, us, resetUs});
+
+      state.playStartUs = us;
+    }
+
+    if (periodUs) {
+      ++drive.numNotes;
+      drive.shortestPeriodUs = drive.shortestPeriodUs ? std::min(drive.shortestPeriodUs, periodUs) : periodUs;
+    }
+
+    state.periodUs = periodUs;
+    state.periodStartUs = us;
+  };
+
+  // Messages reach the drives in batches of the same time, exactly like they reach a FloppySink. A
+  // note stopped and started again within a batch therefore plays on without a silence:
+  const std::vector<PlaybackMessage>& messages = schedule.messages();
+  FloppyDriveStates driveStates(options.numDrives);
+
+  for (size_t batchStart = 0; batchStart < messages.size();) {
+    const uint64_t us = messages[batchStart].timeUs;
+    size_t batchEnd = batchStart + 1;
+
+    while (batchEnd < messages.size() && messages[batchEnd].timeUs == us)
+      ++batchEnd;
+
+    driveStates.apply(&messages[batchStart], batchEnd - batchStart);
+    driveStates.takeChanges(false, [&](size_t driveNo, uint16_t period) { changePeriod(driveNo, us, period); });
+    batchStart = batchEnd;
+  }
+
+  // All heads are reset before the song from wherever they are, and back from their last position after it:
+  uint64_t endUs = schedule.durationUs();
+
+  for (size_t driveNo = 0; driveNo < drives_.size(); ++driveNo) {
+    if (states[driveNo].periodUs)
+      changePeriod(driveNo, std::max(schedule.durationUs(), states[driveNo].periodStartUs), 0);
+
+    Drive& drive = drives_[driveNo];
+    drive.headTrack = headTrackOf(states[driveNo]);
+    endUs = std::max(endUs, drive.lastStopUs + drive.headTrack * uint64_t(options.resetStepUs));
+  }
+
+  driveTimeUs_ = lastTrack * options.resetStepUs + endUs;
+
+  while (!drives_.empty() && drives_.back().numNotes == 0)
+    drives_.pop_back();
+}
+
+size_t HeadSimulation::numResetCollisions() const {
+  size_t numCollisions = 0;
+
+  for (const Drive& drive : drives_)
+    numCollisions += drive.resetCollisions.size();
+
+  return numCollisions;
+}
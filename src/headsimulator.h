@@ -0,0 +1,71 @@
+#ifndef _HEAD_SIMULATOR_H
+#define _HEAD_SIMULATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class PlaybackSchedule;
+
+//-------------------------------------------------------------------------------------------------
+// HeadSimulationOptions
+//-------------------------------------------------------------------------------------------------
+
+struct HeadSimulationOptions {
+  size_t numDrives{16};       // notes for higher drives are ignored, just like a FloppySink does
+  uint16_t numTracks{80};     // the head turns around at track 0 and at the last track
+  uint32_t resetStepUs{4000}; // a reset moves the head back to track 0 at this step period
+};
+
+//-------------------------------------------------------------------------------------------------
+// HeadSimulation
+//-------------------------------------------------------------------------------------------------
+
+// Estimates how the heads of the floppy drives move while a schedule plays. A playing drive steps
+// its head once per note period and turns it around at either end of its travel, so the head
+// position after any number of steps follows in closed form. The simulation therefore only does
+// work at the note ons and offs of the schedule, never per step.
+//
+// A reset moves a head back to track 0, taking one reset step per track it is away from it.
+// Silences of a drive that are too short for a reset from where its head is at their start are
+// reported as reset collisions: A controller resetting its drives there would delay the next note.
+class HeadSimulation {
+public:
+  struct ResetCollision {
+    uint64_t startUs; // silence of the drive
+    uint64_t endUs;
+    uint64_t resetUs; // duration of a reset from the head position at the start of the silence
+  };
+
+  struct Drive {
+    uint64_t numNotes{0};
+    uint64_t numSteps{0};
+    uint64_t numReversals{0};
+    uint64_t playingUs{0};       // time with a note playing
+    uint64_t lastStopUs{0};      // end of the last note
+    uint32_t shortestPeriodUs{0};// of all notes played, 0 if none
+    uint16_t headTrack{0};       // head position at the end of the song
+    std::vector<ResetCollision> resetCollisions;
+
+    double averageStepsPerSecond() const { return playingUs ? numSteps * 1000000.0 / playingUs : 0; }
+    uint32_t maxStepsPerSecond() const   { return shortestPeriodUs ? (1000000 + shortestPeriodUs / 2) / shortestPeriodUs : 0; }
+  };
+
+  void simulate(const PlaybackSchedule& schedule, const HeadSimulationOptions& options = HeadSimulationOptions());
+
+  // Only drives which have played a note or lie below one that has are listed:
+  const std::vector<Drive>& drives() const         { return drives_; }
+  uint64_t songRevision() const                    { return songRevision_; }
+
+  // Duration of the song on the drives, including the reset of all heads from an unknown position
+  // before and the reset of every head back to track 0 after it:
+  uint64_t driveTimeUs() const                     { return driveTimeUs_; }
+  size_t numResetCollisions() const;
+
+private:
+  std::vector<Drive> drives_;
+  uint64_t songRevision_{0};
+  uint64_t driveTimeUs_{0};
+};
+
+#endif // _HEAD_SIMULATOR_H
@@ -1,3 +1,6 @@
+#include <stdlib.h>
+#include <algorithm>
+
 #include <wx/wx.h>
 
 extern "C" {
@@ -5,6 +8,7 @@ extern "C" {
 }
 
 #include "keyeditor.h"
+#include "redrawscheduler.h"
 
 //-------------------------------------------------------------------------------------------------
 // KeyEditorCanvasCanvasSegment
@@ -13,17 +17,160 @@ extern "C" {
 KeyEditorCanvasSegment::KeyEditorCanvasSegment(KeyEditorCanvas* pParent, const wxSize& size = wxDefaultSize)
     : wxWindow(pParent, wxID_ANY, wxDefaultPosition, size) {
 
+  SetBackgroundStyle(wxBG_STYLE_PAINT); // everything is painted from the layers, so never erase
 }
 
 void KeyEditorCanvasSegment::render() {
-  wxClientDC dc(this);
-  dc.Clear();
+  isForegroundValid_ = false;
+  Refresh(false);
+}
+
+void KeyEditorCanvasSegment::renderRect(const wxRect& rect) {
+  // Without a valid foreground layer there is nothing to patch, so it has to be fully recomposed:
+  if (!isForegroundValid_ || !isBackgroundValid_ || foregroundLayer_.GetSize() != GetClientSize()) {
+    render();
+    return;
+  }
+
+  const wxRect dirtyRect = rect.Intersect(wxRect(wxPoint(0, 0), GetClientSize()));
+
+  if (dirtyRect.IsEmpty())
+    return;
+
+  composeRect(dirtyRect);
+  RefreshRect(dirtyRect, false);
+}
+
+void KeyEditorCanvasSegment::renderColumn(int x) {
+  // include a pixel of margin to each side, like for note blocks:
+  renderRect(wxRect(x - 1, 0, 3, GetClientSize().GetHeight()));
+}
+
+void KeyEditorCanvasSegment::scrollLayers(int dx, int left) {
+  const wxSize size = GetClientSize();
+  const int scrollWidth = size.GetWidth() - left;
+
+  if (dx == 0)
+    return;
 
-  onRender(dc);
+  // Layers which have to be recomposed anyway, or a jump by more than the visible width, gain
+  // nothing from shifting:
+  if (!isForegroundValid_ || !isBackgroundValid_ || foregroundLayer_.GetSize() != size || std::abs(dx) >= scrollWidth) {
+    isBackgroundValid_ = false;
+    render();
+    return;
+  }
+
+  shiftLayer(backgroundLayer_, dx, left);
+  shiftLayer(foregroundLayer_, dx, left);
+
+  // Besides the newly exposed strip, everything left of the scrolled area and its first columns
+  // are redrawn, as content gets clipped differently at that edge:
+  if (dx > 0)
+    redrawRect(wxRect(size.GetWidth() - dx, 0, dx, size.GetHeight()));
+  else
+    redrawRect(wxRect(left, 0, -dx, size.GetHeight()));
+
+  redrawRect(wxRect(0, 0, left + 2, size.GetHeight()));
+
+  Refresh(false);
+}
+
+void KeyEditorCanvasSegment::shiftLayer(wxBitmap& layer, int dx, int left) {
+  const wxSize size = layer.GetSize();
+
+  if (scratchLayer_.GetSize() != size)
+    scratchLayer_ = wxBitmap(size.GetWidth(), size.GetHeight());
+
+  // Blitting a bitmap onto itself isn't safe for overlapping areas on every platform, so the
+  // shifted copy goes through a scratch bitmap which then takes the place of the layer. The strip
+  // which is left undefined gets redrawn by the caller:
+  {
+    wxMemoryDC srcDc(layer);
+    wxMemoryDC dc(scratchLayer_);
+    const int width = size.GetWidth() - left - std::abs(dx);
+
+    dc.Blit(0, 0, left, size.GetHeight(), &srcDc, 0, 0);
+
+    if (dx > 0)
+      dc.Blit(left, 0, width, size.GetHeight(), &srcDc, left + dx, 0);
+    else
+      dc.Blit(left - dx, 0, width, size.GetHeight(), &srcDc, left, 0);
+  }
+
+  std::swap(layer, scratchLayer_);
+}
+
+void KeyEditorCanvasSegment::redrawRect(const wxRect& rect) {
+  {
+    wxMemoryDC dc(backgroundLayer_);
+    dc.SetClippingRegion(rect);
+    dc.SetPen(wxPen(GetBackgroundColour()));
+    dc.SetBrush(wxBrush(GetBackgroundColour()));
+    dc.DrawRectangle(rect);
+
+    onRenderBackground(dc);
+    dc.DestroyClippingRegion();
+  }
+
+  composeRect(rect);
+}
+
+bool KeyEditorCanvasSegment::updateLayers() {
+  const wxSize size = GetClientSize();
+
+  if (size.GetWidth() <= 0 || size.GetHeight() <= 0)
+    return false;
+
+  if (foregroundLayer_.GetSize() != size) {
+    backgroundLayer_ = wxBitmap(size.GetWidth(), size.GetHeight());
+    foregroundLayer_ = wxBitmap(size.GetWidth(), size.GetHeight());
+    isBackgroundValid_ = false;
+  }
+
+  if (!isBackgroundValid_) {
+    wxMemoryDC dc(backgroundLayer_);
+    dc.SetBackground(wxBrush(GetBackgroundColour()));
+    dc.Clear();
+
+    onRenderBackground(dc);
+
+    isBackgroundValid_ = true;
+    isForegroundValid_ = false;
+  }
+
+  if (!isForegroundValid_) {
+    composeRect(wxRect(wxPoint(0, 0), size));
+    isForegroundValid_ = true;
+  }
+
+  return true;
+}
+
+void KeyEditorCanvasSegment::composeRect(const wxRect& rect) {
+  wxMemoryDC backgroundDc(backgroundLayer_);
+  wxMemoryDC dc(foregroundLayer_);
+
+  dc.Blit(rect.x, rect.y, rect.width, rect.height, &backgroundDc, rect.x, rect.y);
+
+  dc.SetClippingRegion(rect);
+  onRender(dc, rect);
+  onRenderOverlay(dc, rect);
+  dc.DestroyClippingRegion();
 }
 
 void KeyEditorCanvasSegment::OnPaint(wxPaintEvent& event) {
-  render();
+  wxPaintDC dc(this);
+
+  if (!updateLayers())
+    return;
+
+  wxMemoryDC foregroundDc(foregroundLayer_);
+
+  for (wxRegionIterator it(GetUpdateRegion()); it; ++it) {
+    const wxRect rect = it.GetRect();
+    dc.Blit(rect.x, rect.y, rect.width, rect.height, &foregroundDc, rect.x, rect.y);
+  }
 }
 
 const KeyEditorCanvas* KeyEditorCanvasSegment::canvas() const {
@@ -40,6 +187,11 @@ wxEND_EVENT_TABLE()
 
 static const int _beatsPerBar = 4;
 
+static void renderPlayhead(wxDC& dc, int x, int height) {
+  dc.SetPen(wxPen(wxColor(255, 0, 0), 1));
+  dc.DrawLine(x, 0, x, height);
+}
+
 //-------------------------------------------------------------------------------------------------
 // KeyEditorQuantizationCanvas
 //-------------------------------------------------------------------------------------------------
@@ -49,7 +201,7 @@ KeyEditorQuantizationCanvas::KeyEditorQuantizationCanvas(KeyEditorCanvas* pParen
 
 }
 
-void KeyEditorQuantizationCanvas::onRender(wxDC& dc) {
+void KeyEditorQuantizationCanvas::onRenderBackground(wxDC& dc) {
   const int canvasWidth = GetClientSize().GetWidth() - canvas()->xBlockStartOffset();
   const int numSegments = canvasWidth / canvas()->pixelsPerQuarterNote() + canvas()->pixelsPerQuarterNote();
 
@@ -84,6 +236,14 @@ void KeyEditorQuantizationCanvas::onRender(wxDC& dc) {
   }
 }
 
+void KeyEditorQuantizationCanvas::onRenderOverlay(wxDC& dc, const wxRect& rect) {
+  const int x = canvas()->xBlockStartOffset() + canvas()->playheadX();
+
+  // The area left of the grid belongs to the piano and never shows the playhead:
+  if (x >= canvas()->xBlockStartOffset())
+    renderPlayhead(dc, x, GetClientSize().GetHeight());
+}
+
 //-------------------------------------------------------------------------------------------------
 // KeyEditorPianoCanvas
 //-------------------------------------------------------------------------------------------------
@@ -93,7 +253,7 @@ KeyEditorPianoCanvas::KeyEditorPianoCanvas(KeyEditorCanvas* pParent)
 
 }
 
-void KeyEditorPianoCanvas::onRender(wxDC& dc) {
+void KeyEditorPianoCanvas::onRenderBackground(wxDC& dc) {
   dc.SetPen(wxPen(wxColor(0, 0, 0), 1)); // black line, 1 pixels thick
   dc.SetTextForeground(wxColor(0, 0, 0)); // set text color
 
@@ -109,19 +269,58 @@ void KeyEditorPianoCanvas::onRender(wxDC& dc) {
   }
 }
 
+//-------------------------------------------------------------------------------------------------
+// NoteSpanCache
+//-------------------------------------------------------------------------------------------------
+
+void NoteSpanCache::update(const NoteArray& notes, int pixelsPerQuarterNote, uint16_t tpqn,
+    const std::vector<uint8_t>* pIssues, uint64_t issuesRevision) {
+
+  if (pNotes_ == &notes && revision_ == notes.revision() && pixelsPerQuarterNote_ == pixelsPerQuarterNote &&
+      tpqn_ == tpqn && isFiltered_ == (pIssues != nullptr) && issuesRevision_ == issuesRevision) {
+    return;
+  }
+
+  pNotes_ = &notes;
+  revision_ = notes.revision();
+  pixelsPerQuarterNote_ = pixelsPerQuarterNote;
+  tpqn_ = tpqn;
+  isFiltered_ = pIssues != nullptr;
+  issuesRevision_ = issuesRevision;
+
+  for (std::vector<Span>& spans : spans_)
+    spans.clear();
+
+  // Blocks are visited in order of their start tick, so a block either extends the last span of
+  // its row or starts a new one behind it:
+  for (size_t i = 0; i < notes.size(); ++i) {
+    if (pIssues && (*pIssues)[i] == 0)
+      continue;
+
+    const int x = static_cast<int>((static_cast<uint64_t>(notes.startTick(i)) * pixelsPerQuarterNote) / tpqn);
+    const int width = std::max(1, static_cast<int>((static_cast<uint64_t>(notes.numTicks(i)) * pixelsPerQuarterNote) / tpqn));
+
+    std::vector<Span>& spans = spans_[notes.note(i)];
+
+    if (!spans.empty() && x <= spans.back().x + spans.back().width)
+      spans.back().width = std::max(spans.back().width, x + width - spans.back().x);
+    else
+      spans.push_back({x, width});
+  }
+}
+
 //-------------------------------------------------------------------------------------------------
 // KeyEditorGridCanvas
 //-------------------------------------------------------------------------------------------------
 
-KeyEditorGridCanvas::KeyEditorGridCanvas(KeyEditorCanvas* pParent, Song* pSong) : KeyEditorCanvasSegment(pParent),
-  pSong_(pSong) {
+KeyEditorGridCanvas::KeyEditorGridCanvas(KeyEditorCanvas* pParent, Song* pSong, const PlayabilityAnalysis* pPlayability)
+    : KeyEditorCanvasSegment(pParent), pSong_(pSong), pPlayability_(pPlayability) {
 
 }
 
-void KeyEditorGridCanvas::onRender(wxDC& dc) {
+void KeyEditorGridCanvas::onRenderBackground(wxDC& dc) {
   const wxSize& canvasSize = GetClientSize();
-  const int canvasWidth = canvasSize.GetWidth() / canvas()->pixelsPerQuarterNote();
-  const int numSegments = canvasWidth / canvas()->pixelsPerQuarterNote() + canvas()->pixelsPerQuarterNote();
+  const int numSegments = canvasSize.GetWidth() / canvas()->pixelsPerQuarterNote() + 1;
 
   // draw divisions
   for (int segment = 0; segment < numSegments; ++segment) {
@@ -163,35 +362,226 @@ void KeyEditorGridCanvas::onRender(wxDC& dc) {
     }
   }
 
-  // draw note blocks
-  std::list<SongEvent*> eventsOfCurrentTrack = pSong_->currentSelectedTrack()->songEvents();
+}
+
+void KeyEditorGridCanvas::onRender(wxDC& dc, const wxRect& rect) {
+  const VisibleArea area = visibleArea(rect);
+
+  if (area.highestNote < area.lowestNote)
+    return;
+
+  dc.SetPen(wxPen(wxColor(0, 0, 0), 1)); // black outline, 1 pixels thick
+
+  if (isOverview(rect))
+    renderNoteSpans(dc, area);
+  else
+    renderNoteBlocks(dc, area);
+}
+
+void KeyEditorGridCanvas::onRenderOverlay(wxDC& dc, const wxRect& rect) {
+  renderPlayhead(dc, canvas()->playheadX(), GetClientSize().GetHeight());
+
+  if (editState_ == EditState::Selecting) {
+    const wxRect band = selectionBandRect();
+
+    dc.SetPen(wxPen(wxColor(0, 0, 0), 1, wxPENSTYLE_SHORT_DASH));
+    dc.SetBrush(*wxTRANSPARENT_BRUSH);
+    dc.DrawRectangle(band.x, band.y, band.width, band.height);
+  }
+}
+
+bool KeyEditorGridCanvas::isOverview(const wxRect& rect) {
+  const wxSize size = GetClientSize();
+  const bool isWholeCanvas = rect.x <= 0 && rect.y <= 0 && rect.x + rect.width >= size.GetWidth() &&
+      rect.y + rect.height >= size.GetHeight();
+  const bool isViewChanged = overviewXScrollOffset_ != canvas()->xScrollOffset() ||
+      overviewPixelsPerQuarterNote_ != canvas()->pixelsPerQuarterNote() || overviewWidth_ != size.GetWidth();
+
+  if (!isWholeCanvas && !isViewChanged)
+    return isOverview_;
+
+  overviewXScrollOffset_ = canvas()->xScrollOffset();
+  overviewPixelsPerQuarterNote_ = canvas()->pixelsPerQuarterNote();
+  overviewWidth_ = size.GetWidth();
+
+  // Switch to the level of detail representation as soon as there are more blocks starting inside
+  // the visible range than there are pixel columns to show them:
+  const VisibleArea area = visibleArea(wxRect(wxPoint(0, 0), size));
+  const std::vector<uint32_t>& startTicks = currentNotes().startTicks();
+  const size_t numVisibleBlocks = std::upper_bound(startTicks.begin(), startTicks.end(), area.lastTick) -
+      std::lower_bound(startTicks.begin(), startTicks.end(), area.firstTick);
+
+  const bool wasOverview = isOverview_;
+  isOverview_ = numVisibleBlocks > static_cast<size_t>(size.GetWidth());
+
+  // The rest of the layer still shows the other representation, e.g. after a scroll, so all of it
+  // gets recomposed on the next paint:
+  if (!isWholeCanvas && isOverview_ != wasOverview)
+    render();
+
+  return isOverview_;
+}
+
+KeyEditorGridCanvas::VisibleArea KeyEditorGridCanvas::visibleArea(const wxRect& rect) const {
+  const uint64_t xScrollPixels = canvas()->xScrollOffset() * canvas()->pixelsPerQuarterNote();
+  const int topRow = canvas()->yScrollOffset() + rect.y / canvas()->blockHeight();
+  const int bottomRow = canvas()->yScrollOffset() + (rect.y + rect.height) / canvas()->blockHeight();
+
+  VisibleArea area;
+  area.rect = rect;
+  area.firstTick = static_cast<uint32_t>(((xScrollPixels + std::max(rect.x, 0)) * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote());
+  area.lastTick = static_cast<uint32_t>(((xScrollPixels + rect.x + rect.width + 1) * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote());
+  area.highestNote = MIDI_NUM_NOTES - 1 - topRow;
+  area.lowestNote = std::max(0, MIDI_NUM_NOTES - 1 - bottomRow);
+
+  return area;
+}
+
+wxRect KeyEditorGridCanvas::noteBlockRect(size_t noteIndex) const {
+  const BlockDimensions bd = getVisibleNoteBlockDimensions(noteIndex);
+
+  // include the outline of the block and a pixel of margin to each side:
+  return wxRect(bd.x - 1, bd.y - 1, bd.width + 3, canvas()->blockHeight() + 3);
+}
+
+wxRect KeyEditorGridCanvas::selectionRect() const {
+  const NoteArray& notes = currentNotes();
+  wxRect rect;
+
+  for (EventHandle noteBlock : notes.selection().handles()) {
+    const wxRect blockRect = noteBlockRect(notes.index(noteBlock));
+    rect = rect.IsEmpty() ? blockRect : rect.Union(blockRect);
+  }
+
+  return rect;
+}
+
+wxRect KeyEditorGridCanvas::selectionBandRect() const {
+  const int xScrollPixels = canvas()->xScrollOffset() * canvas()->pixelsPerQuarterNote();
+  const int yScrollPixels = canvas()->yScrollOffset() * canvas()->blockHeight();
+
+  const wxPoint topLeft(std::min(bandStart_.x, bandEnd_.x) - xScrollPixels, std::min(bandStart_.y, bandEnd_.y) - yScrollPixels);
+  const wxPoint bottomRight(std::max(bandStart_.x, bandEnd_.x) - xScrollPixels, std::max(bandStart_.y, bandEnd_.y) - yScrollPixels);
+
+  return wxRect(topLeft, bottomRight);
+}
+
+void KeyEditorGridCanvas::selectBand() {
+  const int left = std::max(std::min(bandStart_.x, bandEnd_.x), 0);
+  const int right = std::max(std::max(bandStart_.x, bandEnd_.x), 0);
+  const int topRow = std::max(std::min(bandStart_.y, bandEnd_.y), 0) / canvas()->blockHeight();
+  const int bottomRow = std::max(std::max(bandStart_.y, bandEnd_.y), 0) / canvas()->blockHeight();
+
+  if (right == left || topRow > MIDI_NUM_NOTES - 1)
+    return;
+
+  const uint32_t firstTick = static_cast<uint32_t>((uint64_t(left) * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote());
+  const uint32_t lastTick = static_cast<uint32_t>((uint64_t(right) * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote());
+  const int highestNote = MIDI_NUM_NOTES - 1 - topRow;
+  const int lowestNote = std::max(0, MIDI_NUM_NOTES - 1 - bottomRow);
+
+  currentNotes().selectRange(firstTick, lastTick, static_cast<uint8_t>(lowestNote), static_cast<uint8_t>(highestNote));
+}
+
+void KeyEditorGridCanvas::renderNoteBlocks(wxDC& dc, const VisibleArea& area) {
+  const NoteArray& notes = currentNotes();
 
-  for (const SongEvent* pSongEvent : eventsOfCurrentTrack) {
-    if (pSongEvent->type() == SongEventType::NoteBlock) {
-      const NoteBlock& noteBlock = *static_cast<const NoteBlock*>(pSongEvent);
-      const BlockDimensions bd = getVisibleNoteBlockDimensions(noteBlock);
+  std::vector<EventHandle> visibleBlocks;
+  notes.query(area.firstTick, area.lastTick, area.lowestNote, area.highestNote, visibleBlocks);
 
-      if (noteBlock.isSelected())
-        dc.SetBrush(wxBrush(wxColour(0, 255, 255)));
-      else
-        dc.SetBrush(wxBrush(wxColour(0, 255, 0)));
+  const wxBrush selectedBrush(wxColour(0, 255, 255));
+  const wxBrush unselectedBrush(wxColour(0, 255, 0));
+  const wxBrush unplayableBrush(wxColour(255, 128, 0));
 
-      dc.DrawRectangle(bd.x, bd.y, bd.width, canvas()->blockHeight());
+  // Results of an older revision don't match the block indices anymore, so they aren't shown:
+  const PlayabilityAnalysis::TrackResult* pResult =
+      pPlayability_->trackResult(pSong_->currentSelectedTrackNo(), pSong_->currentSelectedTrack()->revision());
+
+  for (EventHandle noteBlock : visibleBlocks) {
+    const size_t i = notes.index(noteBlock);
+    const BlockDimensions bd = getVisibleNoteBlockDimensions(i);
+    const bool isPlayable = !pResult || pResult->issues[i] == 0;
+
+    dc.SetBrush(notes.isSelected(i) ? selectedBrush : isPlayable ? unselectedBrush : unplayableBrush);
+    dc.DrawRectangle(bd.x, bd.y, bd.width, canvas()->blockHeight());
+  }
+}
+
+void KeyEditorGridCanvas::renderNoteSpans(wxDC& dc, const VisibleArea& area) {
+  const NoteArray& notes = currentNotes();
+  noteSpanCache_.update(notes, canvas()->pixelsPerQuarterNote(), pSong_->tpqn());
+
+  const int xScrollPixels = canvas()->xScrollOffset() * canvas()->pixelsPerQuarterNote();
+  const int firstX = xScrollPixels + area.rect.x;
+  const int lastX = firstX + area.rect.width;
+
+  dc.SetBrush(wxBrush(wxColour(0, 255, 0)));
+
+  auto renderSpans = [&](const NoteSpanCache& cache) {
+    for (int note = area.lowestNote; note <= area.highestNote; ++note) {
+      const std::vector<NoteSpanCache::Span>& spans = cache.spans(static_cast<uint8_t>(note));
+      const int y = canvas()->blockHeight() * (MIDI_NUM_NOTES - 1 - note - canvas()->yScrollOffset());
+
+      auto spanEndsBefore = [](const NoteSpanCache::Span& span, int x) { return span.x + span.width <= x; };
+      auto it = std::lower_bound(spans.begin(), spans.end(), firstX, spanEndsBefore);
+
+      for (; it != spans.end() && it->x < lastX; ++it) {
+        const int x = std::max(it->x - xScrollPixels, 0);
+        dc.DrawRectangle(x, y, it->x + it->width - xScrollPixels - x, canvas()->blockHeight());
+      }
+    }
+  };
+
+  renderSpans(noteSpanCache_);
+
+  // Unplayable blocks get spans of their own on top, so they stay highlighted like single blocks:
+  const PlayabilityAnalysis::TrackResult* pResult =
+      pPlayability_->trackResult(pSong_->currentSelectedTrackNo(), pSong_->currentSelectedTrack()->revision());
+
+  if (pResult) {
+    unplayableSpanCache_.update(notes, canvas()->pixelsPerQuarterNote(), pSong_->tpqn(), &pResult->issues,
+        pResult->tempoRevision);
+
+    dc.SetBrush(wxBrush(wxColour(255, 128, 0)));
+    renderSpans(unplayableSpanCache_);
+  }
+
+  // Selected blocks are still drawn one by one on top, so the selection stays visible. Only the
+  // selection is visited, never the visible range of the track:
+  dc.SetBrush(wxBrush(wxColour(0, 255, 255)));
+
+  for (EventHandle noteBlock : notes.selection().handles()) {
+    const size_t i = notes.index(noteBlock);
+
+    if (notes.startTick(i) <= area.lastTick && notes.endTick(i) >= area.firstTick &&
+        notes.note(i) >= area.lowestNote && notes.note(i) <= area.highestNote) {
+      const BlockDimensions bd = getVisibleNoteBlockDimensions(i);
+      dc.DrawRectangle(bd.x, bd.y, std::max(bd.width, 1), canvas()->blockHeight());
     }
   }
 }
 
-KeyEditorGridCanvas::BlockDimensions KeyEditorGridCanvas::getAbsoluteNoteBlockDimensions(const NoteBlock& noteBlock) const {
+const NoteArray& KeyEditorGridCanvas::currentNotes() const {
+  return pSong_->currentSelectedTrack()->events().notes();
+}
+
+NoteArray& KeyEditorGridCanvas::currentNotes() {
+  return pSong_->currentSelectedTrack()->events().notes();
+}
+
+KeyEditorGridCanvas::BlockDimensions KeyEditorGridCanvas::getAbsoluteNoteBlockDimensions(size_t noteIndex) const {
+  const NoteArray& notes = currentNotes();
+
   BlockDimensions bd;
-  bd.x = (noteBlock.startTick() * canvas()->pixelsPerQuarterNote()) / pSong_->tpqn();
-  bd.y = canvas()->blockHeight() * (127 - noteBlock.note());
-  bd.width = (noteBlock.numTicks() * canvas()->pixelsPerQuarterNote()) / pSong_->tpqn();
+  bd.x = (notes.startTick(noteIndex) * canvas()->pixelsPerQuarterNote()) / pSong_->tpqn();
+  bd.y = canvas()->blockHeight() * (127 - notes.note(noteIndex));
+  bd.width = (notes.numTicks(noteIndex) * canvas()->pixelsPerQuarterNote()) / pSong_->tpqn();
 
   return bd;
 }
 
-KeyEditorGridCanvas::BlockDimensions KeyEditorGridCanvas::getVisibleNoteBlockDimensions(const NoteBlock& noteBlock) const {
-  BlockDimensions bd = getAbsoluteNoteBlockDimensions(noteBlock);
+KeyEditorGridCanvas::BlockDimensions KeyEditorGridCanvas::getVisibleNoteBlockDimensions(size_t noteIndex) const {
+  BlockDimensions bd = getAbsoluteNoteBlockDimensions(noteIndex);
   bd.x -= canvas()->xScrollOffset() * canvas()->pixelsPerQuarterNote();
   bd.y -= canvas()->blockHeight() * canvas()->yScrollOffset();
 
@@ -231,8 +621,8 @@ KeyEditorGridCanvas::CellPosition KeyEditorGridCanvas::currentPointedCell() {
   return currentPointedCell(mouseX, mouseY);
 }
 
-KeyEditorGridCanvas::ResizeArea KeyEditorGridCanvas::noteBlockResizeArea(const NoteBlock& noteBlock, int mouseX, int mouseY) const {
-  const BlockDimensions bd = getVisibleNoteBlockDimensions(noteBlock);
+KeyEditorGridCanvas::ResizeArea KeyEditorGridCanvas::noteBlockResizeArea(EventHandle noteBlock, int mouseX, int mouseY) const {
+  const BlockDimensions bd = getVisibleNoteBlockDimensions(currentNotes().index(noteBlock));
 
   const int margin = 10;
 
@@ -244,19 +634,31 @@ KeyEditorGridCanvas::ResizeArea KeyEditorGridCanvas::noteBlockResizeArea(const N
     return ResizeArea::None;
 }
 
-NoteBlock* KeyEditorGridCanvas::currentPointedNoteBlock(int mouseX, int mouseY) {
-  for (SongEvent* pSongEvent : pSong_->currentSelectedTrack()->songEvents()) {
-    if (pSongEvent->type() == SongEventType::NoteBlock) {
-      NoteBlock& noteBlock = *static_cast<NoteBlock*>(pSongEvent);
+EventHandle KeyEditorGridCanvas::currentPointedNoteBlock(int mouseX, int mouseY) const {
+  const int mouseXabs = mouseX + canvas()->xScrollOffset() * canvas()->pixelsPerQuarterNote();
+  const int mouseYabs = mouseY + canvas()->yScrollOffset() * canvas()->blockHeight();
+  const int row = mouseYabs / canvas()->blockHeight();
 
-      const BlockDimensions bd = getVisibleNoteBlockDimensions(noteBlock);
+  if (mouseX < 0 || mouseY < 0 || row > 127)
+    return EventHandle();
 
-      if (mouseX > bd.x && mouseX < bd.x + bd.width && mouseY > bd.y && mouseY < bd.y + canvas()->blockHeight())
-        return &noteBlock;
-    }
+  // Only blocks of the pointed note overlapping the ticks of the pointed pixel column can be hit:
+  const uint8_t note = static_cast<uint8_t>(127 - row);
+  const uint32_t firstTick = (mouseXabs * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote();
+  const uint32_t lastTick = ((mouseXabs + 1) * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote();
+
+  const NoteArray& notes = currentNotes();
+  std::vector<EventHandle> candidates;
+  notes.query(firstTick, lastTick, note, note, candidates);
+
+  for (EventHandle candidate : candidates) {
+    const BlockDimensions bd = getVisibleNoteBlockDimensions(notes.index(candidate));
+
+    if (mouseX > bd.x && mouseX < bd.x + bd.width && mouseY > bd.y && mouseY < bd.y + canvas()->blockHeight())
+      return candidate;
   }
 
-  return nullptr;
+  return EventHandle();
 }
 
 void KeyEditorGridCanvas::OnMouseLeftDown(wxMouseEvent& event) {
@@ -265,109 +667,154 @@ void KeyEditorGridCanvas::OnMouseLeftDown(wxMouseEvent& event) {
   const int mouseX = event.GetX();
   const int mouseY = event.GetY();
 
-  if (NoteBlock* pNoteBlock = currentPointedNoteBlock(mouseX, mouseY)) {
-    switch (noteBlockResizeArea(*pNoteBlock, mouseX, mouseY)) {
+  const EventHandle noteBlock = currentPointedNoteBlock(mouseX, mouseY);
+
+  if (noteBlock.isValid()) {
+    switch (noteBlockResizeArea(noteBlock, mouseX, mouseY)) {
       case ResizeArea::Left:
-        pCurrentEditNoteBlock_ = pNoteBlock;
+        currentEditNoteBlock_ = noteBlock;
         editState_ = EditState::ResizingNoteLeft;
         break;
 
       case ResizeArea::Right:
-        pCurrentEditNoteBlock_ = pNoteBlock;
+        currentEditNoteBlock_ = noteBlock;
         editState_ = EditState::ResizingNoteRight;
         break;
 
       case ResizeArea::None:
-        const BlockDimensions dm = getVisibleNoteBlockDimensions(*pNoteBlock);
-        pCurrentEditNoteBlock_ = pNoteBlock;
+        const BlockDimensions dm = getVisibleNoteBlockDimensions(currentNotes().index(noteBlock));
+        currentEditNoteBlock_ = noteBlock;
         editStartBlockXClickPosition_ = mouseX - dm.x;
         editState_ = EditState::Moving;
         break;
     }
 
-    pSong_->unselectAllEvents();
-    pNoteBlock->select();
-    pClickedTarget = eMidi_numberToNote(pNoteBlock->note());
+    // A block of the selection keeps it, so all of its blocks are edited together. Shift adds
+    // blocks to the selection instead of replacing it:
+    if (!currentNotes().selection().contains(noteBlock)) {
+      if (!event.ShiftDown())
+        pSong_->unselectAllEvents();
+
+      currentNotes().select(noteBlock);
+    }
+
+    pClickedTarget = eMidi_numberToNote(currentNotes().note(currentNotes().index(noteBlock)));
+  }
+  else {
+    if (!event.ShiftDown())
+      pSong_->unselectAllEvents();
+
+    bandStart_ = wxPoint(mouseX + canvas()->xScrollOffset() * canvas()->pixelsPerQuarterNote(),
+        mouseY + canvas()->yScrollOffset() * canvas()->blockHeight());
+    bandEnd_ = bandStart_;
+    editState_ = EditState::Selecting;
   }
-  else
-    pSong_->unselectAllEvents();
 
   printf("clicked on: %s\n", pClickedTarget);
   render();
 }
 
 void KeyEditorGridCanvas::OnMouseLeftUp(wxMouseEvent& event) {
-  pCurrentEditNoteBlock_ = nullptr;
+  // An edit may have changed the track length, which is shown by the transport and the track list,
+  // and the playability of the track. While editing, the highlighting of the block stays as it was:
+  if (editState_ == EditState::Selecting) {
+    editState_ = EditState::Idle;
+    selectBand();
+    render();
+  }
+  else if (editState_ != EditState::Idle)
+    RedrawScheduler::request(this, RedrawScheduler::Transport | RedrawScheduler::TrackList | RedrawScheduler::Playability);
+
+  currentEditNoteBlock_ = EventHandle();
   editStartBlockXClickPosition_ = 0;
   editState_ = EditState::Idle;
 }
 
-void KeyEditorGridCanvas::OnPaint(wxPaintEvent& event) {
-  wxPaintDC dc(this);
-  onRender(dc);
-}
-
 void KeyEditorGridCanvas::OnMouseMotion(wxMouseEvent& event) {
   const int mouseX = event.GetX();
   const int mouseY = event.GetY();
   const int mouseXabs = event.GetX() + canvas()->xScrollOffset() * canvas()->pixelsPerQuarterNote();
 
+  NoteArray& notes = currentNotes();
+
+  // The edited block is gone, if a background import has replaced the song in the meantime:
+  if (editState_ != EditState::Idle && editState_ != EditState::Selecting && !notes.contains(currentEditNoteBlock_))
+    editState_ = EditState::Idle;
+
+  // Only the area the selection covered before and after the edit needs to be repainted:
+  auto renderEditedSelection = [&](const wxRect& oldRect) {
+    renderRect(oldRect.Union(selectionRect()));
+  };
+
   switch (editState_) {
     case EditState::ResizingNoteRight: {
-      const BlockDimensions dm = getAbsoluteNoteBlockDimensions(*pCurrentEditNoteBlock_);
+      const BlockDimensions dm = getAbsoluteNoteBlockDimensions(notes.index(currentEditNoteBlock_));
       const int newWidth = mouseXabs - dm.x;
 
       if (newWidth <= 30)
         break;
 
       const int newTicks = (newWidth * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote();
+      const wxRect oldRect = selectionRect();
 
-      pCurrentEditNoteBlock_->setNumTicks(newTicks);
-      render();
+      notes.resizeSelection(0, newTicks - static_cast<int>(notes.numTicks(notes.index(currentEditNoteBlock_))));
+      renderEditedSelection(oldRect);
 
       break;
     }
 
     case EditState::ResizingNoteLeft: {
-      const BlockDimensions dm = getAbsoluteNoteBlockDimensions(*pCurrentEditNoteBlock_);
+      const size_t noteIndex = notes.index(currentEditNoteBlock_);
+      const BlockDimensions dm = getAbsoluteNoteBlockDimensions(noteIndex);
       const int newStart = (mouseXabs * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote();
       const int newWidth = dm.x + dm.width - mouseXabs;
 
       if (newWidth <= 30)
         break;
 
-      const int newTicks = pCurrentEditNoteBlock_->numTicks() + pCurrentEditNoteBlock_->startTick() - newStart;
+      const wxRect oldRect = selectionRect();
 
-      pCurrentEditNoteBlock_->setStartTick(newStart);
-      pCurrentEditNoteBlock_->setNumTicks(newTicks);
-      render();
+      notes.resizeSelection(newStart - static_cast<int>(notes.startTick(noteIndex)), 0);
+      renderEditedSelection(oldRect);
 
       break;
     }
 
     case EditState::Moving: {
-      const BlockDimensions dm = getAbsoluteNoteBlockDimensions(*pCurrentEditNoteBlock_);
       int newStart = ((mouseXabs - editStartBlockXClickPosition_) * pSong_->tpqn()) / canvas()->pixelsPerQuarterNote();
 
       if (newStart < 0)
         newStart = 0;
 
       const CellPosition pos = currentPointedCell(mouseX, mouseY);
-      const uint8_t newNote = static_cast<uint8_t>(127 - pos.absoluteYindex);
+      const int newNote = 127 - pos.absoluteYindex;
+      const size_t noteIndex = notes.index(currentEditNoteBlock_);
+      const wxRect oldRect = selectionRect();
+
+      notes.moveSelection(newStart - static_cast<int>(notes.startTick(noteIndex)), newNote - notes.note(noteIndex));
+      renderEditedSelection(oldRect);
+
+      break;
+    }
+
+    case EditState::Selecting: {
+      const wxRect oldRect = selectionBandRect();
+      bandEnd_ = wxPoint(mouseXabs, mouseY + canvas()->yScrollOffset() * canvas()->blockHeight());
 
-      pCurrentEditNoteBlock_->setNote(newNote);
-      pCurrentEditNoteBlock_->setStartTick(newStart);
-      render();
+      // include the dashed outline on either side:
+      renderRect(oldRect.Union(selectionBandRect()).Inflate(1, 1));
 
       break;
     }
 
     default: {
-      if (NoteBlock* pNoteBlock = currentPointedNoteBlock(mouseX, mouseY)) {
+      const EventHandle noteBlock = currentPointedNoteBlock(mouseX, mouseY);
+
+      if (noteBlock.isValid()) {
         // TODO: - Only set mouse arrow when area changes.
         //       - Why is default arrow set automatically when leaving a note block?
 
-        switch (noteBlockResizeArea(*pNoteBlock, mouseX, mouseY)) {
+        switch (noteBlockResizeArea(noteBlock, mouseX, mouseY)) {
           case ResizeArea::Left:
           case ResizeArea::Right:
             wxSetCursor(wxCursor(wxCURSOR_SIZEWE));
@@ -382,8 +829,7 @@ void KeyEditorGridCanvas::OnMouseMotion(wxMouseEvent& event) {
   }
 }
 
-wxBEGIN_EVENT_TABLE(KeyEditorGridCanvas, wxWindow)
-EVT_PAINT(KeyEditorGridCanvas::OnPaint)
+wxBEGIN_EVENT_TABLE(KeyEditorGridCanvas, KeyEditorCanvasSegment)
 EVT_MOTION(KeyEditorGridCanvas::OnMouseMotion)
 EVT_LEFT_DOWN(KeyEditorGridCanvas::OnMouseLeftDown)
 EVT_LEFT_UP(KeyEditorGridCanvas::OnMouseLeftUp)
@@ -393,14 +839,15 @@ wxEND_EVENT_TABLE()
 // KeyEditorCanvas
 //-------------------------------------------------------------------------------------------------
 
-KeyEditorCanvas::KeyEditorCanvas(wxWindow* pParent, Song* const pSong)
-    : wxWindow(pParent, wxID_ANY, wxDefaultPosition, wxDefaultSize) {
+KeyEditorCanvas::KeyEditorCanvas(wxWindow* pParent, Song* const pSong, const PlayabilityAnalysis* pPlayability)
+    : wxWindow(pParent, wxID_ANY, wxDefaultPosition, wxDefaultSize),
+      pSong_(pSong) {
 
   wxSizer* pTopSizer = new wxBoxSizer(wxVERTICAL);
 
   pKeyEditorQuantizationCanvas_ = new KeyEditorQuantizationCanvas(this);
   pKeyEditorPianoCanvas_ = new KeyEditorPianoCanvas(this);
-  pKeyEditorGridCanvas_ = new KeyEditorGridCanvas(this, pSong);
+  pKeyEditorGridCanvas_ = new KeyEditorGridCanvas(this, pSong, pPlayability);
 
   wxSizer* pPianoGridSizer = new wxBoxSizer(wxHORIZONTAL);
   pPianoGridSizer->Add(pKeyEditorPianoCanvas_, 0, wxEXPAND);
@@ -419,22 +866,64 @@ void KeyEditorCanvas::render() {
 }
 
 void KeyEditorCanvas::setXscrollPosition(int xScrollPosition) {
+  // Scrolling by whole quarter notes keeps all divisions and labels in place relative to the
+  // content, so the existing pixels can be shifted instead of being redrawn:
+  const int dx = (xScrollPosition - xScrollOffset_) * pixelsPerQuarterNote_;
+
   xScrollOffset_ = xScrollPosition;
-  render();
+  pKeyEditorQuantizationCanvas_->scrollLayers(dx, xBlockStartOffset_);
+  pKeyEditorGridCanvas_->scrollLayers(dx, 0);
+}
+
+void KeyEditorCanvas::setPlayheadTick(uint32_t tick, bool isFollowing) {
+  int oldX = playheadX();
+  playheadTick_ = tick;
+
+  const int newX = playheadX();
+
+  if (isFollowing && (newX < 0 || newX >= pKeyEditorGridCanvas_->GetClientSize().GetWidth())) {
+    const int xScrollPosition = static_cast<int>(tick / pSong_->tpqn());
+
+    // The old playhead gets shifted along with the rest of the pixels:
+    oldX -= (xScrollPosition - xScrollOffset_) * pixelsPerQuarterNote_;
+    setXscrollPosition(xScrollPosition);
+  }
+  else if (newX == oldX) {
+    return;
+  }
+
+  pKeyEditorQuantizationCanvas_->renderColumn(xBlockStartOffset_ + oldX);
+  pKeyEditorQuantizationCanvas_->renderColumn(xBlockStartOffset_ + playheadX());
+  pKeyEditorGridCanvas_->renderColumn(oldX);
+  pKeyEditorGridCanvas_->renderColumn(playheadX());
+}
+
+int KeyEditorCanvas::playheadX() const {
+  const int64_t x = (static_cast<int64_t>(playheadTick_) * pixelsPerQuarterNote_) / pSong_->tpqn() -
+      static_cast<int64_t>(xScrollOffset_) * pixelsPerQuarterNote_;
+
+  // Far off screen positions are clamped, so callers can still offset them without overflowing:
+  return static_cast<int>(std::max<int64_t>(std::min<int64_t>(x, 1 << 24), -(1 << 24)));
 }
 
 void KeyEditorCanvas::setYscrollPosition(int yScrollPosition) {
   yScrollOffset_ = yScrollPosition;
+  pKeyEditorPianoCanvas_->invalidateBackground();
+  pKeyEditorGridCanvas_->invalidateBackground();
   render();
 }
 
 void KeyEditorCanvas::setXzoomFactor(int xZoomFactor) {
   pixelsPerQuarterNote_ = (1 + xZoomFactor) * 10;
+  pKeyEditorQuantizationCanvas_->invalidateBackground();
+  pKeyEditorGridCanvas_->invalidateBackground();
   render();
 }
 
 void KeyEditorCanvas::setYzoomFactor(int yZoomFactor) {
   blockHeight_ = (1 + yZoomFactor) * 10;
+  pKeyEditorPianoCanvas_->invalidateBackground();
+  pKeyEditorGridCanvas_->invalidateBackground();
   render();
 }
 
@@ -442,9 +931,10 @@ void KeyEditorCanvas::setYzoomFactor(int yZoomFactor) {
 // KeyEditorWindow
 //-------------------------------------------------------------------------------------------------
 
-KeyEditorWindow::KeyEditorWindow(wxWindow* pParent, Song* pSong)
+KeyEditorWindow::KeyEditorWindow(wxWindow* pParent, Song* pSong, const PlaybackEngine* pPlaybackEngine,
+    const PlayabilityAnalysis* pPlayability)
     : wxWindow(pParent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxBORDER_SUNKEN),
-      pSong_(pSong) {
+      playheadTimer_(this, PlayheadTimerId), pSong_(pSong), pPlaybackEngine_(pPlaybackEngine) {
 
 #ifdef __linux__
   constexpr int controlBarWidth = 26; // minimum size allowed by GTK
@@ -468,7 +958,7 @@ KeyEditorWindow::KeyEditorWindow(wxWindow* pParent, Song* pSong)
   pVerticalBarSizer->Add(pVerticalScrollbar_, 1);
   pVerticalBarSizer->Add(pVerticalZoomSlider_, 0);
 
-  pKeyEditorCanvas_ = new KeyEditorCanvas(this, pSong_);
+  pKeyEditorCanvas_ = new KeyEditorCanvas(this, pSong_, pPlayability);
 
   wxFlexGridSizer* pTopSizer = new wxFlexGridSizer(2, 2, wxSize(0, 0));
   pTopSizer->Add(pKeyEditorCanvas_, 1, wxEXPAND);
@@ -481,6 +971,9 @@ KeyEditorWindow::KeyEditorWindow(wxWindow* pParent, Song* pSong)
   SetSizer(pTopSizer);
 
   setDefaultScrollPositions();
+
+  // The timer only reads the position the timing thread publishes, so it never holds up playback:
+  playheadTimer_.Start(1000 / 60);
 }
 
 void KeyEditorWindow::render() {
@@ -558,7 +1051,19 @@ void KeyEditorWindow::OnMouseWheel(wxMouseEvent& event) {
   }
 }
 
+void KeyEditorWindow::OnPlayheadTimer(wxTimerEvent& event) {
+  const bool isPlaying = pPlaybackEngine_->isPlaying();
+  const uint32_t tick = pSong_->tempoMap().usToTick(pPlaybackEngine_->positionUs());
+
+  // Follow the playhead only while playing, so the view can be scrolled freely otherwise:
+  pKeyEditorCanvas_->setPlayheadTick(tick, isPlaying);
+
+  if (pHorizontalScrollbar_->GetThumbPosition() != pKeyEditorCanvas_->xScrollOffset())
+    pHorizontalScrollbar_->SetThumbPosition(pKeyEditorCanvas_->xScrollOffset());
+}
+
 wxBEGIN_EVENT_TABLE(KeyEditorWindow, wxWindow)
 EVT_SCROLL(KeyEditorWindow::OnScroll)
 EVT_MOUSEWHEEL(KeyEditorWindow::OnMouseWheel)
+EVT_TIMER(PlayheadTimerId, KeyEditorWindow::OnPlayheadTimer)
 wxEND_EVENT_TABLE()
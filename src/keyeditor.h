@@ -3,6 +3,8 @@
 
 #include <wx/wx.h>
 
+#include "playability.h"
+#include "playbackengine.h"
 #include "song.h"
 
 class KeyEditorCanvas;
@@ -11,10 +13,22 @@ class KeyEditorCanvas;
 // KeyEditorCanvasCanvasSegment
 //-------------------------------------------------------------------------------------------------
 
+// Every segment paints from two off-screen layers: a background layer, which is only redrawn after
+// invalidateBackground() was called or the segment got resized, and a foreground layer, which is
+// the background plus everything drawn by onRender(). Partial updates recompose and repaint just
+// the dirty rectangle. Overlays like the playhead are drawn on top of the foreground while a
+// rectangle is composed, so moving them only recomposes the columns they leave and enter.
 class KeyEditorCanvasSegment : public wxWindow {
 public:
   KeyEditorCanvasSegment(KeyEditorCanvas* pParent, const wxSize& size);
   void render();
+  void renderRect(const wxRect& rect);
+  void renderColumn(int x);
+  void invalidateBackground()                  { isBackgroundValid_ = false; }
+
+  // Scrolls everything right of 'left' by 'dx' pixels. Both layers are shifted in place and only
+  // the strips which can't be taken over from the previous position are redrawn:
+  void scrollLayers(int dx, int left);
 
 protected:
   const KeyEditorCanvas* canvas() const;
@@ -22,7 +36,19 @@ protected:
 
 private:
   void OnPaint(wxPaintEvent& event);
-  virtual void onRender(wxDC& dc) = 0;
+  bool updateLayers();
+  void composeRect(const wxRect& rect);
+  void redrawRect(const wxRect& rect);
+  void shiftLayer(wxBitmap& layer, int dx, int left);
+  virtual void onRenderBackground(wxDC& dc) = 0;
+  virtual void onRender(wxDC& dc, const wxRect& rect) {}
+  virtual void onRenderOverlay(wxDC& dc, const wxRect& rect) {}
+
+  wxBitmap backgroundLayer_;
+  wxBitmap foregroundLayer_;
+  wxBitmap scratchLayer_;
+  bool isBackgroundValid_{false};
+  bool isForegroundValid_{false};
 
   wxDECLARE_EVENT_TABLE();
 };
@@ -36,7 +62,8 @@ public:
   KeyEditorQuantizationCanvas(KeyEditorCanvas* pParent);
 
 private:
-  void onRender(wxDC& dc) final;
+  void onRenderBackground(wxDC& dc) final;
+  void onRenderOverlay(wxDC& dc, const wxRect& rect) final;
 };
 
 //-------------------------------------------------------------------------------------------------
@@ -48,7 +75,38 @@ public:
   KeyEditorPianoCanvas(KeyEditorCanvas* pParent);
 
 private:
-  void onRender(wxDC& dc) final;
+  void onRenderBackground(wxDC& dc) final;
+};
+
+//-------------------------------------------------------------------------------------------------
+// NoteSpanCache
+//-------------------------------------------------------------------------------------------------
+
+// Level of detail representation of a track for far zoom levels: all note blocks of a note row are
+// merged into non overlapping pixel spans, so a dense passage is drawn as a few bars instead of
+// thousands of rectangles sharing the same pixel columns.
+class NoteSpanCache {
+public:
+  struct Span {
+    int x;
+    int width;
+  };
+
+  // With 'pIssues', only blocks having any playability issue are merged. 'issuesRevision' tells
+  // apart the results of the same block revision, e.g. before and after a tempo change:
+  void update(const NoteArray& notes, int pixelsPerQuarterNote, uint16_t tpqn,
+      const std::vector<uint8_t>* pIssues = nullptr, uint64_t issuesRevision = 0);
+  const std::vector<Span>& spans(uint8_t note) const { return spans_[note & 0x7F]; }
+
+private:
+  std::vector<Span> spans_[128];
+
+  const NoteArray* pNotes_{nullptr};
+  uint64_t revision_{0};
+  bool isFiltered_{false};
+  uint64_t issuesRevision_{0};
+  int pixelsPerQuarterNote_{0};
+  uint16_t tpqn_{0};
 };
 
 //-------------------------------------------------------------------------------------------------
@@ -57,7 +115,7 @@ private:
 
 class KeyEditorGridCanvas : public KeyEditorCanvasSegment {
 public:
-  KeyEditorGridCanvas(KeyEditorCanvas* pParent, Song* pSong);
+  KeyEditorGridCanvas(KeyEditorCanvas* pParent, Song* pSong, const PlayabilityAnalysis* pPlayability);
 
 private:
   struct CellPosition {
@@ -73,6 +131,14 @@ private:
     int width;
   };
 
+  struct VisibleArea {
+    wxRect rect;
+    uint32_t firstTick;
+    uint32_t lastTick;
+    int lowestNote;
+    int highestNote;
+  };
+
   enum class ResizeArea {
     None,
     Left,
@@ -83,25 +149,49 @@ private:
     Idle,
     ResizingNoteLeft,
     ResizingNoteRight,
-    Moving
+    Moving,
+    Selecting
   } editState_{EditState::Idle};
 
-  void OnPaint(wxPaintEvent& event);
   void OnMouseMotion(wxMouseEvent& event);
   void OnMouseLeftDown(wxMouseEvent& event);
   void OnMouseLeftUp(wxMouseEvent& event);
-  virtual void onRender(wxDC& dc) final;
+  void onRenderBackground(wxDC& dc) final;
+  void onRender(wxDC& dc, const wxRect& rect) final;
+  void onRenderOverlay(wxDC& dc, const wxRect& rect) final;
+  void renderNoteBlocks(wxDC& dc, const VisibleArea& area);
+  void renderNoteSpans(wxDC& dc, const VisibleArea& area);
+  bool isOverview(const wxRect& rect);
+  VisibleArea visibleArea(const wxRect& rect) const;
+  wxRect noteBlockRect(size_t noteIndex) const;
+  wxRect selectionRect() const;
+  wxRect selectionBandRect() const;
+  void selectBand();
 
   CellPosition currentPointedCell(int mouseX, int mouseY);
   CellPosition currentPointedCell();
-  ResizeArea noteBlockResizeArea(const NoteBlock& noteBlock, int mouseX, int mouseY) const;
-  BlockDimensions getAbsoluteNoteBlockDimensions(const NoteBlock& noteBlock) const;
-  BlockDimensions getVisibleNoteBlockDimensions(const NoteBlock& noteBlock) const;
-  NoteBlock* currentPointedNoteBlock(int mouseX, int mouseY);
-  NoteBlock* pCurrentEditNoteBlock_{nullptr};
+  ResizeArea noteBlockResizeArea(EventHandle noteBlock, int mouseX, int mouseY) const;
+  BlockDimensions getAbsoluteNoteBlockDimensions(size_t noteIndex) const;
+  BlockDimensions getVisibleNoteBlockDimensions(size_t noteIndex) const;
+  EventHandle currentPointedNoteBlock(int mouseX, int mouseY) const;
+  const NoteArray& currentNotes() const;
+  NoteArray& currentNotes();
+  EventHandle currentEditNoteBlock_;
   int editStartBlockXClickPosition_{0};
+  wxPoint bandStart_; // corners of the rubber band, in pixels from the top left of the whole grid
+  wxPoint bandEnd_;
+  NoteSpanCache noteSpanCache_;
+  NoteSpanCache unplayableSpanCache_;
+
+  // Whether the grid shows the level of detail representation. It's decided for the whole visible
+  // area whenever the view changes, so partially redrawn rects always match the rest of the layer:
+  bool isOverview_{false};
+  int overviewXScrollOffset_{-1};
+  int overviewPixelsPerQuarterNote_{0};
+  int overviewWidth_{0};
 
   Song* const pSong_;
+  const PlayabilityAnalysis* const pPlayability_;
 
   wxDECLARE_EVENT_TABLE();
 };
@@ -112,7 +202,7 @@ private:
 
 class KeyEditorCanvas : public wxWindow {
 public:
-  KeyEditorCanvas(wxWindow* pParent, Song* const pSong);
+  KeyEditorCanvas(wxWindow* pParent, Song* const pSong, const PlayabilityAnalysis* pPlayability);
   void render();
 
   void setXscrollPosition(int xScrollPosition);
@@ -120,6 +210,10 @@ public:
   void setXzoomFactor(int xZoomFactor);
   void setYzoomFactor(int yZoomFactor);
 
+  // Moves the playhead to 'tick'. While following, the view pages forward (or back after a seek)
+  // as soon as the playhead leaves it:
+  void setPlayheadTick(uint32_t tick, bool isFollowing);
+
   enum class ScrollBarType {
     HorizontalScroll,
     VerticalScroll,
@@ -134,6 +228,10 @@ public:
   int pixelsPerQuarterNote() const { return pixelsPerQuarterNote_; }
   int blockHeight() const          { return blockHeight_; }
 
+  // Position of the playhead relative to the left edge of the grid, outside of the grid while the
+  // playhead is scrolled out of view:
+  int playheadX() const;
+
 private:
   KeyEditorQuantizationCanvas* pKeyEditorQuantizationCanvas_{nullptr};
   KeyEditorPianoCanvas* pKeyEditorPianoCanvas_{nullptr};
@@ -145,6 +243,9 @@ private:
   int yScrollOffset_{0};
   int pixelsPerQuarterNote_{10};
   int blockHeight_{10};
+  uint32_t playheadTick_{0};
+
+  Song* const pSong_;
 };
 
 //-------------------------------------------------------------------------------------------------
@@ -153,22 +254,28 @@ private:
 
 class KeyEditorWindow : public wxWindow {
 public:
-  KeyEditorWindow(wxWindow* pParent, Song* pSong);
+  KeyEditorWindow(wxWindow* pParent, Song* pSong, const PlaybackEngine* pPlaybackEngine,
+      const PlayabilityAnalysis* pPlayability);
   void render();
 
   void setDefaultScrollPositions();
 
 private:
+  static const int PlayheadTimerId = wxID_HIGHEST + 14;
+
   void OnScroll(wxScrollEvent& event);
   void OnMouseWheel(wxMouseEvent& event);
+  void OnPlayheadTimer(wxTimerEvent& event);
 
   KeyEditorCanvas* pKeyEditorCanvas_{nullptr};
   wxScrollBar* pHorizontalScrollbar_{nullptr};
   wxScrollBar* pVerticalScrollbar_{nullptr};
   wxSlider* pVerticalZoomSlider_{nullptr};
   wxSlider* pHorizontalZoomSlider_{nullptr};
+  wxTimer playheadTimer_;
 
   Song* const pSong_;
+  const PlaybackEngine* const pPlaybackEngine_;
 
   wxDECLARE_EVENT_TABLE();
 };
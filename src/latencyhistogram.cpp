@@ -0,0 +1,97 @@
+#include <algorithm>
+
+#include "latencyhistogram.h"
+
+const uint64_t LatencyHistogram::LinearRangeUs;
+const size_t LatencyHistogram::SubBuckets;
+const uint64_t LatencyHistogram::MaxUs;
+const size_t LatencyHistogram::NumBuckets;
+
+//-------------------------------------------------------------------------------------------------
+// LatencyHistogram
+//-------------------------------------------------------------------------------------------------
+
+void LatencyHistogram::record(uint64_t us, uint32_t count) {
+  // There is only one recording thread, so plain loads and stores are enough instead of the more
+  // expensive read-modify-write operations:
+  std::atomic<uint64_t>& bucketCount = counts_[bucketOf(us)];
+  bucketCount.store(bucketCount.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+  count_.store(count_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+
+  if (us > maxUs_.load(std::memory_order_relaxed))
+    maxUs_.store(us, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+  for (std::atomic<uint64_t>& bucketCount : counts_)
+    bucketCount.store(0, std::memory_order_relaxed);
+
+  count_.store(0, std::memory_order_relaxed);
+  maxUs_.store(0, std::memory_order_relaxed);
+}
+
+LatencyStats LatencyHistogram::stats() const {
+  LatencyStats stats;
+  stats.count = count_.load(std::memory_order_relaxed);
+  stats.p50Us = percentileUs(50);
+  stats.p99Us = percentileUs(99);
+  stats.maxUs = maxUs_.load(std::memory_order_relaxed);
+
+  return stats;
+}
+
+uint64_t LatencyHistogram::percentileUs(double percentile) const {
+  const uint64_t maxUs = maxUs_.load(std::memory_order_relaxed);
+  uint64_t total = 0;
+
+  for (const std::atomic<uint64_t>& bucketCount : counts_)
+    total += bucketCount.load(std::memory_order_relaxed);
+
+  if (total == 0)
+    return 0;
+
+  // Rank of the sample at the percentile, starting at 1:
+  const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(total * percentile / 100.0 + 0.5));
+  uint64_t numSeen = 0;
+
+  for (size_t bucket = 0; bucket < NumBuckets; ++bucket) {
+    numSeen += counts_[bucket].load(std::memory_order_relaxed);
+
+    // A bucket can't report more than the largest sample ever recorded:
+    if (numSeen >= rank)
+      return std::min(bucketUpperBoundUs(bucket), maxUs);
+  }
+
+  return maxUs;
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t us) {
+  if (us < LinearRangeUs)
+    return static_cast<size_t>(us);
+
+  if (us >= MaxUs)
+    return NumBuckets - 1;
+
+  // Index of the highest set bit, at least 6 due to the linear range:
+  size_t exponent = 6;
+
+  while ((us >> (exponent + 1)) != 0)
+    ++exponent;
+
+  const size_t subBucket = static_cast<size_t>(us >> (exponent - 4)) & (SubBuckets - 1);
+
+  return LinearRangeUs + (exponent - 6) * SubBuckets + subBucket;
+}
+
+uint64_t LatencyHistogram::bucketUpperBoundUs(size_t bucket) {
+  if (bucket < LinearRangeUs)
+    return bucket;
+
+  if (bucket >= NumBuckets - 1)
+    return MaxUs;
+
+  const size_t exponent = 6 + (bucket - LinearRangeUs) / SubBuckets;
+  const uint64_t subBucket = (bucket - LinearRangeUs) % SubBuckets;
+
+  return ((SubBuckets + subBucket + 1) << (exponent - 4)) - 1;
+}
@@ -0,0 +1,55 @@
+#ifndef _LATENCY_HISTOGRAM_H
+#define _LATENCY_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+//-------------------------------------------------------------------------------------------------
+// LatencyHistogram
+//-------------------------------------------------------------------------------------------------
+
+struct LatencyStats {
+  uint64_t count{0};
+  uint64_t p50Us{0};
+  uint64_t p99Us{0};
+  uint64_t maxUs{0};
+};
+
+// Histogram of durations in microseconds with a fixed set of buckets, so recording a sample never
+// allocates or locks and is safe on the timing thread. Durations below LinearRangeUs get a bucket
+// of their own, above that every power of two is split into SubBuckets buckets, which keeps the
+// error of a percentile below 1/SubBuckets. Samples beyond MaxUs end up in the last bucket, their
+// exact maximum is still kept.
+//
+// One thread records, any other thread may read at the same time. A reader only gets a consistent
+// snapshot once the recording thread is idle, while recording it may lag behind by a few samples.
+class LatencyHistogram {
+public:
+  static const uint64_t LinearRangeUs = 64;
+  static const size_t SubBuckets = 16;
+  static const uint64_t MaxUs = uint64_t(1) << 24; // about 16 s
+  static const size_t NumBuckets = LinearRangeUs + (24 - 6) * SubBuckets + 1;
+
+  LatencyHistogram()                               { reset(); }
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator = (const LatencyHistogram&) = delete;
+
+  // Recording thread:
+  void record(uint64_t us, uint32_t count = 1);
+  void reset();
+
+  // Any thread:
+  LatencyStats stats() const;
+  uint64_t percentileUs(double percentile) const;
+
+  static size_t bucketOf(uint64_t us);
+  static uint64_t bucketUpperBoundUs(size_t bucket);
+
+private:
+  std::atomic<uint64_t> counts_[NumBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> maxUs_;
+};
+
+#endif // _LATENCY_HISTOGRAM_H
@@ -1,41 +1,60 @@
 #include <iostream>
 
+#include <wx/numdlg.h>
+
 extern "C" {
 #include "lib/eMIDI/src/midifile.h"
 #include "lib/eMIDI/src/helpers.h"
 }
 
+#include "floppysink.h"
 #include "main.h"
+#include "timingstats.h"
 
 //-------------------------------------------------------------------------------------------------
 // MainFrame
 //-------------------------------------------------------------------------------------------------
 
 MainFrame::MainFrame(const wxString& title, const wxPoint& pos, const wxSize& size)
-    : wxFrame(NULL, wxID_ANY, title, pos, size) {
+    : wxFrame(NULL, wxID_ANY, title, pos, size),
+      redrawScheduler_([this](uint32_t dirtyViews) { flushRedraws(dirtyViews); }),
+      playbackEngine_(std::unique_ptr<PlaybackSink>(new NullSink)),
+      jobTimer_(this, JobTimerId) {
 
   wxMenu* pFileMenu = new wxMenu;
   pFileMenu->Append(new wxMenuItem(pFileMenu, wxID_OPEN, "&Open MIDI File\tCtrl-O", "Open MIDI File"));
   pFileMenu->Append(new wxMenuItem(pFileMenu, wxID_SAVEAS, "&Export as Midi 0 file\tCtrl-S", "Export as Midi 0 file"));
+  pFileMenu->Append(new wxMenuItem(pFileMenu, ExportBytecodeId, "Export as &Floppy Bytecode...", "Export as Floppy Bytecode"));
+  pFileMenu->AppendSeparator();
+  pFileMenu->Append(new wxMenuItem(pFileMenu, OpenProjectId, "Open &Project\tCtrl-Shift-O", "Open Project"));
+  pFileMenu->Append(new wxMenuItem(pFileMenu, SaveProjectAsId, "Save Project &As\tCtrl-Shift-S", "Save Project As"));
+  pFileMenu->AppendSeparator();
+  pFileMenu->Append(new wxMenuItem(pFileMenu, wxID_STOP, "&Cancel Running Job\tCtrl-.", "Cancel Running Job"));
   pFileMenu->AppendSeparator();
   pFileMenu->Append(wxID_EXIT);
 
+  wxMenu* pPlaybackMenu = new wxMenu;
+  pPlaybackMenu->Append(new wxMenuItem(pPlaybackMenu, FloppyOutputId, "Output to &Floppy Drives...", "Output to Floppy Drives"));
+  pPlaybackMenu->Append(new wxMenuItem(pPlaybackMenu, NullOutputId, "&Disable Output", "Disable Output"));
+  pPlaybackMenu->AppendSeparator();
+  pPlaybackMenu->Append(new wxMenuItem(pPlaybackMenu, TimingStatsId, "Timing &Statistics...", "Timing Statistics"));
+
   wxMenu* pHelpMenu = new wxMenu;
   pHelpMenu->Append(wxID_ABOUT);
 
   wxMenuBar* pMenuBar = new wxMenuBar;
   pMenuBar->Append(pFileMenu, "&File");
+  pMenuBar->Append(pPlaybackMenu, "&Playback");
   pMenuBar->Append(pHelpMenu, "&Help");
 
   SetMenuBar(pMenuBar);
   CreateStatusBar();
   SetStatusText("Ready.");
+  enableFileMenu(true);
 
-  song_.registerRedrawAllCallback(onRedrawAllRequest, this); // TODO: remove once rendering is fixed!
-
-  pTransportWindow_ = new TransportWindow(this, &song_);
+  pTransportWindow_ = new TransportWindow(this, &song_, &playbackEngine_);
   pTrackEditorWindow_ = new TrackEditorWindow(this, &song_);
-  pKeyEditorWindow_ = new KeyEditorWindow(this, &song_);
+  pKeyEditorWindow_ = new KeyEditorWindow(this, &song_, &playbackEngine_, &playability_);
 
   wxSizer* pTopSizer = new wxBoxSizer(wxVERTICAL);
   pTopSizer->Add(pTransportWindow_, 0, wxEXPAND);
@@ -67,14 +86,14 @@ void MainFrame::OnOpen(wxCommandEvent& event) {
   if (openFileDialog.ShowModal() == wxID_CANCEL)
     return;
 
-  song_.importFromMidi0(openFileDialog.GetPath().ToStdString());
-  updateTitle();
+  const std::string path = openFileDialog.GetPath().ToStdString();
 
-  pTransportWindow_->update();
-  pTrackEditorWindow_->updateTrackList();
-  pKeyEditorWindow_->setDefaultScrollPositions();
+  pImportedSong_.reset(new Song);
+  Song* pImportedSong = pImportedSong_.get();
 
-  pKeyEditorWindow_->render();
+  startJob(JobType::Import, path, [pImportedSong, path](JobProgress& progress) {
+    return pImportedSong->importFromMidi(path, &progress);
+  });
 }
 
 void MainFrame::OnSaveAs(wxCommandEvent& event) {
@@ -84,12 +103,269 @@ void MainFrame::OnSaveAs(wxCommandEvent& event) {
   if (saveFileDialog.ShowModal() == wxID_CANCEL)
     return;
 
-  song_.exportAsMidi0(saveFileDialog.GetPath().ToStdString());
-  updateTitle();
+  const std::string path = saveFileDialog.GetPath().ToStdString();
+
+  // The export works on a snapshot, so the song can be edited in the meantime:
+  std::shared_ptr<Song> pSnapshot = std::make_shared<Song>(song_);
+
+  startJob(JobType::Export, path, [pSnapshot, path](JobProgress& progress) {
+    return pSnapshot->exportAsMidi0(path, &progress);
+  });
+}
+
+void MainFrame::OnExportBytecode(wxCommandEvent& event) {
+  wxFileDialog saveFileDialog(this, _("Export as Floppy Bytecode"), "", "", "Floppy bytecode files (*.flpb)|*.flpb",
+      wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+
+  if (saveFileDialog.ShowModal() == wxID_CANCEL)
+    return;
+
+  size_t numDrives = 0;
+  std::unique_ptr<VoiceAllocationOptions> pAllocationOptions;
+  bool hasPoolPerTrack = false;
+
+  if (!askDriveSetup("Export as Floppy Bytecode", numDrives, pAllocationOptions, hasPoolPerTrack))
+    return;
+
+  const std::string path = saveFileDialog.GetPath().ToStdString();
+
+  // Compiling works on a snapshot, so the song can be edited in the meantime:
+  std::shared_ptr<Song> pSnapshot = std::make_shared<Song>(song_);
+  std::shared_ptr<VoiceAllocationOptions> pOptions(pAllocationOptions.release());
+  std::shared_ptr<FloppyBytecodeStats> pStats = std::make_shared<FloppyBytecodeStats>();
+  pBytecodeStats_ = pStats;
+
+  startJob(JobType::ExportBytecode, path,
+      [pSnapshot, pOptions, hasPoolPerTrack, numDrives, pStats, path](JobProgress& progress) {
+    PlaybackSchedule schedule;
+    VoiceAllocation allocation;
+
+    if (pOptions) {
+      if (hasPoolPerTrack)
+        pOptions->trackPools = VoiceAllocationOptions::evenPools(pSnapshot->numberOfTracks(), numDrives);
+
+      allocation.allocate(*pSnapshot, *pOptions);
+    }
+
+    schedule.build(*pSnapshot, pOptions ? &allocation : nullptr);
+
+    return FloppyBytecode::write(path, schedule, numDrives, pStats.get(), &progress);
+  });
+}
+
+void MainFrame::OnOpenProject(wxCommandEvent& event) {
+  wxFileDialog openFileDialog(this, _("Open Project"), "", "", "Project files (*.fmdp)|*.fmdp",
+      wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+
+  if (openFileDialog.ShowModal() == wxID_CANCEL)
+    return;
+
+  const std::string path = openFileDialog.GetPath().ToStdString();
+
+  pImportedSong_.reset(new Song);
+  Song* pOpenedSong = pImportedSong_.get();
+
+  startJob(JobType::OpenProject, path, [pOpenedSong, path](JobProgress& progress) {
+    return pOpenedSong->openProject(path, &progress);
+  });
+}
+
+void MainFrame::OnSaveProjectAs(wxCommandEvent& event) {
+  wxFileDialog saveFileDialog(this, _("Save Project As"), "", "", "Project files (*.fmdp)|*.fmdp",
+      wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+
+  if (saveFileDialog.ShowModal() == wxID_CANCEL)
+    return;
+
+  const std::string path = saveFileDialog.GetPath().ToStdString();
+
+  // Tracks which are still unloaded keep their project file mapped. Loading them first releases the
+  // mapping, so the file can be replaced even if it is the one being saved to:
+  song_.loadAllTracks();
+  std::shared_ptr<Song> pSnapshot = std::make_shared<Song>(song_);
+
+  startJob(JobType::SaveProject, path, [pSnapshot, path](JobProgress& progress) {
+    return pSnapshot->saveProject(path, &progress);
+  });
+}
+
+void MainFrame::OnCancelJob(wxCommandEvent& event) {
+  if (pJob_)
+    pJob_->cancel();
+}
+
+void MainFrame::OnFloppyOutput(wxCommandEvent& event) {
+#ifdef _WIN32
+  const wxString defaultPort = "COM3";
+#else
+  const wxString defaultPort = "/dev/ttyUSB0";
+#endif
+
+  const wxString port = wxGetTextFromUser("Serial port of the floppy controller:", "Output to Floppy Drives",
+      defaultPort, this);
+
+  if (port.IsEmpty())
+    return;
+
+  size_t numDrives = 0;
+  std::unique_ptr<VoiceAllocationOptions> pAllocationOptions;
+  bool hasPoolPerTrack = false;
+
+  if (!askDriveSetup("Output to Floppy Drives", numDrives, pAllocationOptions, hasPoolPerTrack))
+    return;
+
+  std::unique_ptr<FloppySink> pSink(new FloppySink(numDrives));
+
+  if (!pSink->open(port.ToStdString())) {
+    wxMessageBox("Error on opening " + port + "!", "Output to Floppy Drives", wxOK | wxICON_ERROR, this);
+    return;
+  }
+
+  playbackEngine_.setSink(std::move(pSink));
+  pTransportWindow_->setVoiceAllocation(pAllocationOptions.get(), hasPoolPerTrack);
+
+  SetStatusText("Playing on " + port + ".");
+}
+
+bool MainFrame::askDriveSetup(const wxString& title, size_t& numDrives,
+    std::unique_ptr<VoiceAllocationOptions>& pAllocationOptions, bool& hasPoolPerTrack) {
+
+  const long numChosenDrives = wxGetNumberFromUser("One drive plays one track.", "Number of drives:",
+      title, 8, 1, FloppySink::MaxDrives, this);
+
+  if (numChosenDrives < 1)
+    return false;
+
+  const wxString modes[] = {
+    "One drive per track",
+    "Allocate drives, steal from the oldest note",
+    "Allocate drives, highest notes first",
+    "Allocate drives, even share per track"
+  };
+
+  const int mode = wxGetSingleChoiceIndex("Notes of all tracks can be spread over the drives, as a drive plays one note at a time.",
+      title, 4, modes, this);
+
+  if (mode < 0)
+    return false;
+
+  numDrives = static_cast<size_t>(numChosenDrives);
+  hasPoolPerTrack = mode == 3;
+  pAllocationOptions.reset();
+
+  if (mode != 0) {
+    pAllocationOptions.reset(new VoiceAllocationOptions);
+    pAllocationOptions->numVoices = numDrives;
+    pAllocationOptions->policy = mode == 2 ? VoiceAllocationOptions::Policy::HighestNote : VoiceAllocationOptions::Policy::StealOldest;
+  }
+
+  return true;
+}
+
+void MainFrame::OnNullOutput(wxCommandEvent& event) {
+  playbackEngine_.setSink(std::unique_ptr<PlaybackSink>(new NullSink));
+  pTransportWindow_->setVoiceAllocation(nullptr);
+  SetStatusText("Playback output disabled.");
+}
+
+void MainFrame::OnTimingStats(wxCommandEvent& event) {
+  TimingStatsDialog dialog(this, &playbackEngine_);
+  dialog.ShowModal();
+}
+
+void MainFrame::OnJobTimer(wxTimerEvent& event) {
+  if (!pJob_)
+    return;
+
+  if (pJob_->isFinished()) {
+    finishJob();
+    return;
+  }
+
+  const int percent = static_cast<int>(pJob_->progress().fraction() * 100);
+
+  SetStatusText(wxString::Format("%s %s... %d%%", jobName(true), jobPath_.c_str(), percent));
+}
+
+void MainFrame::startJob(JobType type, const std::string& path, BackgroundJob::Work work) {
+  jobType_ = type;
+  jobPath_ = path;
+  pJob_.reset(new BackgroundJob(work));
+
+  enableFileMenu(false);
+  jobTimer_.Start(100);
+}
+
+void MainFrame::finishJob() {
+  jobTimer_.Stop();
+
+  const bool isCanceled = pJob_->progress().isCanceled();
+  const bool hasSucceeded = pJob_->hasSucceeded();
+  pJob_.reset();
+
+  if (hasSucceeded)
+    SetStatusText("Ready.");
+  else if (isCanceled)
+    SetStatusText(wxString::Format("%s %s canceled.", jobName(false), jobPath_.c_str()));
+  else
+    SetStatusText(wxString::Format("%s %s failed!", jobName(false), jobPath_.c_str()));
+
+  if (jobType_ == JobType::Import || jobType_ == JobType::OpenProject) {
+    // The views only ever see the old or the completely imported song:
+    if (hasSucceeded) {
+      song_.swap(*pImportedSong_);
+      pKeyEditorWindow_->setDefaultScrollPositions();
+      redrawScheduler_.invalidate(RedrawScheduler::All);
+    }
+
+    pImportedSong_.reset();
+  }
+  else if (jobType_ == JobType::ExportBytecode) {
+    if (hasSucceeded) {
+      SetStatusText(wxString::Format("Compiled %s: %llu bytes, %u records, up to %u records at once, peak %u records/s.",
+          jobPath_.c_str(), static_cast<unsigned long long>(pBytecodeStats_->fileSize), pBytecodeStats_->numRecords,
+          pBytecodeStats_->maxBurst, pBytecodeStats_->peakRecordsPerSecond));
+    }
+
+    pBytecodeStats_.reset();
+  }
+  else if (hasSucceeded) {
+    song_.setCurrentFileNameFromPath(jobPath_);
+    redrawScheduler_.invalidate(RedrawScheduler::Title);
+  }
+
+  enableFileMenu(true);
+}
+
+const char* MainFrame::jobName(bool isRunning) const {
+  switch (jobType_) {
+    case JobType::Import:         return isRunning ? "Importing" : "Importing of";
+    case JobType::Export:         return isRunning ? "Exporting" : "Exporting of";
+    case JobType::ExportBytecode: return isRunning ? "Compiling" : "Compiling of";
+    case JobType::OpenProject:    return isRunning ? "Opening" : "Opening of";
+    case JobType::SaveProject:    return isRunning ? "Saving" : "Saving of";
+  }
+
+  return "";
+}
+
+void MainFrame::enableFileMenu(bool isEnabled) {
+  GetMenuBar()->Enable(wxID_OPEN, isEnabled);
+  GetMenuBar()->Enable(wxID_SAVEAS, isEnabled);
+  GetMenuBar()->Enable(ExportBytecodeId, isEnabled);
+  GetMenuBar()->Enable(OpenProjectId, isEnabled);
+  GetMenuBar()->Enable(SaveProjectAsId, isEnabled);
+  GetMenuBar()->Enable(wxID_STOP, !isEnabled);
 }
 
 void MainFrame::OnSize(wxSizeEvent& event) {
-  onRedrawAllRequest(this);
+  // The key editor segments repaint themselves on resize, only the track list has to adapt its layout:
+  redrawScheduler_.invalidate(RedrawScheduler::TrackList);
+  event.Skip();
+}
+
+void MainFrame::OnRedrawRequest(wxCommandEvent& event) {
+  redrawScheduler_.invalidate(static_cast<uint32_t>(event.GetInt()));
 }
 
 void MainFrame::updateTitle() {
@@ -105,25 +381,44 @@ void MainFrame::updateTitle() {
       curTrackName.c_str()));
 }
 
-// TODO: remove once rendering is fixed:
-void MainFrame::onRedrawAllRequest(void* pCtx) {
-  MainFrame* pThis = static_cast<MainFrame*>(pCtx);
-
-  if (pThis->pTransportWindow_) {
-    pThis->pTransportWindow_->update();
-    pThis->pTrackEditorWindow_->updateTrackList();
-    pThis->pKeyEditorWindow_->render();
-    pThis->updateTitle();
+void MainFrame::flushRedraws(uint32_t dirtyViews) {
+  // Results arrive on later frames, each one repaints the key editor once it has been published:
+  if (dirtyViews & RedrawScheduler::Playability) {
+    playability_.updateAsync(song_, analysisPool_, [this](std::function<void()> function) { CallAfter(function); },
+        [this](int trackNo) {
+          if (trackNo == song_.currentSelectedTrackNo())
+            redrawScheduler_.invalidate(RedrawScheduler::KeyEditor);
+        });
   }
+
+  if (dirtyViews & RedrawScheduler::Transport)
+    pTransportWindow_->update();
+
+  if (dirtyViews & RedrawScheduler::TrackList)
+    pTrackEditorWindow_->updateTrackList();
+
+  if (dirtyViews & RedrawScheduler::KeyEditor)
+    pKeyEditorWindow_->render();
+
+  if (dirtyViews & RedrawScheduler::Title)
+    updateTitle();
 }
-// --
 
 wxBEGIN_EVENT_TABLE(MainFrame, wxFrame)
 EVT_MENU(wxID_EXIT, MainFrame::OnExit)
 EVT_MENU(wxID_ABOUT, MainFrame::OnAbout)
 EVT_MENU(wxID_OPEN, MainFrame::OnOpen)
 EVT_MENU(wxID_SAVEAS, MainFrame::OnSaveAs)
+EVT_MENU(ExportBytecodeId, MainFrame::OnExportBytecode)
+EVT_MENU(OpenProjectId, MainFrame::OnOpenProject)
+EVT_MENU(SaveProjectAsId, MainFrame::OnSaveProjectAs)
+EVT_MENU(wxID_STOP, MainFrame::OnCancelJob)
+EVT_MENU(FloppyOutputId, MainFrame::OnFloppyOutput)
+EVT_MENU(NullOutputId, MainFrame::OnNullOutput)
+EVT_MENU(TimingStatsId, MainFrame::OnTimingStats)
+EVT_TIMER(JobTimerId, MainFrame::OnJobTimer)
 EVT_SIZE(MainFrame::OnSize)
+EVT_COMMAND(wxID_ANY, EVT_REDRAW_REQUEST, MainFrame::OnRedrawRequest)
 wxEND_EVENT_TABLE()
 
 //-------------------------------------------------------------------------------------------------
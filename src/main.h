@@ -1,12 +1,21 @@
 #ifndef _MAIN_H
 #define _MAIN_H
 
+#include <memory>
+#include <string>
+
 #include <wx/wx.h>
 
+#include "backgroundjob.h"
+#include "floppybytecode.h"
 #include "keyeditor.h"
+#include "playability.h"
+#include "playbackengine.h"
+#include "redrawscheduler.h"
 #include "trackeditor.h"
 #include "transport.h"
 #include "song.h"
+#include "threadpool.h"
 
 //-------------------------------------------------------------------------------------------------
 // MainFrame
@@ -21,16 +30,68 @@ private:
   void OnAbout(wxCommandEvent& event);
   void OnOpen(wxCommandEvent& event);
   void OnSaveAs(wxCommandEvent& event);
+  void OnExportBytecode(wxCommandEvent& event);
+  void OnOpenProject(wxCommandEvent& event);
+  void OnSaveProjectAs(wxCommandEvent& event);
+  void OnCancelJob(wxCommandEvent& event);
+  void OnFloppyOutput(wxCommandEvent& event);
+  void OnNullOutput(wxCommandEvent& event);
+  void OnTimingStats(wxCommandEvent& event);
+  void OnJobTimer(wxTimerEvent& event);
   void OnSize(wxSizeEvent& event);
+  void OnRedrawRequest(wxCommandEvent& event);
+
+  enum class JobType {
+    Import,
+    Export,
+    ExportBytecode,
+    OpenProject,
+    SaveProject
+  };
 
+  void startJob(JobType type, const std::string& path, BackgroundJob::Work work);
+  const char* jobName(bool isRunning) const;
+  void finishJob();
+  void enableFileMenu(bool isEnabled);
   void updateTitle();
 
+  // Asks how many drives play and how the notes are spread over them. Without allocation options,
+  // every track plays on the drive with its own number:
+  bool askDriveSetup(const wxString& title, size_t& numDrives, std::unique_ptr<VoiceAllocationOptions>& pAllocationOptions,
+      bool& hasPoolPerTrack);
+  void flushRedraws(uint32_t dirtyViews);
+
   TransportWindow* pTransportWindow_{nullptr};
   TrackEditorWindow* pTrackEditorWindow_{nullptr};
   KeyEditorWindow* pKeyEditorWindow_{nullptr};
   Song song_;
+  RedrawScheduler redrawScheduler_;
+
+  // Changed tracks are reanalyzed in the background after an edit, spread over all cores. The pool
+  // is destroyed first, so no task outlives the analysis it posts its result to:
+  PlayabilityAnalysis playability_;
+  ThreadPool analysisPool_;
+
+  // Plays into a null sink until an output gets chosen from the playback menu:
+  static const int FloppyOutputId = wxID_HIGHEST + 4;
+  static const int NullOutputId = wxID_HIGHEST + 5;
+  static const int TimingStatsId = wxID_HIGHEST + 6;
+
+  PlaybackEngine playbackEngine_;
+
+  // Import and export run in the background. An import fills its own song, which is swapped in
+  // once it has finished. The job is declared after that song, so it is joined before the song is destroyed:
+  static const int JobTimerId = wxID_HIGHEST + 1;
+  static const int OpenProjectId = wxID_HIGHEST + 2;
+  static const int SaveProjectAsId = wxID_HIGHEST + 3;
+  static const int ExportBytecodeId = wxID_HIGHEST + 17;
 
-  static void onRedrawAllRequest(void* pCtx); // TODO: remove once rendering is fixed!
+  std::unique_ptr<Song> pImportedSong_;
+  std::unique_ptr<BackgroundJob> pJob_;
+  JobType jobType_{JobType::Import};
+  std::string jobPath_;
+  std::shared_ptr<FloppyBytecodeStats> pBytecodeStats_;
+  wxTimer jobTimer_;
 
   wxDECLARE_EVENT_TABLE();
 };
@@ -0,0 +1,144 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mappedfile.h"
+
+//-------------------------------------------------------------------------------------------------
+// MappedFile
+//-------------------------------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path) {
+  close();
+
+  HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+  if (hFile == INVALID_HANDLE_VALUE)
+    return false;
+
+  LARGE_INTEGER fileSize;
+
+  if (!GetFileSizeEx(hFile, &fileSize)) {
+    CloseHandle(hFile);
+    return false;
+  }
+
+  hFile_ = hFile;
+  size_ = static_cast<size_t>(fileSize.QuadPart);
+  isOpen_ = true;
+
+  // Empty files can't be mapped, but are valid nevertheless:
+  if (size_ == 0)
+    return true;
+
+  hMapping_ = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+  if (hMapping_)
+    pData_ = static_cast<const uint8_t*>(MapViewOfFile(hMapping_, FILE_MAP_READ, 0, 0, 0));
+
+  if (!pData_) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void MappedFile::close() {
+  if (pData_)
+    UnmapViewOfFile(pData_);
+
+  if (hMapping_)
+    CloseHandle(hMapping_);
+
+  if (hFile_)
+    CloseHandle(hFile_);
+
+  pData_ = nullptr;
+  hMapping_ = nullptr;
+  hFile_ = nullptr;
+  size_ = 0;
+  isOpen_ = false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path) {
+  close();
+
+  const int fd = ::open(path.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    return false;
+
+  struct stat fileStat;
+
+  if (fstat(fd, &fileStat) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  size_ = static_cast<size_t>(fileStat.st_size);
+  isOpen_ = true;
+
+  // Empty files can't be mapped, but are valid nevertheless:
+  if (size_ > 0) {
+    void* pData = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (pData == MAP_FAILED) {
+      ::close(fd);
+      close();
+      return false;
+    }
+
+    // Files are decoded front to back:
+    madvise(pData, size_, MADV_SEQUENTIAL);
+    pData_ = static_cast<const uint8_t*>(pData);
+  }
+
+  // The mapping stays valid after the descriptor has been closed:
+  ::close(fd);
+
+  return true;
+}
+
+void MappedFile::close() {
+  if (pData_)
+    munmap(const_cast<uint8_t*>(pData_), size_);
+
+  pData_ = nullptr;
+  size_ = 0;
+  isOpen_ = false;
+}
+
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// replaceFile
+//-------------------------------------------------------------------------------------------------
+
+bool replaceFile(const std::string& tempPath, const std::string& path) {
+#ifdef _WIN32
+  // A plain rename refuses to overwrite an existing file on Windows:
+  if (MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    return true;
+
+  DeleteFileA(tempPath.c_str());
+#else
+  if (rename(tempPath.c_str(), path.c_str()) == 0)
+    return true;
+
+  unlink(tempPath.c_str());
+#endif
+
+  return false;
+}
@@ -0,0 +1,41 @@
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <stdint.h>
+#include <string>
+
+//-------------------------------------------------------------------------------------------------
+// MappedFile
+//-------------------------------------------------------------------------------------------------
+
+// Read only memory mapping of a whole file. The mapping is released on close() or destruction.
+class MappedFile {
+public:
+  MappedFile() {}
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator = (const MappedFile&) = delete;
+  ~MappedFile()                                    { close(); }
+
+  bool open(const std::string& path);
+  void close();
+
+  bool isOpen() const                              { return isOpen_; }
+  const uint8_t* data() const                      { return pData_; }
+  size_t size() const                              { return size_; }
+
+private:
+  const uint8_t* pData_{nullptr};
+  size_t size_{0};
+  bool isOpen_{false};
+
+#ifdef _WIN32
+  void* hFile_{nullptr};
+  void* hMapping_{nullptr};
+#endif
+};
+
+// Moves a completely written temporary file onto 'path' in a single step, replacing any file there.
+// On failure the old file stays untouched and the temporary file is removed:
+bool replaceFile(const std::string& tempPath, const std::string& path);
+
+#endif // _MAPPED_FILE_H
@@ -0,0 +1,191 @@
+#include <algorithm>
+
+#include "playability.h"
+#include "song.h"
+#include "threadpool.h"
+
+const size_t PlayabilityAnalysis::NumIssueTypes;
+
+//-------------------------------------------------------------------------------------------------
+// PlayabilityAnalysis
+//-------------------------------------------------------------------------------------------------
+
+bool PlayabilityAnalysis::update(const Song& song, ThreadPool* pPool) {
+  // The tempo map is built lazily and has to be up to date before any task reads it:
+  const TempoMap& tempoMap = song.tempoMap();
+
+  bool hasChanged = tracks_.size() != song.numberOfTracks();
+  tracks_.resize(song.numberOfTracks());
+  pending_.resize(song.numberOfTracks());
+
+  for (size_t trackNo = 0; trackNo < song.numberOfTracks(); ++trackNo) {
+    if (!isOutdated(song, trackNo))
+      continue;
+
+    const ChannelTrack* pTrack = song.track(static_cast<int>(trackNo));
+    const uint64_t tempoRevision = song.tempoRevision();
+    const PlayabilityOptions& options = options_;
+    TrackResult& result = tracks_[trackNo];
+
+    auto task = [pTrack, &tempoMap, tempoRevision, &options, &result]() {
+      const NoteArray& notes = pTrack->events().notes();
+      analyzeTrack(notes.startTicks(), notes.numTicks(), notes.notes(), tempoMap, options, result);
+      result.revision = pTrack->revision();
+      result.tempoRevision = tempoRevision;
+      result.isValid = true;
+    };
+
+    if (pPool)
+      pPool->submit(task);
+    else
+      task();
+
+    hasChanged = true;
+  }
+
+  if (pPool)
+    pPool->wait();
+
+  return hasChanged;
+}
+
+void PlayabilityAnalysis::updateAsync(const Song& song, ThreadPool& pool, PostCallback post, PublishCallback onPublished) {
+  tracks_.resize(song.numberOfTracks());
+  pending_.resize(song.numberOfTracks());
+
+  // Durations depend on the tempo, so a tempo change outdates every track. All tasks share a copy
+  // of the tempo map, which the song may rebuild at any time:
+  std::shared_ptr<const TempoMap> pTempoMap;
+
+  for (size_t trackNo = 0; trackNo < song.numberOfTracks(); ++trackNo) {
+    const ChannelTrack* pTrack = song.track(static_cast<int>(trackNo));
+    PendingRevisions& pending = pending_[trackNo];
+
+    if (!isOutdated(song, trackNo) ||
+        (pending.revision == pTrack->revision() && pending.tempoRevision == song.tempoRevision()))
+      continue;
+
+    if (!pTempoMap)
+      pTempoMap = std::make_shared<TempoMap>(song.tempoMap());
+
+    pending.revision = pTrack->revision();
+    pending.tempoRevision = song.tempoRevision();
+
+    // The snapshot is taken on the owning thread, so the task never touches the song:
+    struct Job {
+      std::vector<uint32_t> startTicks;
+      std::vector<uint32_t> numTicks;
+      std::vector<uint8_t> notes;
+      TrackResult result;
+    };
+
+    const NoteArray& notes = pTrack->events().notes();
+    auto pJob = std::make_shared<Job>();
+    pJob->startTicks = notes.startTicks();
+    pJob->numTicks = notes.numTicks();
+    pJob->notes = notes.notes();
+    pJob->result.revision = pending.revision;
+    pJob->result.tempoRevision = pending.tempoRevision;
+    pJob->result.isValid = true;
+
+    const PlayabilityOptions options = options_;
+    const Song* pSong = &song;
+    const int jobTrackNo = static_cast<int>(trackNo);
+
+    pool.submit([this, pJob, pTempoMap, options, pSong, jobTrackNo, post, onPublished]() {
+      analyzeTrack(pJob->startTicks, pJob->numTicks, pJob->notes, *pTempoMap, options, pJob->result);
+
+      post([this, pJob, pSong, jobTrackNo, onPublished]() {
+        publish(*pSong, jobTrackNo, std::move(pJob->result));
+        onPublished(jobTrackNo);
+      });
+    });
+  }
+}
+
+bool PlayabilityAnalysis::isOutdated(const Song& song, size_t trackNo) const {
+  const ChannelTrack* pTrack = song.track(static_cast<int>(trackNo));
+  const TrackResult& result = tracks_[trackNo];
+
+  return pTrack->isLoaded() &&
+      !(result.isValid && result.revision == pTrack->revision() && result.tempoRevision == song.tempoRevision());
+}
+
+void PlayabilityAnalysis::publish(const Song& song, int trackNo, TrackResult&& result) {
+  if (trackNo >= static_cast<int>(tracks_.size()))
+    return;
+
+  PendingRevisions& pending = pending_[trackNo];
+
+  if (pending.revision == result.revision && pending.tempoRevision == result.tempoRevision)
+    pending = PendingRevisions();
+
+  // Revisions are unique across songs, so edits and even a replaced song leave the result unused:
+  if (trackNo < static_cast<int>(song.numberOfTracks()) && song.track(trackNo)->revision() == result.revision &&
+      song.tempoRevision() == result.tempoRevision)
+    tracks_[trackNo] = std::move(result);
+}
+
+const PlayabilityAnalysis::TrackResult* PlayabilityAnalysis::trackResult(int trackNo, uint64_t revision) const {
+  if (trackNo < 0 || static_cast<size_t>(trackNo) >= tracks_.size())
+    return nullptr;
+
+  const TrackResult& result = tracks_[trackNo];
+
+  return result.isValid && result.revision == revision ? &result : nullptr;
+}
+
+const char* PlayabilityAnalysis::issueName(size_t issueType) {
+  switch (issueType) {
+    case 0:  return "out of range";
+    case 1:  return "too short";
+    case 2:  return "overlapping";
+    case 3:  return "retriggered";
+    default: return "";
+  }
+}
+
+void PlayabilityAnalysis::analyzeTrack(const std::vector<uint32_t>& startTicks, const std::vector<uint32_t>& numTicks,
+    const std::vector<uint8_t>& notes, const TempoMap& tempoMap, const PlayabilityOptions& options, TrackResult& result) {
+
+  auto endTick = [&](size_t i) { return startTicks[i] + numTicks[i]; };
+
+  result.issues.assign(notes.size(), 0);
+  std::fill(result.numIssues, result.numIssues + NumIssueTypes, 0);
+
+  // The note holding the latest end so far, every later note starting before it overlaps it:
+  size_t longestIndex = 0;
+  uint64_t prevStartUs = 0;
+
+  for (size_t i = 0; i < notes.size(); ++i) {
+    const uint64_t startUs = tempoMap.tickToUs(startTicks[i]);
+    const uint64_t endUs = tempoMap.tickToUs(endTick(i));
+    uint8_t& issues = result.issues[i];
+
+    if (notes[i] < options.lowestNote || notes[i] > options.highestNote)
+      issues |= OutOfRange;
+
+    if (endUs - startUs < options.minNoteUs)
+      issues |= TooShort;
+
+    if (i > 0) {
+      if (startTicks[i] < endTick(longestIndex)) {
+        issues |= Overlap;
+        result.issues[longestIndex] |= Overlap;
+      }
+
+      if (startUs > prevStartUs && startUs - prevStartUs < options.minRetriggerUs)
+        issues |= Retrigger;
+
+      if (endTick(i) > endTick(longestIndex))
+        longestIndex = i;
+    }
+
+    prevStartUs = startUs;
+  }
+
+  for (uint8_t issues : result.issues) {
+    for (size_t type = 0; type < NumIssueTypes; ++type)
+      result.numIssues[type] += (issues >> type) & 1;
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef _PLAYABILITY_H
+#define _PLAYABILITY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "floppynotes.h"
+
+class NoteArray;
+class Song;
+class TempoMap;
+class ThreadPool;
+
+//-------------------------------------------------------------------------------------------------
+// PlayabilityOptions
+//-------------------------------------------------------------------------------------------------
+
+struct PlayabilityOptions {
+  uint8_t lowestNote{FloppyLowestNote};
+  uint8_t highestNote{FloppyHighestNote};
+  uint32_t minNoteUs{20000};      // shorter notes end before the drive gets audible
+  uint32_t minRetriggerUs{30000}; // from the start of a note to the start of the next one
+};
+
+//-------------------------------------------------------------------------------------------------
+// PlayabilityAnalysis
+//-------------------------------------------------------------------------------------------------
+
+// Checks whether the notes of every track can be played by a single floppy drive. The findings
+// are kept as one byte of issue flags per note block, in the same order as the blocks of the
+// track, so views can look them up by block index while painting.
+//
+// Only tracks which have changed since the last update are analyzed again, every track on its own
+// task of an optional thread pool. Tracks which are not loaded yet are left out until they are.
+// The UI analyzes in the background: Tasks work on snapshots of the notes and the tempo map, and
+// their results are posted back to the UI thread, which publishes them unless they are outdated.
+class PlayabilityAnalysis {
+public:
+  enum Issue : uint8_t {
+    OutOfRange = 1 << 0, // outside of the notes a drive plays cleanly
+    TooShort   = 1 << 1,
+    Overlap    = 1 << 2, // sounds at the same time as another note of the track
+    Retrigger  = 1 << 3  // follows the previous note faster than the head can step
+  };
+
+  static const size_t NumIssueTypes = 4;
+
+  struct TrackResult {
+    uint64_t revision{0};
+    uint64_t tempoRevision{0};
+    bool isValid{false};
+    std::vector<uint8_t> issues;
+    uint32_t numIssues[NumIssueTypes]{};
+  };
+
+  // Runs a function on the thread owning the analysis, e.g. through wxEvtHandler::CallAfter():
+  using PostCallback = std::function<void(std::function<void()> function)>;
+  using PublishCallback = std::function<void(int trackNo)>;
+
+  PlayabilityAnalysis(const PlayabilityOptions& options = PlayabilityOptions()) : options_(options) {}
+
+  // Returns true if the result of any track has changed. Waits for all tasks, so the song is only
+  // read while the caller is blocked:
+  bool update(const Song& song, ThreadPool* pPool = nullptr);
+
+  // Returns right away. Every result is posted back and published, if its track still has the
+  // analyzed revisions, followed by a call of 'onPublished' on the owning thread. Tracks which are
+  // being analyzed in their current revisions already aren't submitted again:
+  void updateAsync(const Song& song, ThreadPool& pool, PostCallback post, PublishCallback onPublished);
+
+  // Returns nullptr if the track hasn't been analyzed in the given revision:
+  const TrackResult* trackResult(int trackNo, uint64_t revision) const;
+  size_t numTracks() const                         { return tracks_.size(); }
+
+  static const char* issueName(size_t issueType);
+
+private:
+  struct PendingRevisions {
+    uint64_t revision{0};
+    uint64_t tempoRevision{0};
+  };
+
+  bool isOutdated(const Song& song, size_t trackNo) const;
+  void publish(const Song& song, int trackNo, TrackResult&& result);
+
+  static void analyzeTrack(const std::vector<uint32_t>& startTicks, const std::vector<uint32_t>& numTicks,
+      const std::vector<uint8_t>& notes, const TempoMap& tempoMap, const PlayabilityOptions& options,
+      TrackResult& result);
+
+  const PlayabilityOptions options_;
+  std::vector<TrackResult> tracks_;
+  std::vector<PendingRevisions> pending_; // of tracks analyzed in the background right now
+};
+
+#endif // _PLAYABILITY_H
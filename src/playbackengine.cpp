@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#pragma comment(lib, "winmm.lib")
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+extern "C" {
+#include "lib/eMIDI/src/midifile.h"
+}
+
+#include "playbackengine.h"
+
+// How long the timing thread sleeps at most, which bounds the latency of commands:
+static const std::chrono::milliseconds CommandPollInterval(2);
+
+// The OS wakes a sleeping thread up late by up to a scheduler tick, which gets spun away instead:
+#ifdef _WIN32
+static const std::chrono::microseconds SpinMargin(2000);
+#else
+static const std::chrono::microseconds SpinMargin(1000);
+#endif
+
+static void raiseThreadPriority() {
+#ifdef _WIN32
+  timeBeginPeriod(1);
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+#else
+  // Real-time scheduling needs privileges, without them the thread keeps its normal priority:
+  sched_param param = {};
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+    printf("Playback runs without real-time priority!\n");
+#endif
+}
+
+static uint64_t usBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+  return end > start ? std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() : 0;
+}
+
+static void restoreTimerResolution() {
+#ifdef _WIN32
+  timeEndPeriod(1);
+#endif
+}
+
+//-------------------------------------------------------------------------------------------------
+// PlaybackEngine
+//-------------------------------------------------------------------------------------------------
+
+PlaybackEngine::PlaybackEngine(std::unique_ptr<PlaybackSink> pSink)
+    : pSink_(std::move(pSink)), pActiveSink_(pSink_.get()), pPlayingSink_(pSink_.get()) {
+
+  memset(soundingNotes_, 0, sizeof(soundingNotes_));
+  batch_.reserve(256);
+  pPlayingTiming_ = sinkTiming(pSink_->name());
+
+  thread_ = std::thread(&PlaybackEngine::run, this);
+}
+
+PlaybackEngine::~PlaybackEngine() {
+  pushCommand({Command::Type::Quit, 0, nullptr, nullptr});
+  thread_.join();
+}
+
+void PlaybackEngine::setSink(std::unique_ptr<PlaybackSink> pSink) {
+  PlaybackSink* pNewSink = pSink.get();
+  pushCommand({Command::Type::SetSink, 0, nullptr, pNewSink, sinkTiming(pNewSink->name())});
+
+  while (pActiveSink_ != pNewSink)
+    std::this_thread::yield();
+
+  pSink_ = std::move(pSink);
+}
+
+void PlaybackEngine::setSchedule(std::shared_ptr<const PlaybackSchedule> pSchedule) {
+  // Schedules are released by the UI thread only. Commands are processed in order, so once the
+  // command replacing a schedule is done, neither the timing thread nor the queue refers to it:
+  const uint64_t numProcessedCommands = numProcessedCommands_;
+  auto isUnused = [numProcessedCommands](const RetiredSchedule& retired) { return retired.releaseCommandNo <= numProcessedCommands; };
+  retiredSchedules_.erase(std::remove_if(retiredSchedules_.begin(), retiredSchedules_.end(), isUnused),
+      retiredSchedules_.end());
+
+  pushCommand({Command::Type::SetSchedule, 0, pSchedule.get(), nullptr});
+
+  if (pSchedule_)
+    retiredSchedules_.push_back({std::move(pSchedule_), numPushedCommands_});
+
+  pSchedule_ = std::move(pSchedule);
+}
+
+void PlaybackEngine::play() {
+  pushCommand({Command::Type::Play, 0, nullptr, nullptr});
+  waitForCommands();
+}
+
+void PlaybackEngine::stop() {
+  pushCommand({Command::Type::Stop, 0, nullptr, nullptr});
+}
+
+void PlaybackEngine::seek(uint64_t us) {
+  pushCommand({Command::Type::Seek, us, nullptr, nullptr});
+}
+
+void PlaybackEngine::resetSinkTimings() {
+  // Histograms are only ever written by the timing thread, so it has to clear them itself:
+  for (const std::unique_ptr<SinkTiming>& pTiming : sinkTimings_)
+    pushCommand({Command::Type::ResetTiming, 0, nullptr, nullptr, pTiming.get()});
+}
+
+SinkTiming* PlaybackEngine::sinkTiming(const char* pSinkName) {
+  for (const std::unique_ptr<SinkTiming>& pTiming : sinkTimings_) {
+    if (pTiming->sinkName == pSinkName)
+      return pTiming.get();
+  }
+
+  sinkTimings_.emplace_back(new SinkTiming(pSinkName));
+  return sinkTimings_.back().get();
+}
+
+void PlaybackEngine::pushCommand(const Command& command) {
+  // The timing thread polls at least every few milliseconds, so a full queue drains quickly:
+  while (!commands_.push(command))
+    std::this_thread::yield();
+
+  ++numPushedCommands_;
+}
+
+void PlaybackEngine::waitForCommands() const {
+  while (numProcessedCommands_ < numPushedCommands_)
+    std::this_thread::yield();
+}
+
+void PlaybackEngine::run() {
+  raiseThreadPriority();
+
+  while (!isQuitting_) {
+    Command command;
+
+    while (commands_.pop(command)) {
+      processCommand(command);
+      numProcessedCommands_.fetch_add(1, std::memory_order_release);
+    }
+
+    const Clock::time_point now = Clock::now();
+    Clock::time_point deadline = now + CommandPollInterval;
+
+    if (isPlaying_) {
+      dispatchDueMessages(now);
+
+      if (nextIndex_ >= pPlayingSchedule_->messages().size()) {
+        positionUs_ = pPlayingSchedule_->durationUs();
+        isPlaying_ = false;
+        continue;
+      }
+
+      positionUs_.store(std::min(startPositionUs_ + elapsedUs(now), pPlayingSchedule_->durationUs()), std::memory_order_relaxed);
+
+      const uint64_t dueUs = pPlayingSchedule_->messages()[nextIndex_].timeUs - startPositionUs_;
+      const Clock::time_point dueTime = startTime_ + std::chrono::microseconds(dueUs);
+
+      // Only message deadlines are worth spinning for, polling for commands just sleeps:
+      if (dueTime <= deadline) {
+        if (dueTime - now > SpinMargin)
+          std::this_thread::sleep_until(dueTime - SpinMargin);
+
+        while (Clock::now() < dueTime)
+          std::this_thread::yield();
+
+        continue;
+      }
+    }
+
+    std::this_thread::sleep_until(deadline);
+  }
+
+  silenceSoundingNotes();
+  restoreTimerResolution();
+}
+
+void PlaybackEngine::processCommand(const Command& command) {
+  switch (command.type) {
+    case Command::Type::SetSink:
+      // Playback continues on the new sink, only notes sounding right now are lost:
+      silenceSoundingNotes();
+      pPlayingSink_ = command.pSink;
+      pPlayingTiming_ = command.pTiming;
+      pActiveSink_ = command.pSink;
+      break;
+
+    case Command::Type::SetSchedule:
+      silenceSoundingNotes();
+      pPlayingSchedule_ = command.pSchedule;
+      positionUs_ = std::min<uint64_t>(positionUs_, pPlayingSchedule_ ? pPlayingSchedule_->durationUs() : 0);
+
+      if (isPlaying_) {
+        startPositionUs_ = positionUs_;
+        startTime_ = Clock::now();
+        nextIndex_ = pPlayingSchedule_ ? pPlayingSchedule_->indexAt(startPositionUs_) : 0;
+      }
+
+      isPlaying_ = isPlaying_ && pPlayingSchedule_;
+      break;
+
+    case Command::Type::Play:
+      if (!pPlayingSchedule_ || isPlaying_)
+        break;
+
+      // Playing at the end of the song starts over:
+      if (positionUs_ >= pPlayingSchedule_->durationUs())
+        positionUs_ = 0;
+
+      startPositionUs_ = positionUs_;
+      startTime_ = Clock::now();
+      nextIndex_ = pPlayingSchedule_->indexAt(startPositionUs_);
+      isPlaying_ = true;
+      break;
+
+    case Command::Type::Stop:
+      isPlaying_ = false;
+      silenceSoundingNotes();
+      break;
+
+    case Command::Type::Seek:
+      silenceSoundingNotes();
+      positionUs_ = pPlayingSchedule_ ? std::min(command.us, pPlayingSchedule_->durationUs()) : 0;
+      startPositionUs_ = positionUs_;
+      startTime_ = Clock::now();
+      nextIndex_ = pPlayingSchedule_ ? pPlayingSchedule_->indexAt(startPositionUs_) : 0;
+      break;
+
+    case Command::Type::ResetTiming:
+      command.pTiming->lateness.reset();
+      command.pTiming->sendDuration.reset();
+      break;
+
+    case Command::Type::Quit:
+      isPlaying_ = false;
+      isQuitting_ = true;
+      break;
+  }
+}
+
+void PlaybackEngine::dispatchDueMessages(Clock::time_point now) {
+  const std::vector<PlaybackMessage>& messages = pPlayingSchedule_->messages();
+  const uint64_t positionUs = startPositionUs_ + elapsedUs(now);
+
+  // Every batch holds all messages sharing the same timestamp:
+  while (nextIndex_ < messages.size() && messages[nextIndex_].timeUs <= positionUs) {
+    const uint64_t timeUs = messages[nextIndex_].timeUs;
+    batch_.clear();
+
+    for (; nextIndex_ < messages.size() && messages[nextIndex_].timeUs == timeUs; ++nextIndex_) {
+      const PlaybackMessage& message = messages[nextIndex_];
+      const uint8_t type = message.status & 0xF0;
+      uint8_t& numSounding = soundingNotes_[message.status & 0x0F][message.data1 & 0x7F];
+
+      if (type == MIDI_EVENT_NOTE_ON)
+        ++numSounding;
+      else if (type == MIDI_EVENT_NOTE_OFF && numSounding > 0)
+        --numSounding;
+
+      batch_.push_back(message);
+    }
+
+    // Lateness shows how well the thread meets its deadlines, the send duration how long a sink
+    // blocks it, e.g. on a full serial port buffer:
+    const Clock::time_point dueTime = startTime_ + std::chrono::microseconds(timeUs - startPositionUs_);
+    const Clock::time_point sendTime = Clock::now();
+
+    pPlayingSink_->send(batch_.data(), batch_.size());
+
+    pPlayingTiming_->lateness.record(usBetween(dueTime, sendTime), static_cast<uint32_t>(batch_.size()));
+    pPlayingTiming_->sendDuration.record(usBetween(sendTime, Clock::now()));
+  }
+}
+
+void PlaybackEngine::silenceSoundingNotes() {
+  batch_.clear();
+
+  for (uint8_t channel = 0; channel < 16; ++channel) {
+    for (uint8_t note = 0; note < 128; ++note) {
+      for (; soundingNotes_[channel][note] > 0; --soundingNotes_[channel][note])
+        batch_.push_back({positionUs_, -1, -1, static_cast<uint8_t>(MIDI_EVENT_NOTE_OFF | channel), note, 0, 3});
+    }
+  }
+
+  if (!batch_.empty())
+    pPlayingSink_->send(batch_.data(), batch_.size());
+}
+
+uint64_t PlaybackEngine::elapsedUs(Clock::time_point now) const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(now - startTime_).count();
+}
@@ -0,0 +1,135 @@
+#ifndef _PLAYBACK_ENGINE_H
+#define _PLAYBACK_ENGINE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latencyhistogram.h"
+#include "playbackschedule.h"
+#include "playbacksink.h"
+#include "spscqueue.h"
+
+//-------------------------------------------------------------------------------------------------
+// SinkTiming
+//-------------------------------------------------------------------------------------------------
+
+// Timing of everything which has been played on one kind of sink. Recorded by the timing thread,
+// readable from the UI thread at any time:
+struct SinkTiming {
+  SinkTiming(const std::string& sinkName) : sinkName(sinkName) {}
+
+  const std::string sinkName;
+  LatencyHistogram lateness;     // actual minus scheduled send time, once per message
+  LatencyHistogram sendDuration; // time spent inside of send(), once per batch
+};
+
+//-------------------------------------------------------------------------------------------------
+// PlaybackEngine
+//-------------------------------------------------------------------------------------------------
+
+// Plays a schedule on its own high priority timing thread. The thread sleeps until shortly before
+// the absolute deadline of the next batch of messages and spins for the rest, so a busy UI doesn't
+// delay any message. Commands are passed through a lock-free queue and all public methods must be
+// called from the same (UI) thread.
+class PlaybackEngine {
+public:
+  PlaybackEngine(std::unique_ptr<PlaybackSink> pSink);
+  PlaybackEngine(const PlaybackEngine&) = delete;
+  PlaybackEngine& operator = (const PlaybackEngine&) = delete;
+  ~PlaybackEngine();
+
+  // Blocks until the timing thread has switched over, so the previous sink is closed on return:
+  void setSink(std::unique_ptr<PlaybackSink> pSink);
+
+  // The engine keeps the schedule alive for as long as the timing thread may use it:
+  void setSchedule(std::shared_ptr<const PlaybackSchedule> pSchedule);
+  const PlaybackSchedule* schedule() const         { return pSchedule_.get(); }
+
+  // Blocks until the timing thread has processed all commands so far, so isPlaying() tells on
+  // return whether playback has started:
+  void play();
+  void stop();
+  void seek(uint64_t us);
+
+  bool isPlaying() const                           { return isPlaying_; }
+  uint64_t positionUs() const                      { return positionUs_.load(std::memory_order_relaxed); }
+
+  // One entry per sink name, in order of first use. Playing on a sink of the same name again
+  // continues its entry:
+  const std::vector<std::unique_ptr<SinkTiming>>& sinkTimings() const { return sinkTimings_; }
+  void resetSinkTimings();
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Command {
+    enum class Type {
+      SetSink,
+      SetSchedule,
+      Play,
+      Stop,
+      Seek,
+      ResetTiming,
+      Quit
+    };
+
+    Type type;
+    uint64_t us;
+    const PlaybackSchedule* pSchedule;
+    PlaybackSink* pSink;
+    SinkTiming* pTiming;
+  };
+
+  // Replaced schedules stay alive until the command replacing them has been processed, since any
+  // SetSchedule command still queued before it may point to them:
+  struct RetiredSchedule {
+    std::shared_ptr<const PlaybackSchedule> pSchedule;
+    uint64_t releaseCommandNo;
+  };
+
+  void pushCommand(const Command& command);
+  void waitForCommands() const;
+  SinkTiming* sinkTiming(const char* pSinkName);
+
+  // Timing thread:
+  void run();
+  void processCommand(const Command& command);
+  void dispatchDueMessages(Clock::time_point now);
+  void silenceSoundingNotes();
+  uint64_t elapsedUs(Clock::time_point now) const;
+
+  std::unique_ptr<PlaybackSink> pSink_;
+  std::shared_ptr<const PlaybackSchedule> pSchedule_;
+  std::vector<RetiredSchedule> retiredSchedules_;
+  std::vector<std::unique_ptr<SinkTiming>> sinkTimings_;
+
+  SpscQueue<Command, 64> commands_;
+  uint64_t numPushedCommands_{0};
+  std::atomic<uint64_t> numProcessedCommands_{0}; // published by the timing thread after every command
+  std::atomic<PlaybackSink*> pActiveSink_{nullptr};
+  std::atomic<bool> isPlaying_{false};
+
+  // Published by the timing thread on every wake up. It's a single lock-free word without any
+  // ordering guarantees, so UI timers may poll it as often as they like at no cost to the thread:
+  std::atomic<uint64_t> positionUs_{0};
+
+  // Owned by the timing thread:
+  PlaybackSink* pPlayingSink_{nullptr};
+  SinkTiming* pPlayingTiming_{nullptr};
+  const PlaybackSchedule* pPlayingSchedule_{nullptr};
+  size_t nextIndex_{0};
+  uint64_t startPositionUs_{0};
+  Clock::time_point startTime_;
+  std::vector<PlaybackMessage> batch_;
+  uint8_t soundingNotes_[16][128];
+  bool isQuitting_{false};
+
+  std::thread thread_;
+};
+
+#endif // _PLAYBACK_ENGINE_H
@@ -0,0 +1,86 @@
+#include <algorithm>
+
+extern "C" {
+#include "lib/eMIDI/src/midifile.h"
+}
+
+#include "eventmerger.h"
+#include "playbackschedule.h"
+#include "song.h"
+
+//-------------------------------------------------------------------------------------------------
+// PlaybackSchedule
+//-------------------------------------------------------------------------------------------------
+
+void PlaybackSchedule::build(const Song& song, const VoiceAllocation* pAllocation) {
+  const TempoMap& tempoMap = song.tempoMap();
+
+  messages_.clear();
+  messages_.reserve(song.numberOfTracks() * 64);
+  songRevision_ = song.revision();
+  durationUs_ = song.durationUs();
+
+  SongEventMerger merger(song, pAllocation);
+  MergedEvent event;
+
+  // Ticks only ever grow, so the conversion is skipped for all events sharing the same tick:
+  uint32_t lastTick = 0;
+  uint64_t lastUs = tempoMap.tickToUs(0);
+
+  while (merger.next(event)) {
+    if (event.type == MergedEvent::Type::SetTempo)
+      continue;
+
+    if (event.tick != lastTick) {
+      lastTick = event.tick;
+      lastUs = tempoMap.tickToUs(event.tick);
+    }
+
+    PlaybackMessage message;
+    message.timeUs = lastUs;
+    message.trackNo = static_cast<int16_t>(event.trackNo);
+    message.voice = event.voice;
+    message.data2 = 0;
+    message.size = 3;
+
+    switch (event.type) {
+      case MergedEvent::Type::NoteOff:
+        message.status = MIDI_EVENT_NOTE_OFF | event.midiChannel;
+        message.data1 = event.note;
+        message.data2 = MIDI_DEFAULT_VELOCITY;
+        break;
+
+      case MergedEvent::Type::ProgramChange:
+        message.status = MIDI_EVENT_PROGRAM_CHANGE | event.midiChannel;
+        message.data1 = event.programNumber & 0x7F;
+        message.size = 2;
+        break;
+
+      case MergedEvent::Type::PitchBend:
+        message.status = MIDI_EVENT_PITCH_BEND | event.midiChannel;
+        message.data1 = event.pitchBendValue & 0x7F;
+        message.data2 = (event.pitchBendValue >> 7) & 0x7F;
+        break;
+
+      case MergedEvent::Type::NoteOn:
+        message.status = MIDI_EVENT_NOTE_ON | event.midiChannel;
+        message.data1 = event.note;
+        message.data2 = MIDI_DEFAULT_VELOCITY;
+        break;
+
+      default:
+        continue;
+    }
+
+    messages_.push_back(message);
+  }
+
+  if (!messages_.empty())
+    durationUs_ = std::max(durationUs_, messages_.back().timeUs);
+}
+
+size_t PlaybackSchedule::indexAt(uint64_t us) const {
+  auto isEarlier = [](const PlaybackMessage& message, uint64_t us) { return message.timeUs < us; };
+
+  return std::lower_bound(messages_.begin(), messages_.end(), us, isEarlier) - messages_.begin();
+}
@@ -0,0 +1,36 @@
+#ifndef _PLAYBACK_SCHEDULE_H
+#define _PLAYBACK_SCHEDULE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "playbacksink.h"
+
+class Song;
+class VoiceAllocation;
+
+//-------------------------------------------------------------------------------------------------
+// PlaybackSchedule
+//-------------------------------------------------------------------------------------------------
+
+// A song compiled into a flat list of messages with absolute timestamps in microseconds, so the
+// timing thread never has to look at the song or convert ticks while playing.
+class PlaybackSchedule {
+public:
+  // With a voice allocation, notes carry their voice and dropped notes are left out:
+  void build(const Song& song, const VoiceAllocation* pAllocation = nullptr);
+
+  const std::vector<PlaybackMessage>& messages() const { return messages_; }
+  uint64_t durationUs() const                         { return durationUs_; }
+  uint64_t songRevision() const                       { return songRevision_; }
+
+  // Returns the index of the first message due at or after 'us':
+  size_t indexAt(uint64_t us) const;
+
+private:
+  std::vector<PlaybackMessage> messages_;
+  uint64_t durationUs_{0};
+  uint64_t songRevision_{0};
+};
+
+#endif // _PLAYBACK_SCHEDULE_H
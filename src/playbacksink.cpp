@@ -0,0 +1,48 @@
+#include "playbacksink.h"
+
+//-------------------------------------------------------------------------------------------------
+// StreamSink
+//-------------------------------------------------------------------------------------------------
+
+StreamSink::~StreamSink() {
+  close();
+}
+
+bool StreamSink::open(const std::string& path) {
+  close();
+
+  pFile_ = path == "-" ? stdout : fopen(path.c_str(), format_ == Format::Raw ? "wb" : "w");
+
+  return pFile_ != nullptr;
+}
+
+void StreamSink::close() {
+  if (pFile_ && pFile_ != stdout)
+    fclose(pFile_);
+
+  pFile_ = nullptr;
+}
+
+void StreamSink::send(const PlaybackMessage* pMessages, size_t numMessages) {
+  if (!pFile_)
+    return;
+
+  for (size_t i = 0; i < numMessages; ++i) {
+    const PlaybackMessage& m = pMessages[i];
+
+    if (format_ == Format::Raw) {
+      const uint8_t bytes[] = {m.status, m.data1, m.data2};
+      fwrite(bytes, 1, m.size, pFile_);
+    }
+    else if (m.size == 3) {
+      fprintf(pFile_, "%llu %d %02X %02X %02X\n", static_cast<unsigned long long>(m.timeUs), m.trackNo, m.status,
+          m.data1, m.data2);
+    }
+    else {
+      fprintf(pFile_, "%llu %d %02X %02X\n", static_cast<unsigned long long>(m.timeUs), m.trackNo, m.status, m.data1);
+    }
+  }
+
+  // Whoever reads a pipe wants the messages now, not once the buffer is full:
+  fflush(pFile_);
+}
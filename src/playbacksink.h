@@ -0,0 +1,84 @@
+#ifndef _PLAYBACK_SINK_H
+#define _PLAYBACK_SINK_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+//-------------------------------------------------------------------------------------------------
+// PlaybackMessage
+//-------------------------------------------------------------------------------------------------
+
+// A single MIDI channel message, ready to be sent:
+struct PlaybackMessage {
+  uint64_t timeUs;   // relative to the start of the song
+  int16_t trackNo;   // track which has caused the message
+  int8_t voice;      // voice of a note on or off if the song has been voice allocated, else -1
+  uint8_t status;
+  uint8_t data1;
+  uint8_t data2;
+  uint8_t size;      // 2 or 3 bytes, including the status
+};
+
+//-------------------------------------------------------------------------------------------------
+// PlaybackSink
+//-------------------------------------------------------------------------------------------------
+
+// Receives the messages of a playing song. All messages due at the same time are passed as one
+// batch. Sinks are only ever called from the timing thread of the playback engine, so send()
+// should return quickly and must not wait for the UI.
+class PlaybackSink {
+public:
+  virtual ~PlaybackSink() {}
+
+  // Short name of the kind of output, used to group timing statistics:
+  virtual const char* name() const = 0;
+  virtual void send(const PlaybackMessage* pMessages, size_t numMessages) = 0;
+};
+
+//-------------------------------------------------------------------------------------------------
+// NullSink
+//-------------------------------------------------------------------------------------------------
+
+// Drops all messages, only counting them:
+class NullSink : public PlaybackSink {
+public:
+  const char* name() const final                                         { return "Null"; }
+  void send(const PlaybackMessage* pMessages, size_t numMessages) final { numMessages_ += numMessages; }
+  uint64_t numMessages() const                                           { return numMessages_; }
+
+private:
+  uint64_t numMessages_{0};
+};
+
+//-------------------------------------------------------------------------------------------------
+// StreamSink
+//-------------------------------------------------------------------------------------------------
+
+// Writes messages into a file, a named pipe, a device node or stdout. Raw output is a plain MIDI
+// byte stream, text output has one line per message with its timestamp.
+class StreamSink : public PlaybackSink {
+public:
+  enum class Format {
+    Raw,
+    Text
+  };
+
+  StreamSink(Format format) : format_(format) {}
+  StreamSink(const StreamSink&) = delete;
+  StreamSink& operator = (const StreamSink&) = delete;
+  ~StreamSink();
+
+  // Opens 'path' for writing, "-" selects stdout:
+  bool open(const std::string& path);
+  void close();
+
+  const char* name() const final       { return format_ == Format::Raw ? "Stream (raw)" : "Stream (text)"; }
+  void send(const PlaybackMessage* pMessages, size_t numMessages) final;
+
+private:
+  const Format format_;
+  FILE* pFile_{nullptr};
+};
+
+#endif // _PLAYBACK_SINK_H
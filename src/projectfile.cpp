@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+#include "backgroundjob.h"
+#include "projectfile.h"
+#include "song.h"
+
+static const char ProjectMagic[8] = {'F', 'M', 'D', 'P', 'R', 'O', 'J', 0};
+
+// Records are written as they are laid out in memory:
+static_assert(sizeof(ProjectHeader) == 64, "unexpected project header size");
+static_assert(sizeof(ProjectTrackEntry) == 144, "unexpected project track entry size");
+static_assert(sizeof(ProgramChangeRecord) == 8, "unexpected program change record size");
+static_assert(sizeof(PitchBendRecord) == 8, "unexpected pitch bend record size");
+static_assert(sizeof(SetTempoRecord) == 8, "unexpected set tempo record size");
+static_assert(sizeof(NotImplementedRecord) == 8, "unexpected not implemented record size");
+
+//-------------------------------------------------------------------------------------------------
+// ProjectFile
+//-------------------------------------------------------------------------------------------------
+
+const uint32_t ProjectFile::Version;
+
+bool ProjectFile::open(const std::string& path) {
+  if (!file_.open(path))
+    return false;
+
+  // The meta track entry comes on top of all channel tracks, so their number must leave room for it:
+  if (file_.size() < sizeof(ProjectHeader) || memcmp(header().magic, ProjectMagic, sizeof(ProjectMagic)) != 0 ||
+      header().version < 1 || header().version > Version || header().numTracks == UINT32_MAX) {
+    file_.close();
+    return false;
+  }
+
+  const uint64_t directorySize = static_cast<uint64_t>(numEntries()) * sizeof(ProjectTrackEntry);
+
+  if (header().directoryOffset % alignof(ProjectTrackEntry) != 0 || header().directoryOffset > file_.size() ||
+      directorySize > file_.size() - header().directoryOffset) {
+    file_.close();
+    return false;
+  }
+
+  // Validating all blocks up front keeps loading a track free of any checks:
+  for (uint32_t entryNo = 0; entryNo < numEntries(); ++entryNo) {
+    const ProjectTrackEntry& e = entry(entryNo);
+
+    const bool isValid = isBlockValid<char>({e.nameOffset, e.nameLength}) &&
+        isBlockValid<uint32_t>(e.noteStartTicks) && isBlockValid<uint32_t>(e.noteNumTicks) &&
+        isBlockValid<uint8_t>(e.notes) && isBlockValid<ProgramChangeRecord>(e.programChanges) &&
+        isBlockValid<PitchBendRecord>(e.pitchBends) && isBlockValid<SetTempoRecord>(e.tempoChanges) &&
+        isBlockValid<NotImplementedRecord>(e.notImplemented) &&
+        e.noteStartTicks.count == e.notes.count && e.noteNumTicks.count == e.notes.count;
+
+    if (!isValid) {
+      file_.close();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+const ProjectTrackEntry& ProjectFile::entry(uint32_t entryNo) const {
+  const uint8_t* pDirectory = file_.data() + header().directoryOffset;
+
+  return reinterpret_cast<const ProjectTrackEntry*>(pDirectory)[entryNo];
+}
+
+std::string ProjectFile::trackName(uint32_t entryNo) const {
+  const ProjectTrackEntry& e = entry(entryNo);
+
+  return std::string(reinterpret_cast<const char*>(file_.data() + e.nameOffset), e.nameLength);
+}
+
+EventStoreStats ProjectFile::stats(uint32_t entryNo) const {
+  const ProjectTrackEntry& e = entry(entryNo);
+
+  EventStoreStats stats;
+  stats.endTick = e.endTick;
+  stats.audibleEndTick = e.audibleEndTick;
+  stats.numNotes = e.numNotes;
+  stats.lowestNote = e.lowestNote;
+  stats.highestNote = e.highestNote;
+
+  return stats;
+}
+
+void ProjectFile::loadTrack(uint32_t entryNo, TrackEventStore& events) const {
+  const ProjectTrackEntry& e = entry(entryNo);
+
+  // Blocks are stored sorted, so assigning them is a plain copy:
+  events.notes().assign(readBlock<uint32_t>(e.noteStartTicks), readBlock<uint32_t>(e.noteNumTicks),
+      readBlock<uint8_t>(e.notes));
+  events.programChanges().assign(readBlock<ProgramChangeRecord>(e.programChanges));
+  events.pitchBends().assign(readBlock<PitchBendRecord>(e.pitchBends));
+  std::vector<SetTempoRecord> tempoChanges = readBlock<SetTempoRecord>(e.tempoChanges);
+
+  // Version 1 stored the tempo as float bpm in the same bits:
+  if (header().version == 1) {
+    for (SetTempoRecord& setTempo : tempoChanges) {
+      float bpm = 0;
+      memcpy(&bpm, &setTempo.usPerQuarterNote, sizeof(bpm));
+      setTempo.usPerQuarterNote = bpm > 0 ? static_cast<uint32_t>(std::lround(60000000.0 / bpm)) : TempoMap::DefaultUsPerQuarterNote;
+    }
+  }
+
+  events.tempoChanges().assign(std::move(tempoChanges));
+  events.notImplemented().assign(readBlock<NotImplementedRecord>(e.notImplemented));
+}
+
+template <typename T>
+bool ProjectFile::isBlockValid(const ProjectBlock& block) const {
+  if (block.offset > file_.size() || block.count > (file_.size() - block.offset) / sizeof(T))
+    return false;
+
+  return block.count == 0 || block.offset % alignof(T) == 0;
+}
+
+template <typename T>
+std::vector<T> ProjectFile::readBlock(const ProjectBlock& block) const {
+  std::vector<T> elements(static_cast<size_t>(block.count));
+
+  if (!elements.empty())
+    memcpy(elements.data(), file_.data() + block.offset, elements.size() * sizeof(T));
+
+  return elements;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Writing
+//-------------------------------------------------------------------------------------------------
+
+namespace {
+
+// Writes blocks while keeping track of the current file offset:
+class BlockWriter {
+public:
+  BlockWriter(FILE* pFile, JobProgress* pProgress) : pFile_(pFile), pProgress_(pProgress) {}
+
+  uint64_t offset() const                         { return offset_; }
+  bool hasFailed() const                          { return hasFailed_; }
+
+  void write(const void* pData, size_t size) {
+    if (size && fwrite(pData, 1, size, pFile_) != size)
+      hasFailed_ = true;
+
+    offset_ += size;
+
+    if (pProgress_)
+      pProgress_->advance(size);
+  }
+
+  void align(size_t alignment) {
+    static const uint8_t zeros[8] = {};
+    write(zeros, static_cast<size_t>((alignment - offset_ % alignment) % alignment));
+  }
+
+  template <typename T>
+  ProjectBlock writeBlock(const std::vector<T>& elements) {
+    align(std::max<size_t>(alignof(T), 4));
+
+    const ProjectBlock block = {offset_, elements.size()};
+    write(elements.data(), elements.size() * sizeof(T));
+
+    return block;
+  }
+
+private:
+  FILE* const pFile_;
+  JobProgress* const pProgress_;
+  uint64_t offset_{0};
+  bool hasFailed_{false};
+};
+
+} // namespace
+
+bool ProjectFile::write(const std::string& path, const Song& song, JobProgress* pProgress) {
+  std::vector<const Track*> tracks;
+  tracks.push_back(song.metaTrack());
+
+  for (size_t trackNo = 0; trackNo < song.numberOfTracks(); ++trackNo)
+    tracks.push_back(song.track(static_cast<int>(trackNo)));
+
+  if (pProgress) {
+    uint64_t totalSize = sizeof(ProjectHeader) + tracks.size() * sizeof(ProjectTrackEntry);
+
+    for (const Track* pTrack : tracks) {
+      const TrackEventStore& events = pTrack->events();
+      totalSize += pTrack->name().size() + events.notes().size() * 9 + events.size() * 8;
+    }
+
+    pProgress->setTotal(totalSize);
+  }
+
+  // Never leave a truncated project behind, the old one stays untouched until the new one is complete:
+  const std::string tempPath = path + ".tmp";
+  FILE* pFile = fopen(tempPath.c_str(), "wb");
+
+  if (!pFile)
+    return false;
+
+  ProjectHeader header = {};
+  memcpy(header.magic, ProjectMagic, sizeof(ProjectMagic));
+  header.version = Version;
+  header.tpqn = song.tpqn();
+  header.numTracks = static_cast<uint32_t>(song.numberOfTracks());
+  header.selectedTrackNo = song.currentSelectedTrackNo();
+  header.directoryOffset = sizeof(ProjectHeader);
+
+  std::vector<ProjectTrackEntry> directory(tracks.size());
+  BlockWriter writer(pFile, pProgress);
+
+  // The directory is written twice, first as a placeholder and finally with all offsets filled in:
+  writer.write(&header, sizeof(header));
+  writer.write(directory.data(), directory.size() * sizeof(ProjectTrackEntry));
+
+  for (size_t entryNo = 0; entryNo < tracks.size(); ++entryNo) {
+    const Track* pTrack = tracks[entryNo];
+    ProjectTrackEntry& e = directory[entryNo];
+
+    e.nameOffset = writer.offset();
+    e.nameLength = static_cast<uint32_t>(pTrack->name().size());
+    writer.write(pTrack->name().data(), pTrack->name().size());
+  }
+
+  for (size_t entryNo = 0; entryNo < tracks.size(); ++entryNo) {
+    if (pProgress && pProgress->isCanceled())
+      break;
+
+    const Track* pTrack = tracks[entryNo];
+    const TrackEventStore& events = pTrack->events();
+    const EventStoreStats& stats = events.stats();
+    ProjectTrackEntry& e = directory[entryNo];
+
+    e.midiChannel = entryNo == 0 ? -1 : static_cast<const ChannelTrack*>(pTrack)->midiChannel();
+    e.endTick = stats.endTick;
+    e.audibleEndTick = stats.audibleEndTick;
+    e.numNotes = static_cast<uint32_t>(stats.numNotes);
+    e.lowestNote = stats.lowestNote;
+    e.highestNote = stats.highestNote;
+
+    e.noteStartTicks = writer.writeBlock(events.notes().startTicks());
+    e.noteNumTicks = writer.writeBlock(events.notes().numTicks());
+    e.notes = writer.writeBlock(events.notes().notes());
+    e.programChanges = writer.writeBlock(events.programChanges().records());
+    e.pitchBends = writer.writeBlock(events.pitchBends().records());
+    e.tempoChanges = writer.writeBlock(events.tempoChanges().records());
+    e.notImplemented = writer.writeBlock(events.notImplemented().records());
+  }
+
+  bool hasSucceeded = !writer.hasFailed() && !(pProgress && pProgress->isCanceled());
+
+  if (hasSucceeded && (fseek(pFile, static_cast<long>(header.directoryOffset), SEEK_SET) != 0 ||
+      fwrite(directory.data(), sizeof(ProjectTrackEntry), directory.size(), pFile) != directory.size()))
+    hasSucceeded = false;
+
+  if (fclose(pFile) != 0)
+    hasSucceeded = false;
+
+  if (!hasSucceeded) {
+    remove(tempPath.c_str());
+    return false;
+  }
+
+  return replaceFile(tempPath, path);
+}
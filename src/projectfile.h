@@ -0,0 +1,92 @@
+#ifndef _PROJECT_FILE_H
+#define _PROJECT_FILE_H
+
+#include <stdint.h>
+#include <string>
+
+#include "eventstore.h"
+#include "mappedfile.h"
+
+class JobProgress;
+class Song;
+
+//-------------------------------------------------------------------------------------------------
+// Project file layout
+//-------------------------------------------------------------------------------------------------
+
+// All fields are stored little endian and naturally aligned, so a mapped file can be used as is.
+// The file starts with the header, followed by the track directory, the track names and finally
+// the event blocks of all tracks. Entry 0 of the directory is the meta track.
+
+struct ProjectHeader {
+  char magic[8];
+  uint32_t version;
+  uint16_t tpqn;
+  uint16_t reserved0;
+  uint32_t numTracks;         // channel tracks, without the meta track
+  int32_t selectedTrackNo;
+  uint64_t directoryOffset;
+  uint64_t reserved1[4];
+};
+
+// Contiguous array of fixed width elements:
+struct ProjectBlock {
+  uint64_t offset;
+  uint64_t count;
+};
+
+struct ProjectTrackEntry {
+  uint64_t nameOffset;
+  uint32_t nameLength;
+  int32_t midiChannel;        // -1 for the meta track
+
+  // Precomputed, so the track list can be shown without loading any events:
+  uint32_t endTick;
+  uint32_t audibleEndTick;
+  uint32_t numNotes;
+  uint8_t lowestNote;
+  uint8_t highestNote;
+  uint16_t reserved;
+
+  ProjectBlock noteStartTicks;
+  ProjectBlock noteNumTicks;
+  ProjectBlock notes;
+  ProjectBlock programChanges;
+  ProjectBlock pitchBends;
+  ProjectBlock tempoChanges;
+  ProjectBlock notImplemented;
+};
+
+//-------------------------------------------------------------------------------------------------
+// ProjectFile
+//-------------------------------------------------------------------------------------------------
+
+// Read access to a mapped project file. Opening only validates the header and the directory, the
+// events of a track are copied out of the mapping, when the track gets loaded.
+class ProjectFile {
+public:
+  static const uint32_t Version = 2; // 1 stored tempo changes as float bpm
+
+  bool open(const std::string& path);
+
+  const ProjectHeader& header() const              { return *reinterpret_cast<const ProjectHeader*>(file_.data()); }
+  uint32_t numEntries() const                      { return header().numTracks + 1; }
+  const ProjectTrackEntry& entry(uint32_t entryNo) const;
+  std::string trackName(uint32_t entryNo) const;
+  EventStoreStats stats(uint32_t entryNo) const;
+  void loadTrack(uint32_t entryNo, TrackEventStore& events) const;
+
+  // Writes a song into a temporary file, which replaces 'path' once it is complete:
+  static bool write(const std::string& path, const Song& song, JobProgress* pProgress = nullptr);
+
+private:
+  template <typename T>
+  bool isBlockValid(const ProjectBlock& block) const;
+
+  template <typename T>
+  std::vector<T> readBlock(const ProjectBlock& block) const;
+
+  MappedFile file_;
+};
+
+#endif // _PROJECT_FILE_H
@@ -0,0 +1,30 @@
+#include "redrawscheduler.h"
+
+wxDEFINE_EVENT(EVT_REDRAW_REQUEST, wxCommandEvent);
+
+//-------------------------------------------------------------------------------------------------
+// RedrawScheduler
+//-------------------------------------------------------------------------------------------------
+
+void RedrawScheduler::invalidate(uint32_t views) {
+  dirtyViews_ |= views;
+
+  if (!IsRunning())
+    Start(FrameIntervalMs, wxTIMER_ONE_SHOT);
+}
+
+void RedrawScheduler::request(wxWindow* pSender, uint32_t views) {
+  wxCommandEvent event(EVT_REDRAW_REQUEST, pSender->GetId());
+  event.SetEventObject(pSender);
+  event.SetInt(static_cast<int>(views));
+
+  pSender->ProcessWindowEvent(event);
+}
+
+void RedrawScheduler::Notify() {
+  const uint32_t dirtyViews = dirtyViews_;
+  dirtyViews_ = 0;
+
+  if (dirtyViews)
+    flushCallback_(dirtyViews);
+}
@@ -0,0 +1,46 @@
+#ifndef _REDRAW_SCHEDULER_H
+#define _REDRAW_SCHEDULER_H
+
+#include <functional>
+
+#include <wx/wx.h>
+
+wxDECLARE_EVENT(EVT_REDRAW_REQUEST, wxCommandEvent);
+
+//-------------------------------------------------------------------------------------------------
+// RedrawScheduler
+//-------------------------------------------------------------------------------------------------
+
+// Collects redraw requests of all views as dirty flags and flushes them at most once per display
+// frame, so bursts of resize, scroll or edit events result in a single repaint.
+class RedrawScheduler : public wxTimer {
+public:
+  enum View : uint32_t {
+    Transport   = 1 << 0,
+    TrackList   = 1 << 1,
+    KeyEditor   = 1 << 2,
+    Title       = 1 << 3,
+    Playability = 1 << 4, // reanalysis of changed tracks, repaints the key editor if needed
+    All         = Transport | TrackList | KeyEditor | Title | Playability
+  };
+
+  using FlushCallback = std::function<void(uint32_t dirtyViews)>;
+
+  RedrawScheduler(FlushCallback flushCallback)
+      : flushCallback_(flushCallback) {}
+
+  void invalidate(uint32_t views);
+
+  // Posts a redraw request from any window. It propagates up to the frame owning the scheduler.
+  static void request(wxWindow* pSender, uint32_t views);
+
+private:
+  void Notify() final;
+
+  static const int FrameIntervalMs = 16;
+
+  FlushCallback flushCallback_;
+  uint32_t dirtyViews_{0};
+};
+
+#endif // _REDRAW_SCHEDULER_H
@@ -0,0 +1,165 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
+
+#include "serialport.h"
+
+//-------------------------------------------------------------------------------------------------
+// SerialPort
+//-------------------------------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+bool SerialPort::open(const std::string& path, uint32_t baudRate) {
+  close();
+
+  // COM ports above 9 are only reachable through the device namespace:
+  const std::string devicePath = path.compare(0, 4, "\\\\.\\") == 0 ? path : "\\\\.\\" + path;
+  HANDLE hPort = CreateFileA(devicePath.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+  if (hPort == INVALID_HANDLE_VALUE)
+    return false;
+
+  DCB dcb = {};
+  dcb.DCBlength = sizeof(dcb);
+
+  if (!GetCommState(hPort, &dcb)) {
+    CloseHandle(hPort);
+    return false;
+  }
+
+  dcb.BaudRate = baudRate;
+  dcb.ByteSize = 8;
+  dcb.Parity = NOPARITY;
+  dcb.StopBits = ONESTOPBIT;
+  dcb.fBinary = TRUE;
+  dcb.fOutxCtsFlow = FALSE;
+  dcb.fOutxDsrFlow = FALSE;
+  dcb.fOutX = FALSE;
+  dcb.fInX = FALSE;
+  dcb.fDtrControl = DTR_CONTROL_ENABLE;
+  dcb.fRtsControl = RTS_CONTROL_ENABLE;
+
+  if (!SetCommState(hPort, &dcb)) {
+    CloseHandle(hPort);
+    return false;
+  }
+
+  hPort_ = hPort;
+
+  return true;
+}
+
+void SerialPort::close() {
+  if (hPort_)
+    CloseHandle(hPort_);
+
+  hPort_ = nullptr;
+}
+
+bool SerialPort::isOpen() const {
+  return hPort_ != nullptr;
+}
+
+bool SerialPort::write(const uint8_t* pData, size_t size) {
+  while (size > 0) {
+    DWORD numWritten = 0;
+
+    if (!WriteFile(hPort_, pData, static_cast<DWORD>(size), &numWritten, NULL))
+      return false;
+
+    pData += numWritten;
+    size -= numWritten;
+  }
+
+  return true;
+}
+
+#else
+
+static bool toSpeed(uint32_t baudRate, speed_t& speed) {
+  switch (baudRate) {
+    case 9600:   speed = B9600;   return true;
+    case 19200:  speed = B19200;  return true;
+    case 38400:  speed = B38400;  return true;
+    case 57600:  speed = B57600;  return true;
+    case 115200: speed = B115200; return true;
+    case 230400: speed = B230400; return true;
+    default:     return false;
+  }
+}
+
+bool SerialPort::open(const std::string& path, uint32_t baudRate) {
+  close();
+
+  speed_t speed;
+
+  if (!toSpeed(baudRate, speed))
+    return false;
+
+  const int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+
+  if (fd < 0)
+    return false;
+
+  termios tty;
+
+  if (tcgetattr(fd, &tty) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  cfmakeraw(&tty);
+  cfsetispeed(&tty, speed);
+  cfsetospeed(&tty, speed);
+  tty.c_cflag |= CLOCAL | CREAD;
+  tty.c_cflag &= ~CSTOPB;
+#ifdef CRTSCTS
+  tty.c_cflag &= ~CRTSCTS;
+#endif
+
+  if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+    ::close(fd);
+    return false;
+  }
+
+  fd_ = fd;
+
+  return true;
+}
+
+void SerialPort::close() {
+  if (fd_ >= 0)
+    ::close(fd_);
+
+  fd_ = -1;
+}
+
+bool SerialPort::isOpen() const {
+  return fd_ >= 0;
+}
+
+bool SerialPort::write(const uint8_t* pData, size_t size) {
+  while (size > 0) {
+    const ssize_t numWritten = ::write(fd_, pData, size);
+
+    if (numWritten < 0) {
+      if (errno == EINTR)
+        continue;
+
+      return false;
+    }
+
+    pData += numWritten;
+    size -= numWritten;
+  }
+
+  return true;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef _SERIAL_PORT_H
+#define _SERIAL_PORT_H
+
+#include <stdint.h>
+#include <string>
+
+//-------------------------------------------------------------------------------------------------
+// SerialPort
+//-------------------------------------------------------------------------------------------------
+
+// Raw 8N1 serial port without flow control. Writes block until all bytes are handed to the driver.
+// On POSIX systems any terminal device works, including pseudo terminals.
+class SerialPort {
+public:
+  SerialPort() {}
+  SerialPort(const SerialPort&) = delete;
+  SerialPort& operator = (const SerialPort&) = delete;
+  ~SerialPort()                                    { close(); }
+
+  bool open(const std::string& path, uint32_t baudRate);
+  void close();
+  bool isOpen() const;
+
+  bool write(const uint8_t* pData, size_t size);
+
+private:
+#ifdef _WIN32
+  void* hPort_{nullptr};
+#else
+  int fd_{-1};
+#endif
+};
+
+#endif // _SERIAL_PORT_H
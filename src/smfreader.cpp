@@ -0,0 +1,360 @@
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "backgroundjob.h"
+#include "smfreader.h"
+
+namespace {
+
+uint32_t readBigEndian(const uint8_t* p, int numBytes) {
+  uint32_t value = 0;
+
+  for (int i = 0; i < numBytes; ++i)
+    value = (value << 8) | p[i];
+
+  return value;
+}
+
+bool readVariableLength(const uint8_t*& p, const uint8_t* pEnd, uint32_t& value) {
+  value = 0;
+
+  // Variable length quantities are limited to four bytes:
+  for (int i = 0; i < 4 && p < pEnd; ++i) {
+    const uint8_t byte = *p++;
+    value = (value << 7) | (byte & 0x7F);
+
+    if (!(byte & 0x80))
+      return true;
+  }
+
+  return false;
+}
+
+// Walks over all events of a track chunk and passes them to the handler with their absolute tick.
+// Running status is resolved here, so handlers always receive complete messages.
+template <typename Handler>
+bool walkTrackChunk(const SmfReader::Chunk& chunk, Handler& handler, JobProgress* pProgress = nullptr) {
+  const uint8_t* p = chunk.pData;
+  const uint8_t* const pEnd = chunk.pData + chunk.size;
+  const uint8_t* pLastReport = p;
+
+  uint32_t tick = 0;
+  uint8_t runningStatus = 0;
+
+  // Progress is reported in steps, to keep the shared counter out of the hot loop:
+  auto reportProgress = [&]() {
+    if (pProgress) {
+      pProgress->advance(p - pLastReport);
+      pLastReport = p;
+    }
+  };
+
+  while (p < pEnd) {
+    if (pProgress && p - pLastReport >= 0x10000) {
+      reportProgress();
+
+      if (pProgress->isCanceled())
+        return false;
+    }
+
+    uint32_t deltaTicks;
+
+    if (!readVariableLength(p, pEnd, deltaTicks) || p == pEnd)
+      return false;
+
+    tick += deltaTicks;
+    uint8_t status = *p;
+
+    if (status & 0x80)
+      ++p;
+    else if (runningStatus)
+      status = runningStatus;
+    else
+      return false;
+
+    if (status == 0xFF) {
+      uint32_t length;
+
+      if (p == pEnd)
+        return false;
+
+      const uint8_t type = *p++;
+
+      if (!readVariableLength(p, pEnd, length) || length > static_cast<size_t>(pEnd - p))
+        return false;
+
+      handler.metaEvent(tick, type, p, length);
+      p += length;
+
+      if (type == 0x2F) { // end of track
+        p = pEnd;
+        reportProgress();
+
+        return true;
+      }
+    }
+    else if (status == 0xF0 || status == 0xF7) {
+      uint32_t length;
+
+      if (!readVariableLength(p, pEnd, length) || length > static_cast<size_t>(pEnd - p))
+        return false;
+
+      handler.sysExEvent(tick, status);
+      p += length;
+    }
+    else if (status > 0xF0) // system common and real time messages are not allowed in files
+      return false;
+    else {
+      const uint8_t eventId = status & 0xF0;
+      const int numDataBytes = eventId == 0xC0 || eventId == 0xD0 ? 1 : 2;
+
+      if (pEnd - p < numDataBytes)
+        return false;
+
+      handler.channelEvent(tick, status, p[0] & 0x7F, numDataBytes == 2 ? p[1] & 0x7F : 0);
+      p += numDataBytes;
+      runningStatus = status;
+    }
+  }
+
+  reportProgress();
+
+  return true;
+}
+
+// First pass, which only counts events, so all columns can be reserved up front:
+struct EventCounter {
+  void channelEvent(uint32_t tick, uint8_t status, uint8_t data1, uint8_t data2) {
+    uint32_t* pCounts = channelCounts[status & 0x0F];
+
+    switch (status & 0xF0) {
+      case 0x80:
+        break;
+
+      case 0x90:
+        ++pCounts[NoteBlocks];
+        break;
+
+      case 0xC0:
+        ++pCounts[ProgramChanges];
+        break;
+
+      case 0xE0:
+        ++pCounts[PitchBends];
+        break;
+
+      default:
+        ++pCounts[NotImplemented];
+        break;
+    }
+  }
+
+  void sysExEvent(uint32_t tick, uint8_t status) {
+    ++channelCounts[status & 0x0F][NotImplemented];
+  }
+
+  void metaEvent(uint32_t tick, uint8_t type, const uint8_t* pData, uint32_t length) {
+    ++numMetaEvents;
+  }
+
+  enum { NoteBlocks, ProgramChanges, PitchBends, NotImplemented, NumCounts };
+
+  uint32_t channelCounts[16][NumCounts]{};
+  uint32_t numMetaEvents{0};
+};
+
+// Second pass, which pairs note on and off events and fills the columns:
+struct EventDecoder {
+  EventDecoder(SmfChunkEvents& events, const EventCounter& counter)
+      : events(events), counter(counter) {
+
+    memset(channelSlots, -1, sizeof(channelSlots));
+    memset(isNoteOn, 0, sizeof(isNoteOn));
+  }
+
+  SmfChannelEvents& channel(int midiChannel) {
+    if (channelSlots[midiChannel] < 0) {
+      const uint32_t* pCounts = counter.channelCounts[midiChannel];
+
+      channelSlots[midiChannel] = static_cast<int8_t>(events.channels.size());
+      events.channels.push_back(SmfChannelEvents());
+
+      SmfChannelEvents& channelEvents = events.channels.back();
+      channelEvents.midiChannel = midiChannel;
+      channelEvents.noteStartTicks.reserve(pCounts[EventCounter::NoteBlocks]);
+      channelEvents.noteNumTicks.reserve(pCounts[EventCounter::NoteBlocks]);
+      channelEvents.notes.reserve(pCounts[EventCounter::NoteBlocks]);
+      channelEvents.programChanges.reserve(pCounts[EventCounter::ProgramChanges]);
+      channelEvents.pitchBends.reserve(pCounts[EventCounter::PitchBends]);
+      channelEvents.notImplemented.reserve(pCounts[EventCounter::NotImplemented]);
+    }
+
+    return events.channels[channelSlots[midiChannel]];
+  }
+
+  void noteOff(SmfChannelEvents& channelEvents, uint32_t tick, uint8_t note) {
+    const int midiChannel = channelEvents.midiChannel;
+
+    // A note off without a preceding note on closes a block of note 0, which spans from tick 0 up to
+    // the note off. This is what the eMIDI based importer did, so both produce the same songs:
+    uint32_t startTick = 0;
+    uint8_t blockNote = 0;
+
+    if (isNoteOn[midiChannel][note]) {
+      startTick = noteStartTicks[midiChannel][note];
+      blockNote = note;
+      isNoteOn[midiChannel][note] = false;
+    }
+
+    channelEvents.noteStartTicks.push_back(startTick);
+    channelEvents.noteNumTicks.push_back(tick - startTick);
+    channelEvents.notes.push_back(blockNote);
+  }
+
+  void channelEvent(uint32_t tick, uint8_t status, uint8_t data1, uint8_t data2) {
+    const int midiChannel = status & 0x0F;
+    const uint8_t eventId = status & 0xF0;
+    SmfChannelEvents& channelEvents = channel(midiChannel);
+
+    switch (eventId) {
+      case 0x90:
+        if (data2 == 0) // velocity of 0 means note off
+          noteOff(channelEvents, tick, data1);
+        else if (!isNoteOn[midiChannel][data1]) { // ignore additional note on events of active notes
+          isNoteOn[midiChannel][data1] = true;
+          noteStartTicks[midiChannel][data1] = tick;
+        }
+
+        break;
+
+      case 0x80:
+        if (isNoteOn[midiChannel][data1]) // ignore note off events without an active note
+          noteOff(channelEvents, tick, data1);
+
+        break;
+
+      case 0xC0:
+        channelEvents.programChanges.push_back({tick, data1});
+        break;
+
+      case 0xE0:
+        channelEvents.pitchBends.push_back({tick, static_cast<uint16_t>(data1 | (data2 << 7))});
+        break;
+
+      default:
+        channelEvents.notImplemented.push_back({tick, eventId, false});
+        break;
+    }
+  }
+
+  void sysExEvent(uint32_t tick, uint8_t status) {
+    channel(status & 0x0F).notImplemented.push_back({tick, static_cast<uint8_t>(status & 0xF0), false});
+  }
+
+  void metaEvent(uint32_t tick, uint8_t type, const uint8_t* pData, uint32_t length) {
+    if (type == 0x51 && length == 3) {
+      events.tempoChanges.push_back({tick, readBigEndian(pData, 3)});
+      return;
+    }
+
+    if (type == 0x03 && events.trackName.empty())
+      events.trackName.assign(reinterpret_cast<const char*>(pData), length);
+
+    events.metaNotImplemented.push_back({tick, type, true});
+  }
+
+  SmfChunkEvents& events;
+  const EventCounter& counter;
+
+  int8_t channelSlots[16];
+  bool isNoteOn[16][128];
+  uint32_t noteStartTicks[16][128];
+};
+
+} // namespace
+
+//-------------------------------------------------------------------------------------------------
+// SmfReader
+//-------------------------------------------------------------------------------------------------
+
+bool SmfReader::open(const uint8_t* pData, size_t size) {
+  trackChunks_.clear();
+
+  if (size < 14 || memcmp(pData, "MThd", 4) != 0 || readBigEndian(pData + 4, 4) < 6)
+    return false;
+
+  format_ = static_cast<uint16_t>(readBigEndian(pData + 8, 2));
+  tpqn_ = static_cast<uint16_t>(readBigEndian(pData + 12, 2));
+
+  const uint8_t* p = pData + 8 + readBigEndian(pData + 4, 4);
+  const uint8_t* const pEnd = pData + size;
+
+  // Unknown chunks are skipped, a truncated last chunk is decoded as far as it goes:
+  while (pEnd - p >= 8) {
+    const uint32_t chunkSize = readBigEndian(p + 4, 4);
+    const uint8_t* const pChunkData = p + 8;
+    const size_t availableSize = std::min<size_t>(chunkSize, pEnd - pChunkData);
+
+    if (memcmp(p, "MTrk", 4) == 0)
+      trackChunks_.push_back({pChunkData, availableSize});
+
+    p = pChunkData + availableSize;
+  }
+
+  return true;
+}
+
+bool SmfReader::decodeTrackChunk(const Chunk& chunk, SmfChunkEvents& events, JobProgress* pProgress) {
+  EventCounter counter;
+  walkTrackChunk(chunk, counter);
+
+  events.tempoChanges.reserve(counter.numMetaEvents);
+  events.metaNotImplemented.reserve(counter.numMetaEvents);
+
+  EventDecoder decoder(events, counter);
+  events.isComplete = walkTrackChunk(chunk, decoder, pProgress);
+
+  return events.isComplete;
+}
+
+std::vector<SmfChunkEvents> SmfReader::decodeTrackChunks(JobProgress* pProgress, size_t numThreads) const {
+  std::vector<SmfChunkEvents> events(trackChunks_.size());
+  std::atomic<size_t> nextChunkNo{0};
+
+  if (pProgress) {
+    uint64_t totalSize = 0;
+
+    for (const Chunk& chunk : trackChunks_)
+      totalSize += chunk.size;
+
+    pProgress->setTotal(totalSize);
+  }
+
+  // Every chunk is decoded into its own slot, so the order of completion doesn't matter:
+  auto decodeChunks = [&]() {
+    for (size_t chunkNo = nextChunkNo++; chunkNo < trackChunks_.size(); chunkNo = nextChunkNo++) {
+      if (pProgress && pProgress->isCanceled())
+        events[chunkNo].isComplete = false;
+      else
+        decodeTrackChunk(trackChunks_[chunkNo], events[chunkNo], pProgress);
+    }
+  };
+
+  if (numThreads == 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  const size_t numWorkers = std::min(numThreads, trackChunks_.size());
+  std::vector<std::thread> workers;
+
+  for (size_t i = 1; i < numWorkers; ++i)
+    workers.push_back(std::thread(decodeChunks));
+
+  decodeChunks();
+
+  for (std::thread& worker : workers)
+    worker.join();
+
+  return events;
+}
@@ -0,0 +1,73 @@
+#ifndef _SMF_READER_H
+#define _SMF_READER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "eventstore.h"
+
+class JobProgress;
+
+//-------------------------------------------------------------------------------------------------
+// SmfChunkEvents
+//-------------------------------------------------------------------------------------------------
+
+// Events of a single MIDI channel. Note blocks are stored in the order they have been closed in,
+// all other events in tick order.
+struct SmfChannelEvents {
+  int midiChannel{0};
+  std::vector<uint32_t> noteStartTicks;
+  std::vector<uint32_t> noteNumTicks;
+  std::vector<uint8_t> notes;
+  std::vector<ProgramChangeRecord> programChanges;
+  std::vector<PitchBendRecord> pitchBends;
+  std::vector<NotImplementedRecord> notImplemented;
+};
+
+// All events decoded from a single track chunk:
+struct SmfChunkEvents {
+  std::string trackName;                  // first track name meta event, if any
+  std::vector<SmfChannelEvents> channels; // in order of their first event
+  std::vector<SetTempoRecord> tempoChanges;
+  std::vector<NotImplementedRecord> metaNotImplemented;
+  bool isComplete{true};                  // false, if decoding stopped at a malformed event
+};
+
+//-------------------------------------------------------------------------------------------------
+// SmfReader
+//-------------------------------------------------------------------------------------------------
+
+// Decodes standard MIDI files straight from memory, e.g. a mapped file. The reader doesn't copy the
+// data, so it has to outlive the reader.
+class SmfReader {
+public:
+  struct Chunk {
+    const uint8_t* pData;
+    size_t size;
+  };
+
+  // Parses the header and locates all track chunks:
+  bool open(const uint8_t* pData, size_t size);
+
+  uint16_t format() const                            { return format_; }
+  uint16_t tpqn() const                              { return tpqn_; }
+  const std::vector<Chunk>& trackChunks() const      { return trackChunks_; }
+
+  // Decodes all events of a track chunk. Decoding stops at the first malformed event, in which case
+  // all events before it are kept and false is returned. Progress is reported in decoded bytes.
+  static bool decodeTrackChunk(const Chunk& chunk, SmfChunkEvents& events, JobProgress* pProgress = nullptr);
+
+  // Decodes all track chunks in parallel, one chunk per worker at a time. Starts one worker per
+  // hardware thread if 'numThreads' is 0, callers decoding several files in parallel pass 1. The
+  // result only depends on the file, never on how the workers have been scheduled. Once canceled,
+  // the remaining chunks are left incomplete.
+  std::vector<SmfChunkEvents> decodeTrackChunks(JobProgress* pProgress = nullptr, size_t numThreads = 0) const;
+
+private:
+  uint16_t format_{0};
+  uint16_t tpqn_{0};
+  std::vector<Chunk> trackChunks_;
+};
+
+#endif // _SMF_READER_H
@@ -0,0 +1,134 @@
+#include "smfwriter.h"
+
+//-------------------------------------------------------------------------------------------------
+// SmfWriter
+//-------------------------------------------------------------------------------------------------
+
+const size_t SmfWriter::BufferSize;
+
+SmfWriter::~SmfWriter() {
+  if (pFile_)
+    close();
+}
+
+bool SmfWriter::open(const std::string& path, uint16_t tpqn) {
+  pFile_ = fopen(path.c_str(), "wb");
+
+  if (!pFile_)
+    return false;
+
+  buffer_.clear();
+  buffer_.reserve(BufferSize);
+  trackLength_ = 0;
+  runningStatus_ = 0;
+  hasFailed_ = false;
+
+  // Header chunk of a format 0 file with a single track, followed by the track chunk, whose length
+  // is unknown yet:
+  const uint8_t header[] = {
+    'M', 'T', 'h', 'd', 0, 0, 0, 6,
+    0, 0,
+    0, 1,
+    static_cast<uint8_t>(tpqn >> 8), static_cast<uint8_t>(tpqn),
+    'M', 'T', 'r', 'k', 0, 0, 0, 0
+  };
+
+  buffer_.insert(buffer_.end(), header, header + sizeof(header));
+
+  return true;
+}
+
+bool SmfWriter::close() {
+  if (!pFile_)
+    return false;
+
+  flush();
+
+  const uint8_t length[] = {
+    static_cast<uint8_t>(trackLength_ >> 24), static_cast<uint8_t>(trackLength_ >> 16),
+    static_cast<uint8_t>(trackLength_ >> 8), static_cast<uint8_t>(trackLength_)
+  };
+
+  if (fseek(pFile_, 18, SEEK_SET) != 0 || fwrite(length, 1, sizeof(length), pFile_) != sizeof(length))
+    hasFailed_ = true;
+
+  if (fclose(pFile_) != 0)
+    hasFailed_ = true;
+
+  pFile_ = nullptr;
+  buffer_ = std::vector<uint8_t>();
+
+  return !hasFailed_;
+}
+
+void SmfWriter::writeChannelEvent(uint32_t deltaTicks, uint8_t status, uint8_t data1) {
+  writeVariableLength(deltaTicks);
+  writeStatus(status);
+  put(data1 & 0x7F);
+}
+
+void SmfWriter::writeChannelEvent(uint32_t deltaTicks, uint8_t status, uint8_t data1, uint8_t data2) {
+  writeVariableLength(deltaTicks);
+  writeStatus(status);
+  put(data1 & 0x7F);
+  put(data2 & 0x7F);
+}
+
+void SmfWriter::writeSetTempo(uint32_t deltaTicks, uint32_t usPerQuarterNote) {
+  writeVariableLength(deltaTicks);
+  put(0xFF);
+  put(0x51);
+  put(0x03);
+  put(static_cast<uint8_t>(usPerQuarterNote >> 16));
+  put(static_cast<uint8_t>(usPerQuarterNote >> 8));
+  put(static_cast<uint8_t>(usPerQuarterNote));
+
+  // Readers may or may not keep running status across meta events, so don't rely on it:
+  runningStatus_ = 0;
+}
+
+void SmfWriter::writeEndOfTrack(uint32_t deltaTicks) {
+  writeVariableLength(deltaTicks);
+  put(0xFF);
+  put(0x2F);
+  put(0x00);
+
+  runningStatus_ = 0;
+}
+
+void SmfWriter::writeVariableLength(uint32_t value) {
+  uint8_t bytes[5];
+  int numBytes = 0;
+
+  do {
+    bytes[numBytes++] = value & 0x7F;
+    value >>= 7;
+  } while (value);
+
+  while (numBytes > 1)
+    put(bytes[--numBytes] | 0x80);
+
+  put(bytes[0]);
+}
+
+void SmfWriter::writeStatus(uint8_t status) {
+  if (status != runningStatus_)
+    put(status);
+
+  runningStatus_ = status;
+}
+
+void SmfWriter::put(uint8_t byte) {
+  if (buffer_.size() == BufferSize)
+    flush();
+
+  buffer_.push_back(byte);
+  ++trackLength_;
+}
+
+void SmfWriter::flush() {
+  if (!buffer_.empty() && fwrite(buffer_.data(), 1, buffer_.size(), pFile_) != buffer_.size())
+    hasFailed_ = true;
+
+  buffer_.clear();
+}
@@ -0,0 +1,45 @@
+#ifndef _SMF_WRITER_H
+#define _SMF_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+//-------------------------------------------------------------------------------------------------
+// SmfWriter
+//-------------------------------------------------------------------------------------------------
+
+// Writes a single track standard MIDI file in one pass. Events are encoded into a large buffer,
+// which is flushed whenever it is full. The chunk length is patched in on close().
+class SmfWriter {
+public:
+  SmfWriter() {}
+  SmfWriter(const SmfWriter&) = delete;
+  SmfWriter& operator = (const SmfWriter&) = delete;
+  ~SmfWriter();
+
+  bool open(const std::string& path, uint16_t tpqn);
+  bool close();
+
+  void writeChannelEvent(uint32_t deltaTicks, uint8_t status, uint8_t data1);
+  void writeChannelEvent(uint32_t deltaTicks, uint8_t status, uint8_t data1, uint8_t data2);
+  void writeSetTempo(uint32_t deltaTicks, uint32_t usPerQuarterNote);
+  void writeEndOfTrack(uint32_t deltaTicks);
+
+private:
+  static const size_t BufferSize = 1 << 20;
+
+  void writeVariableLength(uint32_t value);
+  void writeStatus(uint8_t status);
+  void put(uint8_t byte);
+  void flush();
+
+  FILE* pFile_{nullptr};
+  std::vector<uint8_t> buffer_;
+  uint32_t trackLength_{0};
+  uint8_t runningStatus_{0};
+  bool hasFailed_{false};
+};
+
+#endif // _SMF_WRITER_H
@@ -1,18 +1,59 @@
-#include <map>
+#include <algorithm>
 #include <sstream>
 
 extern "C" {
+#include "lib/eMIDI/src/midifile.h"
 #include "lib/eMIDI/src/helpers.h"
 }
 
-#include "lib/eMIDI/src/midifile_oop.h"
-
+#include "backgroundjob.h"
+#include "eventmerger.h"
+#include "mappedfile.h"
+#include "projectfile.h"
+#include "smfreader.h"
+#include "smfwriter.h"
 #include "song.h"
 
+template <typename T>
+static void appendColumn(std::vector<T>& to, std::vector<T>& from) {
+  if (to.empty())
+    to.swap(from);
+  else
+    to.insert(to.end(), from.begin(), from.end());
+}
+
+// Appends channel events to the ones of previous chunks, keeping one entry per channel:
+static void mergeChannelEvents(std::vector<SmfChannelEvents>& merged, std::vector<SmfChannelEvents>& channels) {
+  for (SmfChannelEvents& from : channels) {
+    auto sameChannel = [&from](const SmfChannelEvents& c) { return c.midiChannel == from.midiChannel; };
+    auto it = std::find_if(merged.begin(), merged.end(), sameChannel);
+
+    if (it == merged.end()) {
+      merged.push_back(std::move(from));
+      continue;
+    }
+
+    appendColumn(it->noteStartTicks, from.noteStartTicks);
+    appendColumn(it->noteNumTicks, from.noteNumTicks);
+    appendColumn(it->notes, from.notes);
+    appendColumn(it->programChanges, from.programChanges);
+    appendColumn(it->pitchBends, from.pitchBends);
+    appendColumn(it->notImplemented, from.notImplemented);
+  }
+}
+
 //-------------------------------------------------------------------------------------------------
 // Song
 //-------------------------------------------------------------------------------------------------
 
+Song::Song(const Song& song)
+    : currentSongFileName_(song.currentSongFileName_), currentSelectedTrackNo_(song.currentSelectedTrackNo_),
+      tpqn_(song.tpqn_), tracks_(song.tracks_), structureRevision_(song.structureRevision_) {
+
+  metaTrack_.events() = song.metaTrack_.events();
+  rebindTracks();
+}
+
 void Song::clear() {
   tpqn_ = MIDI_DEFAULT_TPQN;
   tracks_.clear();
@@ -20,37 +61,83 @@ void Song::clear() {
 
   tracks_.push_back(ChannelTrack(*this, "Track 1", 0));
   currentSelectedTrackNo_ = 0;
+  structureRevision_ = nextRevision();
 }
 
-uint64_t Song::durationUs() const {
-  uint64_t longestDuration = 0;
+void Song::swap(Song& song) {
+  std::swap(currentSongFileName_, song.currentSongFileName_);
+  std::swap(currentSelectedTrackNo_, song.currentSelectedTrackNo_);
+  std::swap(tpqn_, song.tpqn_);
+  std::swap(metaTrack_.events(), song.metaTrack_.events());
+  tracks_.swap(song.tracks_);
+  std::swap(structureRevision_, song.structureRevision_);
 
-  for (const ChannelTrack& track : tracks_) {
-    const uint64_t curDuration = track.durationUs();
+  // Revisions are unique among all songs, so resetting them makes both songs rebuild their caches:
+  tempoMapRevision_ = song.tempoMapRevision_ = 0;
+  cacheRevision_ = song.cacheRevision_ = 0;
+
+  rebindTracks();
+  song.rebindTracks();
+}
+
+void Song::rebindTracks() {
+  for (ChannelTrack& track : tracks_)
+    track.setSong(*this);
+}
 
-    if (curDuration > longestDuration)
-      longestDuration = curDuration;
+const TempoMap& Song::tempoMap() const {
+  const uint64_t currentRevision = tempoRevision();
+
+  if (tempoMapRevision_ != currentRevision) {
+    tempoMap_.build(metaTrack_.events().tempoChanges(), tpqn_);
+    tempoMapRevision_ = currentRevision;
   }
 
-  return longestDuration;
+  return tempoMap_;
 }
 
-uint32_t Song::numTicks() const {
-  uint32_t longestTrackTicks = 0;
+uint64_t Song::tempoRevision() const {
+  return std::max(structureRevision_, metaTrack_.events().tempoChanges().revision());
+}
+
+uint64_t Song::revision() const {
+  uint64_t revision = std::max(structureRevision_, metaTrack_.events().revision());
+
+  for (const ChannelTrack& track : tracks_)
+    revision = std::max(revision, track.revision());
+
+  return revision;
+}
 
-  for (const Track& track : tracks_) {
-    const uint32_t curTrackTicks = track.numTicks();
+uint64_t Song::durationUs() const {
+  const uint64_t currentRevision = revision();
+
+  if (cacheRevision_ == currentRevision)
+    return durationUs_;
+
+  uint64_t longestDuration = 0;
+  uint32_t longestTrackTicks = 0;
 
-    if (curTrackTicks > longestTrackTicks)
-      longestTrackTicks = curTrackTicks;
+  for (const ChannelTrack& track : tracks_) {
+    longestDuration = std::max(longestDuration, track.durationUs());
+    longestTrackTicks = std::max(longestTrackTicks, track.numTicks());
   }
 
-  return longestTrackTicks;
+  durationUs_ = longestDuration;
+  numTicks_ = longestTrackTicks;
+  cacheRevision_ = currentRevision;
+
+  return durationUs_;
+}
+
+uint32_t Song::numTicks() const {
+  durationUs();
+
+  return numTicks_;
 }
 
 void Song::unselectAllEvents() {
-  for (SongEvent* pSongEvent : currentSelectedTrack()->songEvents())
-    pSongEvent->unselect();
+  currentSelectedTrack()->events().notes().unselectAll();
 }
 
 void Song::debugPrintAllSongEvents() const {
@@ -67,239 +154,252 @@ void Song::debugPrintAllSongEvents() const {
   metaTrack_.debugPrintAllEvents();
 }
 
-void Song::importFromMidi0(const std::string& path) {
-  MidiFile midiFile{0};
+bool Song::importFromMidi(const std::string& path, JobProgress* pProgress, size_t numThreads) {
+  MappedFile file;
 
-  if (Error error = eMidi_open(&midiFile, path.c_str())) {
+  if (!file.open(path)) {
     printf("Error on opening midi file!\n");
-    return;
+    return false;
   }
 
-  clear();
-  tracks_.clear();
-
-  setTpqn(midiFile.header.division.tpqn.TPQN);
+  SmfReader reader;
 
-  using OnNotesMap = std::map<uint8_t, NoteBlock>;
-  std::map<uint8_t, OnNotesMap> trackOnNotes;
-  std::map<uint8_t, uint8_t> channelToTrackNo;
+  if (!reader.open(file.data(), file.size())) {
+    printf("Error on reading midi file header!\n");
+    return false;
+  }
 
-  uint32_t currentTick = 0;
-  MidiEvent midiEvent;
+  std::vector<SmfChunkEvents> chunks = reader.decodeTrackChunks(pProgress, numThreads);
 
-  while (eMidi_readEvent(&midiFile, &midiEvent) == EMIDI_OK) {
-    const int eventId = midiEvent.eventId != MIDI_EVENT_META ? midiEvent.eventId & 0xF0 : MIDI_EVENT_META;
+  // A canceled import leaves the song untouched:
+  if (pProgress && pProgress->isCanceled())
+    return false;
 
-    currentTick += midiEvent.deltaTime;
+  struct ImportedTrack {
+    std::string name;
+    SmfChannelEvents* pEvents;
+  };
 
-    if (eventId != MIDI_EVENT_META) {
-      const int channel = midiEvent.eventId & 0x0F;
+  std::vector<ImportedTrack> importedTracks;
+  std::vector<SmfChannelEvents> channels;
+  std::vector<SetTempoRecord> tempoChanges;
+  std::vector<NotImplementedRecord> metaNotImplemented;
 
-      if (channelToTrackNo.find(channel) == channelToTrackNo.end()) {
-        trackOnNotes[channel] = OnNotesMap();
+  // Tracks are created in file order, so the result doesn't depend on which worker finished first:
+  for (size_t chunkNo = 0; chunkNo < chunks.size(); ++chunkNo) {
+    SmfChunkEvents& chunk = chunks[chunkNo];
 
-        std::ostringstream trackName;
-        trackName << "Track " << channel + 1;
-        tracks_.push_back(ChannelTrack(*this, trackName.str(), channel));
+    if (!chunk.isComplete)
+      printf("Error on reading track chunk %d, skipping its remaining events!\n", static_cast<int>(chunkNo));
 
-        channelToTrackNo[channel] = static_cast<uint8_t>(tracks_.size() - 1);
-      }
+    appendColumn(tempoChanges, chunk.tempoChanges);
+    appendColumn(metaNotImplemented, chunk.metaNotImplemented);
 
-      const int trackNo = channelToTrackNo[channel];
+    // A type 0 file is a single stream of all channels, which gets split into one track per channel:
+    if (reader.format() == 0) {
+      mergeChannelEvents(channels, chunk.channels);
+      continue;
+    }
 
-      Track* pTrack = &tracks_[trackNo];
-      OnNotesMap& onNotes = trackOnNotes[channel];
+    // Type 1 files get one track per chunk and channel. Chunks without channel events, like the
+    // tempo track, only contribute to the meta track:
+    for (SmfChannelEvents& channelEvents : chunk.channels) {
+      std::ostringstream trackName;
 
-      auto noteOn = [&](uint8_t note) {
-        NoteBlock noteBlock;
-        noteBlock.setNote(midiEvent.params.msg.noteOn.note);
-        noteBlock.setStartTick(currentTick);
+      if (chunk.trackName.empty())
+        trackName << "Track " << chunkNo + 1;
+      else
+        trackName << chunk.trackName;
 
-        onNotes[note] = noteBlock;
-      };
+      if (chunk.channels.size() > 1)
+        trackName << " (Ch. " << channelEvents.midiChannel + 1 << ")";
 
-      auto noteOff = [&](uint8_t note) {
-        NoteBlock& noteBlock = onNotes[note];
-        noteBlock.setNumTicks(currentTick - noteBlock.startTick());
-        pTrack->addSongEvent(onNotes[note]);
-        onNotes.erase(note);
-      };
+      importedTracks.push_back({trackName.str(), &channelEvents});
+    }
+  }
 
-      switch (eventId) {
-        case MIDI_EVENT_NOTE_ON: {
-          const uint8_t note = midiEvent.params.msg.noteOn.note;
+  for (SmfChannelEvents& channelEvents : channels) {
+    std::ostringstream trackName;
+    trackName << "Track " << channelEvents.midiChannel + 1;
 
-          if (midiEvent.params.msg.noteOn.velocity > 0) {
-            if (onNotes.find(note) == onNotes.end()) // ignore, double additional note on event if already active
-              noteOn(note);
-          }
-          else // Velocity of 0 means note off:
-            noteOff(note);
+    importedTracks.push_back({trackName.str(), &channelEvents});
+  }
 
-          break;
-        }
+  clear();
+  tracks_.clear();
+  tracks_.reserve(importedTracks.size());
 
-        case MIDI_EVENT_NOTE_OFF: {
-          const uint8_t note = midiEvent.params.msg.noteOff.note;
+  setTpqn(reader.tpqn());
 
-          if (onNotes.find(note) != onNotes.end()) // ignore, if there is no matching note on event active
-            noteOff(note);
+  for (ImportedTrack& importedTrack : importedTracks) {
+    SmfChannelEvents& channelEvents = *importedTrack.pEvents;
+    tracks_.push_back(ChannelTrack(*this, importedTrack.name, channelEvents.midiChannel));
 
-          break;
-        }
+    TrackEventStore& events = tracks_.back().events();
+    events.notes().assign(std::move(channelEvents.noteStartTicks), std::move(channelEvents.noteNumTicks),
+        std::move(channelEvents.notes));
+    events.programChanges().assign(std::move(channelEvents.programChanges));
+    events.pitchBends().assign(std::move(channelEvents.pitchBends));
+    events.notImplemented().assign(std::move(channelEvents.notImplemented));
+  }
 
-        case MIDI_EVENT_PROGRAM_CHANGE: {
-          ProgramChangeEvent programChange;
-          programChange.setStartTick(currentTick);
-          programChange.setProgram(midiEvent.params.msg.programChange.programNumber);
+  metaTrack_.events().tempoChanges().assign(std::move(tempoChanges));
+  metaTrack_.events().notImplemented().assign(std::move(metaNotImplemented));
 
-          pTrack->addSongEvent(programChange);
-          break;
-        }
+  structureRevision_ = nextRevision();
 
-        case MIDI_EVENT_PITCH_BEND: {
-          PitchBendEvent pitchBendEvent;
-          pitchBendEvent.setStartTick(currentTick);
-          pitchBendEvent.setPitchBendValue(midiEvent.params.msg.pitchBend.value);
+  printf("Imported MIDI file: format %d, %d track chunk(s), %d tpqn, %d channel track(s)\n", reader.format(),
+      static_cast<int>(reader.trackChunks().size()), reader.tpqn(), static_cast<int>(tracks_.size()));
 
-          pTrack->addSongEvent(pitchBendEvent);
-          break;
-        }
+  setCurrentFileNameFromPath(path);
 
-        default:
-          pTrack->addSongEvent(NotImplementedEvent(currentTick, eventId, 0));
-          break;
-      }
-    }
-    else {
-      switch (midiEvent.metaEventId) {
-        case MIDI_SET_TEMPO: {
-          static const uint32_t c = 60000000;
-          const float bpm = static_cast<float>(c) / midiEvent.params.msg.meta.setTempo.usPerQuarterNote;
-
-          SetTempoEvent setTempoEvent;
-          setTempoEvent.setStartTick(currentTick);
-          setTempoEvent.setBpm(bpm);
-
-          metaTrack_.addSongEvent(setTempoEvent);
-          break;
-        }
-
-        default:
-          metaTrack_.addSongEvent(NotImplementedMetaEvent(currentTick, midiEvent.metaEventId, 0));
-          break;
-      }
-    }
-  }
+  return true;
+}
 
-  if (Error error = eMidi_printFileInfo(&midiFile)) {
-    printf("Error on printing MIDI file info!\n");
-    return;
-  }
+bool Song::exportAsMidi0(const std::string& path, JobProgress* pProgress) {
+  // A failed or canceled export keeps the previous midi file, it only gets replaced as a whole:
+  const std::string tempPath = path + ".tmp";
+  SmfWriter writer;
 
-  if (Error error = eMidi_close(&midiFile)) {
-    printf("Error on closing midi file!\n");
-    return;
+  if (!writer.open(tempPath, tpqn())) {
+    printf("Error on creating midi file!\n");
+    return false;
   }
 
-  setCurrentFileNameFromPath(path);
-}
+  if (pProgress) {
+    uint64_t numEvents = metaTrack_.events().tempoChanges().size();
 
-void Song::exportAsMidi0(const std::string& path) {
-  MidiFile midiFile;
+    for (const ChannelTrack& track : tracks_) {
+      numEvents += 2 * track.events().notes().size() + track.events().programChanges().size() +
+          track.events().pitchBends().size();
+    }
 
-  if (Error error = eMidi_create(&midiFile, path.c_str(), tpqn())) {
-    eMidi_printError(error);
-    return;
+    pProgress->setTotal(numEvents);
   }
 
-  std::list<EmMidiEvent*> eventList;
+  SongEventMerger merger(*this);
+  MergedEvent event;
+  uint32_t lastTick = 0;
+  uint32_t numUnreportedEvents = 0;
+
+  while (merger.next(event)) {
+    if (pProgress && ++numUnreportedEvents == 0x10000) {
+      pProgress->advance(numUnreportedEvents);
+      numUnreportedEvents = 0;
 
-  for (const ChannelTrack& track : tracks_) {
-    for (const SongEvent* pSongEvent : track.songEvents()) {
-      switch (pSongEvent->type()) {
-        case SongEventType::NoteBlock: {
-          const NoteBlock& noteBlock = *static_cast<const NoteBlock*>(pSongEvent);
+      if (pProgress->isCanceled()) {
+        writer.close();
+        remove(tempPath.c_str());
 
-          eventList.push_back(new EmNoteOnEvent(&midiFile, noteBlock.startTick(), track.midiChannel(), noteBlock.note(), MIDI_DEFAULT_VELOCITY));
-          eventList.push_back(new EmNoteOffEvent(&midiFile, noteBlock.startTick() + noteBlock.numTicks(), track.midiChannel(), noteBlock.note(), MIDI_DEFAULT_VELOCITY));
-          break;
-        }
+        return false;
+      }
+    }
 
-        case SongEventType::ProgramChange: {
-          const ProgramChangeEvent& programChange = *static_cast<const ProgramChangeEvent*>(pSongEvent);
+    const uint32_t deltaTicks = event.tick - lastTick;
 
-          eventList.push_back(new EmProgramChangeEvent(&midiFile, programChange.startTick(),
-              track.midiChannel(), programChange.programNumber()));
+    switch (event.type) {
+      case MergedEvent::Type::SetTempo:
+        writer.writeSetTempo(deltaTicks, event.usPerQuarterNote);
+        break;
 
-          break;
-        }
+      case MergedEvent::Type::NoteOff:
+        writer.writeChannelEvent(deltaTicks, MIDI_EVENT_NOTE_OFF | event.midiChannel, event.note, MIDI_DEFAULT_VELOCITY);
+        break;
 
-        case SongEventType::PitchBend: {
-          const PitchBendEvent& pitchBendEvent = *static_cast<const PitchBendEvent*>(pSongEvent);
+      case MergedEvent::Type::ProgramChange:
+        writer.writeChannelEvent(deltaTicks, MIDI_EVENT_PROGRAM_CHANGE | event.midiChannel, event.programNumber);
+        break;
 
-          eventList.push_back(new EmPitchBendEvent(&midiFile, pitchBendEvent.startTick(), track.midiChannel(),
-              pitchBendEvent.pitchBendValue()));
+      case MergedEvent::Type::PitchBend:
+        writer.writeChannelEvent(deltaTicks, MIDI_EVENT_PITCH_BEND | event.midiChannel, event.pitchBendValue & 0x7F,
+            (event.pitchBendValue >> 7) & 0x7F);
+        break;
 
-          break;
-        }
-      }
+      case MergedEvent::Type::NoteOn:
+        writer.writeChannelEvent(deltaTicks, MIDI_EVENT_NOTE_ON | event.midiChannel, event.note, MIDI_DEFAULT_VELOCITY);
+        break;
     }
+
+    lastTick = event.tick;
   }
 
-  for (const SongEvent* pSongEvent : metaTrack_.songEvents()) {
-    switch (pSongEvent->type()) {
-      case SongEventType::SetTempo: {
-        const SetTempoEvent& setTempoEvent = *static_cast<const SetTempoEvent*>(pSongEvent);
+  writer.writeEndOfTrack(100);
 
-        eventList.push_back(new EmMetaSetTempoEvent(&midiFile, setTempoEvent.startTick(), setTempoEvent.bpm()));
-        break;
-      }
-    }
+  if (!writer.close()) {
+    printf("Error on writing midi file!\n");
+    remove(tempPath.c_str());
+    return false;
   }
 
-  // comparison, not case sensitive.
-  auto absoluteTicksAscending = [](const EmMidiEvent* pFirst, const EmMidiEvent* pSecond) -> bool {
-    return pFirst->absoluteTick() < pSecond->absoluteTick();
-  };
+  if (!replaceFile(tempPath, path))
+    return false;
 
-  eventList.sort(absoluteTicksAscending);
+  if (pProgress)
+    pProgress->advance(numUnreportedEvents);
 
-  uint32_t lastTick = 0;
+  setCurrentFileNameFromPath(path);
 
-  for (const EmMidiEvent* pEvent : eventList) {
-    const uint32_t deltaTick = pEvent->absoluteTick() - lastTick;
+  return true;
+}
 
-    if (Error error = pEvent->write(deltaTick))
-      eMidi_printError(error);
+bool Song::openProject(const std::string& path, JobProgress* pProgress) {
+  std::shared_ptr<ProjectFile> pFile = std::make_shared<ProjectFile>();
 
-    lastTick = pEvent->absoluteTick();
+  if (!pFile->open(path)) {
+    printf("Error on opening project file!\n");
+    return false;
   }
 
-  if (Error error = eMidi_writeEndOfTrackMetaEvent(&midiFile, 100)) {
-    eMidi_printError(error);
-    return;
-  }
+  const ProjectHeader& header = pFile->header();
 
-  if (Error error = eMidi_close(&midiFile)) {
-    eMidi_printError(error);
-    return;
+  if (pProgress)
+    pProgress->setTotal(pFile->numEntries());
+
+  clear();
+  tracks_.clear();
+  tracks_.reserve(header.numTracks);
+
+  setTpqn(header.tpqn);
+
+  // The meta track feeds the tempo map, which every duration depends on, so it is loaded right away:
+  pFile->loadTrack(0, metaTrack_.events());
+
+  for (uint32_t entryNo = 1; entryNo < pFile->numEntries(); ++entryNo) {
+    tracks_.push_back(ChannelTrack(*this, pFile->trackName(entryNo), pFile->entry(entryNo).midiChannel));
+    tracks_.back().setSource(pFile, entryNo);
+
+    if (pProgress)
+      pProgress->advance(1);
   }
 
+  if (tracks_.empty())
+    tracks_.push_back(ChannelTrack(*this, "Track 1", 0));
+
+  if (header.selectedTrackNo >= 0 && header.selectedTrackNo < static_cast<int>(tracks_.size()))
+    currentSelectedTrackNo_ = header.selectedTrackNo;
+
+  structureRevision_ = nextRevision();
+
+  printf("Opened project file: %d tpqn, %d channel track(s)\n", tpqn_, static_cast<int>(tracks_.size()));
+
   setCurrentFileNameFromPath(path);
+
+  return true;
 }
 
-// TODO: remove once rendering is fixed
-void Song::registerRedrawAllCallback(void(*redrawAllCallback)(void* pCtx), void* pCtx) {
-  pRedrawAllCallback_ = redrawAllCallback;
-  pRedrawCallbackCtx_ = pCtx;
+bool Song::saveProject(const std::string& path, JobProgress* pProgress) const {
+  if (!ProjectFile::write(path, *this, pProgress)) {
+    printf("Error on writing project file!\n");
+    return false;
+  }
+
+  return true;
 }
 
-void Song::requestGlobalRedraw() {
-  if (pRedrawAllCallback_)
-    pRedrawAllCallback_(pRedrawCallbackCtx_);
+void Song::loadAllTracks() {
+  for (const ChannelTrack& track : tracks_)
+    track.load();
 }
-// --
 
 void Song::setCurrentFileNameFromPath(const std::string & path) {
   size_t startOfFileName = path.find_last_of('\\');
@@ -317,167 +417,149 @@ void Song::setCurrentFileNameFromPath(const std::string & path) {
 //-------------------------------------------------------------------------------------------------
 
 Track::Track(const Track& track)
-  : Track(track.song_, track.name_) {
+  : Track(*track.pSong_, track.name_) {
   operator = (track);
 }
 
-Track::~Track() {
-  clear();
-}
-
 Track& Track::operator = (const Track& rhs) {
-  clear();
-
-  for (const SongEvent* pSongEvent : rhs.songEvents_)
-    songEvents_.push_back(pSongEvent->clone());
+  events_ = rhs.events_;
+  pSource_ = rhs.pSource_;
+  sourceEntryNo_ = rhs.sourceEntryNo_;
+  sourceStats_ = rhs.sourceStats_;
 
   return *this;
 }
 
 void Track::clear() {
-  for (SongEvent* pSongEvent : songEvents_)
-    delete pSongEvent;
-
-  songEvents_.clear();
+  events_.clear();
+  pSource_.reset();
 }
 
-uint32_t Track::numTicks() const {
-  if (!songEvents_.size())
-    return 0;
-
-  const SongEvent& lastEvent = *songEvents_.back();
-
-  return lastEvent.startTick() + lastEvent.numTicks();
+void Track::setSource(std::shared_ptr<const ProjectFile> pFile, uint32_t entryNo) {
+  // Clearing stamps the empty store with fresh revisions, loading it later stamps it again:
+  events_.clear();
+  sourceStats_ = pFile->stats(entryNo);
+  sourceEntryNo_ = entryNo;
+  pSource_ = std::move(pFile);
 }
 
-void Track::debugPrintAllEvents() const {
-  for (const SongEvent* pSongEvent : songEvents_) {
-    switch (pSongEvent->type()) {
-      case SongEventType::NotImplementedEvent: {
-        const NotImplementedEvent& ne = *static_cast<const NotImplementedEvent*>(pSongEvent);
+void Track::loadFromSource() const {
+  pSource_->loadTrack(sourceEntryNo_, events_);
+  pSource_.reset();
+}
 
-        printf("Not implemented event: ID: 0x%02X (%s)\n", ne.midiEventId(), eMidi_eventToStr(ne.midiEventId()));
-        break;
-      }
+void Track::addSongEvent(const SongEvent& songEvent) {
+  switch (songEvent.type()) {
+    case SongEventType::NoteBlock: {
+      const NoteBlock& noteBlock = static_cast<const NoteBlock&>(songEvent);
+      const EventHandle handle = events().notes().insert(noteBlock.startTick(), noteBlock.numTicks(), noteBlock.note());
 
-      case SongEventType::NotImplementedMetaEvent: {
-        const NotImplementedMetaEvent& nme = *static_cast<const NotImplementedMetaEvent*>(pSongEvent);
+      if (noteBlock.isSelected())
+        events().notes().select(handle);
 
-        printf("Not implemented meta event: ID: 0x%02X (%s)\n", nme.midiMetaEventId(),
-            eMidi_metaEventToStr(nme.midiMetaEventId()));
-        break;
-      }
+      break;
+    }
 
-      case SongEventType::ProgramChange: {
-        const ProgramChangeEvent& pce = *static_cast<const ProgramChangeEvent*>(pSongEvent);
+    case SongEventType::ProgramChange: {
+      const ProgramChangeEvent& programChange = static_cast<const ProgramChangeEvent&>(songEvent);
 
-        printf("Program change: %d (%s)\n", pce.programNumber(), eMidi_programToStr(pce.programNumber()));
-        break;
-      }
+      events().programChanges().insert({programChange.startTick(), programChange.programNumber()});
+      break;
+    }
 
-      case SongEventType::SetTempo: {
-        const SetTempoEvent& st = *static_cast<const SetTempoEvent*>(pSongEvent);
+    case SongEventType::PitchBend: {
+      const PitchBendEvent& pitchBend = static_cast<const PitchBendEvent&>(songEvent);
 
-        printf("Set Tempo: %.2f bpm\n", st.bpm());
-        break;
-      }
+      events().pitchBends().insert({pitchBend.startTick(), pitchBend.pitchBendValue()});
+      break;
+    }
 
-      case SongEventType::NoteBlock: {
-        const NoteBlock& b = *static_cast<const NoteBlock*>(pSongEvent);
+    case SongEventType::SetTempo: {
+      const SetTempoEvent& setTempo = static_cast<const SetTempoEvent&>(songEvent);
 
-        const ChannelTrack& channelTrack = *static_cast<const ChannelTrack*>(this);
-        const char* pNoteName = nullptr;
+      events().tempoChanges().insert({setTempo.startTick(), setTempo.usPerQuarterNote()});
+      break;
+    }
 
-        if (channelTrack.midiChannel() != 9)
-          pNoteName = eMidi_numberToNote(b.note());
-        else
-          pNoteName = eMidi_drumToStr(b.note());
+    case SongEventType::NotImplementedEvent: {
+      const NotImplementedEvent& ne = static_cast<const NotImplementedEvent&>(songEvent);
 
-        printf("Note: %s, start: %d, numTicks: %d\n", pNoteName, b.startTick(), b.numTicks());
-        break;
-      }
+      events().notImplemented().insert({ne.startTick(), ne.midiEventId(), false});
+      break;
     }
-  }
-}
 
-//-------------------------------------------------------------------------------------------------
-// ChannelTrack
-//-------------------------------------------------------------------------------------------------
-
-uint64_t ChannelTrack::durationUs() const {
-  std::list<EmMidiEvent*> eventList;
+    case SongEventType::NotImplementedMetaEvent: {
+      const NotImplementedMetaEvent& nme = static_cast<const NotImplementedMetaEvent&>(songEvent);
 
-  for (const SongEvent* pSongEvent : songEvents()) {
-    switch (pSongEvent->type()) {
-      case SongEventType::NoteBlock: {
-        const NoteBlock& noteBlock = *static_cast<const NoteBlock*>(pSongEvent);
+      events().notImplemented().insert({nme.startTick(), nme.midiMetaEventId(), true});
+      break;
+    }
 
-        eventList.push_back(new EmNoteOnEvent(nullptr, noteBlock.startTick(), midiChannel(), noteBlock.note(), MIDI_DEFAULT_VELOCITY));
-        eventList.push_back(new EmNoteOffEvent(nullptr, noteBlock.startTick() + noteBlock.numTicks(), midiChannel(), noteBlock.note(), MIDI_DEFAULT_VELOCITY));
+    default:
+      break;
+  }
+}
 
-        break;
-      }
+NoteBlock Track::noteBlock(EventHandle handle) const {
+  const NoteArray& notes = events().notes();
+  const size_t index = notes.index(handle);
 
-      case SongEventType::NotImplementedEvent: {
-        const NotImplementedEvent& notImplementedEvent = *static_cast<const NotImplementedEvent*>(pSongEvent);
+  NoteBlock noteBlock;
+  noteBlock.setStartTick(notes.startTick(index));
+  noteBlock.setNumTicks(notes.numTicks(index));
+  noteBlock.setNote(notes.note(index));
 
-        eventList.push_back(new EmNotImplementedEvent(nullptr, notImplementedEvent.midiEventId(),
-            notImplementedEvent.startTick()));
-      }
+  if (notes.isSelected(index))
+    noteBlock.select();
 
-      default:
-        break;
-    }
-  }
+  return noteBlock;
+}
 
-  for (const SongEvent* pSongEvent : song_.metaTrack()->songEvents()) {
-    switch (pSongEvent->type()) {
-      case SongEventType::SetTempo: {
-        const SetTempoEvent& setTempoEvent = *static_cast<const SetTempoEvent*>(pSongEvent);
+uint32_t Track::numTicks() const {
+  return stats().endTick;
+}
 
-        eventList.push_back(new EmMetaSetTempoEvent(nullptr, setTempoEvent.startTick(), setTempoEvent.bpm()));
-        break;
-      }
-    }
+void Track::debugPrintAllEvents() const {
+  for (const NotImplementedRecord& ne : events().notImplemented().records()) {
+    if (ne.isMetaEvent)
+      printf("Not implemented meta event: ID: 0x%02X (%s)\n", ne.midiEventId, eMidi_metaEventToStr(ne.midiEventId));
+    else
+      printf("Not implemented event: ID: 0x%02X (%s)\n", ne.midiEventId, eMidi_eventToStr(ne.midiEventId));
   }
 
-  // comparison, not case sensitive.
-  auto absoluteTicksAscending = [](const EmMidiEvent* pFirst, const EmMidiEvent* pSecond) -> bool {
-    return pFirst->absoluteTick() < pSecond->absoluteTick();
-  };
+  for (const ProgramChangeRecord& pce : events().programChanges().records())
+    printf("Program change: %d (%s)\n", pce.programNumber, eMidi_programToStr(pce.programNumber));
 
-  eventList.sort(absoluteTicksAscending);
+  for (const SetTempoRecord& st : events().tempoChanges().records())
+    printf("Set Tempo: %.2f bpm\n", TempoMap::usPerQuarterNoteToBpm(st.usPerQuarterNote));
 
-  static const uint32_t c = 60000000;
-  const float defaultBpm = 120;
-  const uint32_t tpqn = song_.tpqn();
+  const NoteArray& notes = events().notes();
 
-  uint32_t uspqn = static_cast<uint32_t>(c / defaultBpm);
-  uint64_t usCurrent = 0;
-  uint64_t usTotal = 0;
-  uint64_t lastTick = 0;
+  for (size_t i = 0; i < notes.size(); ++i) {
+    const ChannelTrack& channelTrack = *static_cast<const ChannelTrack*>(this);
+    const char* pNoteName = nullptr;
 
-  for (const EmMidiEvent* pEvent : eventList) {
-    const uint64_t deltaTick = pEvent->absoluteTick() - lastTick;
-
-    usCurrent += (deltaTick * uspqn) / tpqn; // FIXME: leads to integer overflow on big delta values
+    if (channelTrack.midiChannel() != 9)
+      pNoteName = eMidi_numberToNote(notes.note(i));
+    else
+      pNoteName = eMidi_drumToStr(notes.note(i));
 
-    lastTick = pEvent->absoluteTick();
+    printf("Note: %s, start: %d, numTicks: %d\n", pNoteName, notes.startTick(i), notes.numTicks(i));
+  }
+}
 
-    if (pEvent->eventId() == MIDI_EVENT_META) {
-      const EmMetaEvent* pMetaEvent = static_cast<const EmMetaEvent*>(pEvent);
+//-------------------------------------------------------------------------------------------------
+// ChannelTrack
+//-------------------------------------------------------------------------------------------------
 
-      if (pMetaEvent->metaEventId() == MIDI_SET_TEMPO) {
-        const EmMetaSetTempoEvent* pSetTempoEvent = static_cast<const EmMetaSetTempoEvent*>(pEvent);
+uint64_t ChannelTrack::durationUs() const {
+  const uint64_t currentRevision = std::max(revision(), pSong_->tempoRevision());
 
-        uspqn = static_cast<uint32_t>(c / pSetTempoEvent->bpm());
-      }
-      else
-        throw "non tempo meta event invalid!";
-    }
-    else
-      usTotal = usCurrent;
+  if (durationRevision_ != currentRevision) {
+    // Program changes and pitch bends do not extend the audible duration of a track:
+    durationUs_ = pSong_->tempoMap().tickToUs(stats().audibleEndTick);
+    durationRevision_ = currentRevision;
   }
 
-  return usTotal;
+  return durationUs_;
 }
@@ -2,10 +2,13 @@
 #define _SONG_H
 
 #include <stdint.h>
-#include <list>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "eventstore.h"
+#include "tempomap.h"
+
 //-------------------------------------------------------------------------------------------------
 // SongEvent
 //-------------------------------------------------------------------------------------------------
@@ -137,42 +140,58 @@ public:
   SongEvent* clone() const final   { return new SetTempoEvent(*this); }
   SongEventType type() const final { return SongEventType::SetTempo; }
 
-  void setBpm(float bpm)           { bpm_ = bpm; }
-  const float bpm() const          { return bpm_; }
+  void setUsPerQuarterNote(uint32_t usPerQuarterNote) { usPerQuarterNote_ = usPerQuarterNote; }
+  uint32_t usPerQuarterNote() const                   { return usPerQuarterNote_; }
 
 private:
-  float bpm_{0}; // TODO: use fixed point arithmetic instead
+  uint32_t usPerQuarterNote_{TempoMap::DefaultUsPerQuarterNote};
 };
 
 //-------------------------------------------------------------------------------------------------
 // Track
 //-------------------------------------------------------------------------------------------------
 
+class JobProgress;
+class ProjectFile;
 class Song;
 
 class Track {
 public:
   Track(const Song& song, std::string name)
-      : song_(song), name_(name) {};
+      : pSong_(&song), name_(name) {};
   Track(const Track& track);
   Track& operator = (const Track& rhs);
-  ~Track();
 
   void clear();
-  void addSongEvent(const SongEvent& songEvent)   { songEvents_.push_back(songEvent.clone()); }
-  const std::list<SongEvent*>& songEvents() const { return songEvents_; }
-  std::list<SongEvent*>& songEvents()             { return songEvents_; }
+  void setSong(const Song& song)                  { pSong_ = &song; }
+  void addSongEvent(const SongEvent& songEvent);
+  const TrackEventStore& events() const           { load(); return events_; }
+  TrackEventStore& events()                       { load(); return events_; }
+  const EventStoreStats& stats() const            { return pSource_ ? sourceStats_ : events_.stats(); }
+  NoteBlock noteBlock(EventHandle handle) const;
   const std::string& name() const                 { return name_; }
   uint32_t numTicks() const;
+  uint64_t revision() const                       { return events_.revision(); }
+
+  // Events of a track opened from a project file stay in the file until they are accessed first:
+  void setSource(std::shared_ptr<const ProjectFile> pFile, uint32_t entryNo);
+  bool isLoaded() const                           { return !pSource_; }
+  void load() const                               { if (pSource_) loadFromSource(); }
 
   void debugPrintAllEvents() const;
 
 protected:
-  const Song& song_;
+  const Song* pSong_;
 
 private:
-  std::list<SongEvent*> songEvents_;
+  void loadFromSource() const;
+
+  mutable TrackEventStore events_;
   std::string name_{"Undefined"};
+
+  mutable std::shared_ptr<const ProjectFile> pSource_;
+  uint32_t sourceEntryNo_{0};
+  EventStoreStats sourceStats_;
 };
 
 //-------------------------------------------------------------------------------------------------
@@ -189,6 +208,9 @@ public:
 
 private:
   const int midiChannel_{0};
+
+  mutable uint64_t durationUs_{0};
+  mutable uint64_t durationRevision_{0};
 };
 
 //-------------------------------------------------------------------------------------------------
@@ -209,35 +231,42 @@ public:
 class Song {
 public:
   Song()                                           { clear(); }
+  Song(const Song& song);
+  Song& operator = (const Song&) = delete;
+
   void clear();
-  void setTpqn(uint16_t tpqn)                      { tpqn_ = tpqn; }
+  void swap(Song& song);
+  void setTpqn(uint16_t tpqn)                      { tpqn_ = tpqn; structureRevision_ = nextRevision(); }
   ChannelTrack* track(int trackNo)                 { return &tracks_[trackNo]; }
   const ChannelTrack* track(int trackNo) const     { return &tracks_[trackNo]; }
   MetaTrack* metaTrack()                           { return &metaTrack_; }
   const MetaTrack* metaTrack() const               { return &metaTrack_; }
+  const TempoMap& tempoMap() const;
+  uint64_t tempoRevision() const;
+  uint64_t revision() const;
 
   size_t numberOfTracks() const                    { return tracks_.size(); }
   uint64_t durationUs() const;
   uint32_t numTicks() const;
   int currentSelectedTrackNo() const               { return currentSelectedTrackNo_; }
+  ChannelTrack* currentSelectedTrack()             { return track(currentSelectedTrackNo_); }
   const ChannelTrack* currentSelectedTrack() const { return track(currentSelectedTrackNo_); }
   const std::string& currentSongFileName() const   { return currentSongFileName_; }
 
   void setCurrentSelectedTrack(int track)          { currentSelectedTrackNo_ = track; }
   void debugPrintAllSongEvents() const;
   void unselectAllEvents();
-  void importFromMidi0(const std::string& path);
-  void exportAsMidi0(const std::string& path);
+  bool importFromMidi(const std::string& path, JobProgress* pProgress = nullptr, size_t numThreads = 0);
+  bool exportAsMidi0(const std::string& path, JobProgress* pProgress = nullptr);
+  bool openProject(const std::string& path, JobProgress* pProgress = nullptr);
+  bool saveProject(const std::string& path, JobProgress* pProgress = nullptr) const;
+  void loadAllTracks();
+  void setCurrentFileNameFromPath(const std::string& path);
 
   const uint16_t tpqn() const                      { return tpqn_; }
 
-  // TODO: remove once rendering is fixed:
-  void registerRedrawAllCallback(void(*redrawAllCallback)(void* pCtx), void* pCtx);
-  void requestGlobalRedraw();
-  // --
-
 private:
-  void setCurrentFileNameFromPath(const std::string& path);
+  void rebindTracks();
 
   std::string currentSongFileName_{"Unnamed"};
   int currentSelectedTrackNo_{0};
@@ -245,11 +274,13 @@ private:
 
   MetaTrack metaTrack_{*this};
   std::vector<ChannelTrack> tracks_;
+  uint64_t structureRevision_{0};
 
-  // TODO: remove once rendering is fixed:
-  void(*pRedrawAllCallback_)(void* pCtx) = nullptr;
-  void* pRedrawCallbackCtx_ = nullptr;
-  // --
+  mutable TempoMap tempoMap_;
+  mutable uint64_t tempoMapRevision_{0};
+  mutable uint64_t durationUs_{0};
+  mutable uint32_t numTicks_{0};
+  mutable uint64_t cacheRevision_{0};
 };
 
 #endif // _SONG_H
@@ -0,0 +1,224 @@
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "backgroundjob.h"
+#include "song.h"
+#include "songrenderer.h"
+#include "threadpool.h"
+
+// Adds a pulse wave to 'pOut', starting at the given phase in periods. Phases are below one period
+// on entry and advance by less than one per sample, so they fit into 32 bits for any segment:
+static void addPulseWave(float* pOut, size_t numSamples, double phase, double increment, float dutyCycle,
+    float amplitude) {
+  size_t i = 0;
+
+#ifdef HAS_SSE2
+  // Four consecutive samples per step, as two pairs of double precision phases. Every phase is
+  // computed from the sample index exactly like the scalar loop does, so both produce the same
+  // samples and no rounding error accumulates:
+  const __m128d high = _mm_set1_pd(amplitude);
+  const __m128d low = _mm_set1_pd(-amplitude);
+  const __m128d duty = _mm_set1_pd(dutyCycle);
+  const __m128d start = _mm_set1_pd(phase);
+  const __m128d step = _mm_set1_pd(increment);
+
+  auto pulse = [&](size_t index) {
+    const __m128d p = _mm_add_pd(start, _mm_mul_pd(_mm_setr_pd(double(index), double(index + 1)), step));
+    const __m128d fraction = _mm_sub_pd(p, _mm_cvtepi32_pd(_mm_cvttpd_epi32(p)));
+    const __m128d isHigh = _mm_cmplt_pd(fraction, duty);
+
+    return _mm_cvtpd_ps(_mm_or_pd(_mm_and_pd(isHigh, high), _mm_andnot_pd(isHigh, low)));
+  };
+
+  for (; i + 4 <= numSamples; i += 4) {
+    const __m128 sample = _mm_movelh_ps(pulse(i), pulse(i + 2));
+    _mm_storeu_ps(pOut + i, _mm_add_ps(_mm_loadu_ps(pOut + i), sample));
+  }
+#endif
+
+  for (; i < numSamples; ++i) {
+    double p = phase + i * increment;
+    p -= floor(p);
+
+    pOut[i] += p < dutyCycle ? amplitude : -amplitude;
+  }
+}
+
+// Clips the mix and converts it into 16 bit samples:
+static void convertToPcm(const float* pMix, size_t numSamples, int16_t* pOut) {
+  size_t i = 0;
+
+#ifdef HAS_SSE2
+  const __m128 scale = _mm_set1_ps(32767.0f);
+  const __m128 maxValue = _mm_set1_ps(1.0f);
+  const __m128 minValue = _mm_set1_ps(-1.0f);
+
+  for (; i + 8 <= numSamples; i += 8) {
+    const __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pMix + i), minValue), maxValue);
+    const __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pMix + i + 4), minValue), maxValue);
+    const __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(a, scale)),
+        _mm_cvtps_epi32(_mm_mul_ps(b, scale)));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + i), packed);
+  }
+#endif
+
+  for (; i < numSamples; ++i) {
+    const float sample = std::min(1.0f, std::max(-1.0f, pMix[i]));
+    pOut[i] = static_cast<int16_t>(lrintf(sample * 32767.0f));
+  }
+}
+
+static void putLittleEndian(uint8_t* pOut, uint32_t value, size_t numBytes) {
+  for (size_t i = 0; i < numBytes; ++i)
+    pOut[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+//-------------------------------------------------------------------------------------------------
+// SongRenderer
+//-------------------------------------------------------------------------------------------------
+
+const size_t SongRenderer::SegmentSize;
+
+SongRenderer::SongRenderer(const Song& song, const RenderOptions& options)
+    : song_(song), options_(options) {
+}
+
+void SongRenderer::prepareTrack(size_t trackNo) {
+  const TempoMap& tempoMap = song_.tempoMap();
+  const NoteArray& notes = song_.track(static_cast<int>(trackNo))->events().notes();
+  TrackVoices& track = tracks_[trackNo];
+
+  auto usToSample = [this](uint64_t us) { return us * options_.sampleRate / 1000000; };
+
+  track.voices.reserve(notes.size());
+
+  for (size_t i = 0; i < notes.size(); ++i) {
+    const uint64_t firstSample = usToSample(tempoMap.tickToUs(notes.startTick(i)));
+    const uint64_t endSample = usToSample(tempoMap.tickToUs(notes.endTick(i)));
+
+    if (endSample <= firstSample)
+      continue;
+
+    const double frequency = 440.0 * pow(2.0, (notes.note(i) - 69) / 12.0);
+
+    track.voices.push_back({firstSample, endSample, frequency / options_.sampleRate});
+    track.maxLength = std::max(track.maxLength, endSample - firstSample);
+  }
+}
+
+void SongRenderer::renderSegment(uint64_t firstSample, size_t numSamples, std::vector<float>& mix,
+    int16_t* pOut) const {
+  const uint64_t endSample = firstSample + numSamples;
+
+  mix.assign(numSamples, 0.0f);
+
+  for (const TrackVoices& track : tracks_) {
+    // Voices are sorted by their first sample, none of them is longer than maxLength:
+    const uint64_t earliestStart = firstSample > track.maxLength ? firstSample - track.maxLength : 0;
+    auto startsBefore = [](const Voice& voice, uint64_t sample) { return voice.firstSample < sample; };
+    auto it = std::lower_bound(track.voices.begin(), track.voices.end(), earliestStart, startsBefore);
+
+    for (; it != track.voices.end() && it->firstSample < endSample; ++it) {
+      if (it->endSample <= firstSample)
+        continue;
+
+      const uint64_t from = std::max(firstSample, it->firstSample);
+      const uint64_t to = std::min(endSample, it->endSample);
+
+      // The phase is derived from the start of the voice, so it continues seamlessly across segments:
+      double phase = (from - it->firstSample) * it->phaseIncrement;
+      phase -= floor(phase);
+
+      addPulseWave(mix.data() + (from - firstSample), static_cast<size_t>(to - from), phase, it->phaseIncrement,
+          options_.dutyCycle, options_.voiceAmplitude);
+    }
+  }
+
+  convertToPcm(mix.data(), numSamples, pOut);
+}
+
+bool SongRenderer::renderToWav(const std::string& path, JobProgress* pProgress) {
+  // The tempo map is built lazily, so it must exist before any worker asks for it:
+  const TempoMap& tempoMap = song_.tempoMap();
+
+  ThreadPool pool(options_.numThreads);
+  tracks_.assign(song_.numberOfTracks(), TrackVoices());
+
+  for (size_t trackNo = 0; trackNo < tracks_.size(); ++trackNo)
+    pool.submit([this, trackNo]() { prepareTrack(trackNo); });
+
+  pool.wait();
+
+  numSamples_ = (tempoMap.tickToUs(song_.numTicks()) * options_.sampleRate + 999999) / 1000000;
+
+  if (pProgress)
+    pProgress->setTotal(numSamples_);
+
+  FILE* pFile = fopen(path.c_str(), "wb");
+
+  if (!pFile)
+    return false;
+
+  const uint32_t dataSize = static_cast<uint32_t>(std::min<uint64_t>(numSamples_ * 2, 0xFFFFFFFF - 36));
+  uint8_t header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0,
+      1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 16, 0, 'd', 'a', 't', 'a'};
+
+  putLittleEndian(header + 4, 36 + dataSize, 4);
+  putLittleEndian(header + 24, options_.sampleRate, 4);
+  putLittleEndian(header + 28, options_.sampleRate * 2, 4);
+  putLittleEndian(header + 40, dataSize, 4);
+
+  bool hasSucceeded = fwrite(header, 1, sizeof(header), pFile) == sizeof(header);
+
+  // Segments are rendered in batches, so memory use doesn't depend on the length of the song:
+  const size_t segmentsPerBatch = 4 * pool.numThreads();
+  const uint64_t numSegments = (numSamples_ + SegmentSize - 1) / SegmentSize;
+
+  std::vector<int16_t> samples(segmentsPerBatch * SegmentSize);
+  std::vector<std::vector<float>> mixBuffers(segmentsPerBatch);
+
+  for (uint64_t batchStart = 0; batchStart < numSegments && hasSucceeded; batchStart += segmentsPerBatch) {
+    if (pProgress && pProgress->isCanceled()) {
+      hasSucceeded = false;
+      break;
+    }
+
+    const size_t numBatchSegments = static_cast<size_t>(std::min<uint64_t>(segmentsPerBatch, numSegments - batchStart));
+    const uint64_t firstSample = batchStart * SegmentSize;
+    const size_t numBatchSamples = static_cast<size_t>(std::min<uint64_t>(numBatchSegments * SegmentSize,
+        numSamples_ - firstSample));
+
+    for (size_t segmentNo = 0; segmentNo < numBatchSegments; ++segmentNo) {
+      pool.submit([&, segmentNo]() {
+        const size_t offset = segmentNo * SegmentSize;
+        const size_t numSegmentSamples = std::min(SegmentSize, numBatchSamples - offset);
+
+        renderSegment(firstSample + offset, numSegmentSamples, mixBuffers[segmentNo], samples.data() + offset);
+      });
+    }
+
+    pool.wait();
+
+    // WAV samples are little endian, just like the supported platforms:
+    if (fwrite(samples.data(), sizeof(int16_t), numBatchSamples, pFile) != numBatchSamples)
+      hasSucceeded = false;
+
+    if (pProgress)
+      pProgress->advance(numBatchSamples);
+  }
+
+  if (fclose(pFile) != 0)
+    hasSucceeded = false;
+
+  if (!hasSucceeded)
+    remove(path.c_str());
+
+  return hasSucceeded;
+}
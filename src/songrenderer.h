@@ -0,0 +1,55 @@
+#ifndef _SONG_RENDERER_H
+#define _SONG_RENDERER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class JobProgress;
+class Song;
+
+//-------------------------------------------------------------------------------------------------
+// SongRenderer
+//-------------------------------------------------------------------------------------------------
+
+struct RenderOptions {
+  uint32_t sampleRate{44100};
+  float dutyCycle{0.5f};       // fraction of a period the pulse is high
+  float voiceAmplitude{0.25f}; // the mix is clipped, so many overlapping notes saturate
+  size_t numThreads{0};        // one per hardware thread if 0
+};
+
+// Renders a song into a mono 16 bit WAV file, which approximates the sound of floppy drives by a
+// pulse wave per note. The song is split into segments of a fixed number of samples, which are
+// synthesized in parallel and written in order.
+class SongRenderer {
+public:
+  SongRenderer(const Song& song, const RenderOptions& options = RenderOptions());
+
+  bool renderToWav(const std::string& path, JobProgress* pProgress = nullptr);
+  uint64_t numSamples() const                      { return numSamples_; }
+
+private:
+  static const size_t SegmentSize = 1 << 16;
+
+  struct Voice {
+    uint64_t firstSample;
+    uint64_t endSample;
+    double phaseIncrement;     // periods per sample
+  };
+
+  struct TrackVoices {
+    std::vector<Voice> voices; // sorted by first sample
+    uint64_t maxLength{0};
+  };
+
+  void prepareTrack(size_t trackNo);
+  void renderSegment(uint64_t firstSample, size_t numSamples, std::vector<float>& mix, int16_t* pOut) const;
+
+  const Song& song_;
+  const RenderOptions options_;
+  std::vector<TrackVoices> tracks_;
+  uint64_t numSamples_{0};
+};
+
+#endif // _SONG_RENDERER_H
@@ -0,0 +1,58 @@
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+//-------------------------------------------------------------------------------------------------
+// SpscQueue
+//-------------------------------------------------------------------------------------------------
+
+// Bounded, lock-free queue for exactly one producer and one consumer thread. Neither side ever
+// blocks or allocates, which makes it safe to poll from a real-time thread. 'Capacity' must be a
+// power of two, one slot is always kept free.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+  // Producer side, returns false if the queue is full:
+  bool push(const T& element) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t nextTail = (tail + 1) & (Capacity - 1);
+
+    if (nextTail == head_.load(std::memory_order_acquire))
+      return false;
+
+    elements_[tail] = element;
+    tail_.store(nextTail, std::memory_order_release);
+
+    return true;
+  }
+
+  // Consumer side, returns false if the queue is empty:
+  bool pop(T& element) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+
+    if (head == tail_.load(std::memory_order_acquire))
+      return false;
+
+    element = elements_[head];
+    head_.store((head + 1) & (Capacity - 1), std::memory_order_release);
+
+    return true;
+  }
+
+private:
+  T elements_[Capacity];
+
+  // Both indices are written by different threads, so they are kept on different cache lines. Padding
+  // is used instead of alignas(), which heap allocations before C++17 don't honor:
+  char padding0_[64];
+  std::atomic<size_t> head_{0};
+  char padding1_[64];
+  std::atomic<size_t> tail_{0};
+  char padding2_[64];
+};
+
+#endif // _SPSC_QUEUE_H
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <cmath>
+
+#include "tempomap.h"
+
+//-------------------------------------------------------------------------------------------------
+// TempoMap
+//-------------------------------------------------------------------------------------------------
+
+const uint32_t TempoMap::DefaultUsPerQuarterNote;
+
+void TempoMap::build(const SortedEventArray<SetTempoRecord>& tempoChanges, uint16_t tpqn) {
+  tpqn_ = tpqn ? tpqn : 1;
+
+  segments_.clear();
+  segments_.reserve(tempoChanges.size() + 1);
+  segments_.push_back({0, DefaultUsPerQuarterNote, 0});
+
+  for (const SetTempoRecord& setTempo : tempoChanges.records()) {
+    // A tempo of 0 would stop time, files carrying one get the shortest possible quarter note:
+    const uint32_t uspqn = std::max<uint32_t>(1, setTempo.usPerQuarterNote);
+    Segment& last = segments_.back();
+
+    // A tempo change on the same tick replaces the previous one, as no time passes in between:
+    if (setTempo.startTick == last.startTick) {
+      last.usPerQuarterNote = uspqn;
+      continue;
+    }
+
+    const uint64_t deltaTicks = setTempo.startTick - last.startTick;
+    const uint64_t startUsScaled = last.startUsScaled + deltaTicks * last.usPerQuarterNote;
+
+    segments_.push_back({setTempo.startTick, uspqn, startUsScaled});
+  }
+}
+
+const TempoMap::Segment& TempoMap::segmentAtTick(uint32_t tick) const {
+  auto tickLess = [](uint32_t tick, const Segment& segment) { return tick < segment.startTick; };
+
+  return *(std::upper_bound(segments_.begin(), segments_.end(), tick, tickLess) - 1);
+}
+
+uint64_t TempoMap::tickToUs(uint32_t tick) const {
+  const Segment& segment = segmentAtTick(tick);
+  const uint64_t deltaTicks = tick - segment.startTick;
+
+  return (segment.startUsScaled + deltaTicks * segment.usPerQuarterNote) / tpqn_;
+}
+
+uint32_t TempoMap::usToTick(uint64_t us) const {
+  const uint64_t usScaled = us * tpqn_;
+
+  auto usLess = [](uint64_t usScaled, const Segment& segment) { return usScaled < segment.startUsScaled; };
+  const Segment& segment = *(std::upper_bound(segments_.begin(), segments_.end(), usScaled, usLess) - 1);
+
+  const uint64_t tick = segment.startTick + (usScaled - segment.startUsScaled) / segment.usPerQuarterNote;
+
+  return static_cast<uint32_t>(std::min<uint64_t>(tick, UINT32_MAX));
+}
+
+uint32_t TempoMap::usPerQuarterNoteAt(uint32_t tick) const {
+  return segmentAtTick(tick).usPerQuarterNote;
+}
+
+float TempoMap::usPerQuarterNoteToBpm(uint32_t usPerQuarterNote) {
+  return 60000000.0f / std::max<uint32_t>(1, usPerQuarterNote);
+}
@@ -0,0 +1,43 @@
+#ifndef _TEMPO_MAP_H
+#define _TEMPO_MAP_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "eventstore.h"
+
+//-------------------------------------------------------------------------------------------------
+// TempoMap
+//-------------------------------------------------------------------------------------------------
+
+// Converts between ticks and microseconds. The song is split into segments of constant tempo and
+// the start time of every segment is precomputed, so a conversion is a binary search followed by
+// a single integer division.
+class TempoMap {
+public:
+  static const uint32_t DefaultUsPerQuarterNote = 500000; // 120 bpm
+
+  TempoMap()                                           { build(SortedEventArray<SetTempoRecord>(), 1); }
+
+  void build(const SortedEventArray<SetTempoRecord>& tempoChanges, uint16_t tpqn);
+  uint64_t tickToUs(uint32_t tick) const;
+  uint32_t usToTick(uint64_t us) const;
+  uint32_t usPerQuarterNoteAt(uint32_t tick) const;
+  size_t numSegments() const                           { return segments_.size(); }
+
+  static float usPerQuarterNoteToBpm(uint32_t usPerQuarterNote);
+
+private:
+  struct Segment {
+    uint32_t startTick;
+    uint32_t usPerQuarterNote;
+    uint64_t startUsScaled; // start time in microseconds multiplied by tpqn, so it stays exact
+  };
+
+  const Segment& segmentAtTick(uint32_t tick) const;
+
+  std::vector<Segment> segments_;
+  uint16_t tpqn_{1};
+};
+
+#endif // _TEMPO_MAP_H
@@ -0,0 +1,82 @@
+#include <stdio.h>
+
+#include "eventstore.h"
+
+static int numFailures = 0;
+
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      ++numFailures; \
+    } \
+  } while (0)
+
+//-------------------------------------------------------------------------------------------------
+// NoteArray selection
+//-------------------------------------------------------------------------------------------------
+
+static void testResizeSelectionWithZeroLengthBlock() {
+  NoteArray notes;
+  const EventHandle empty = notes.insert(0, 0, 60);
+  const EventHandle block = notes.insert(0, 96, 62);
+
+  notes.select(empty);
+  notes.select(block);
+
+  // Dragging the end only must neither move any start nor wrap the start of the empty block:
+  notes.resizeSelection(0, 48);
+
+  CHECK(notes.startTick(notes.index(empty)) == 0);
+  CHECK(notes.numTicks(notes.index(empty)) == 48);
+  CHECK(notes.startTick(notes.index(block)) == 0);
+  CHECK(notes.numTicks(notes.index(block)) == 144);
+
+  // Shrinking is clamped by the shortest block, which can't get shorter than it is:
+  notes.resizeSelection(0, -1000);
+
+  CHECK(notes.startTick(notes.index(empty)) == 0);
+  CHECK(notes.numTicks(notes.index(empty)) == 1);
+  CHECK(notes.numTicks(notes.index(block)) == 97);
+
+  notes.unselect(block);
+  notes.resizeSelection(-10, -1000);
+
+  CHECK(notes.startTick(notes.index(empty)) == 0);
+  CHECK(notes.numTicks(notes.index(empty)) == 1);
+}
+
+static void testMoveSelectionKeepsOrder() {
+  NoteArray notes;
+  const EventHandle a = notes.insert(0, 10, 60);
+  const EventHandle b = notes.insert(100, 10, 60);
+  const EventHandle c = notes.insert(200, 10, 60);
+
+  notes.select(a);
+  notes.moveSelection(150, 2);
+
+  CHECK(notes.index(b) == 0);
+  CHECK(notes.index(a) == 1);
+  CHECK(notes.index(c) == 2);
+  CHECK(notes.startTick(notes.index(a)) == 150);
+  CHECK(notes.note(notes.index(a)) == 62);
+
+  // Moves before tick 0 are clamped:
+  notes.moveSelection(-1000, 0);
+  CHECK(notes.startTick(notes.index(a)) == 0);
+  CHECK(notes.index(a) == 0);
+
+  notes.unselectAll();
+  CHECK(notes.selection().empty());
+  CHECK(!notes.isSelected(notes.index(a)));
+}
+
+int main() {
+  testResizeSelectionWithZeroLengthBlock();
+  testMoveSelectionKeepsOrder();
+
+  if (numFailures == 0)
+    printf("All event store tests passed.\n");
+
+  return numFailures == 0 ? 0 : 1;
+}
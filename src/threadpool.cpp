@@ -0,0 +1,117 @@
+#include <algorithm>
+
+#include "threadpool.h"
+
+// Identifies the pool and queue of the current thread, if it is a worker:
+static thread_local const ThreadPool* pCurrentPool = nullptr;
+static thread_local size_t currentWorkerNo = 0;
+
+//-------------------------------------------------------------------------------------------------
+// ThreadPool
+//-------------------------------------------------------------------------------------------------
+
+ThreadPool::ThreadPool(size_t numThreads) {
+  if (numThreads == 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (size_t workerNo = 0; workerNo < numThreads; ++workerNo)
+    queues_.push_back(std::unique_ptr<Queue>(new Queue));
+
+  for (size_t workerNo = 0; workerNo < numThreads; ++workerNo)
+    threads_.push_back(std::thread(&ThreadPool::run, this, workerNo));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    isStopping_ = true;
+  }
+
+  taskAvailable_.notify_all();
+
+  for (std::thread& thread : threads_)
+    thread.join();
+}
+
+void ThreadPool::submit(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t queueNo = pCurrentPool == this ? currentWorkerNo : nextQueueNo_++ % queues_.size();
+
+    // The task is counted before any worker can pop it, so the counters never drop below the
+    // number of tasks actually queued and pending. popTask() never holds both locks at once:
+    ++numQueued_;
+    ++numPending_;
+
+    Queue& queue = *queues_[queueNo];
+    std::lock_guard<std::mutex> queueLock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+
+  taskAvailable_.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  allDone_.wait(lock, [this]() { return numPending_ == 0; });
+}
+
+void ThreadPool::run(size_t workerNo) {
+  pCurrentPool = this;
+  currentWorkerNo = workerNo;
+
+  for (;;) {
+    Task task;
+
+    if (popTask(workerNo, task)) {
+      task();
+
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      if (--numPending_ == 0)
+        allDone_.notify_all();
+
+      continue;
+    }
+
+    // Tasks are counted and pushed under the same lock, so none can be queued unnoticed while sleeping:
+    std::unique_lock<std::mutex> lock(mutex_);
+    taskAvailable_.wait(lock, [this]() { return isStopping_ || numQueued_ > 0; });
+
+    if (isStopping_ && numQueued_ == 0)
+      return;
+  }
+}
+
+bool ThreadPool::popTask(size_t workerNo, Task& task) {
+  bool hasTask = false;
+
+  {
+    Queue& own = *queues_[workerNo];
+    std::lock_guard<std::mutex> lock(own.mutex);
+
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      hasTask = true;
+    }
+  }
+
+  for (size_t i = 1; i < queues_.size() && !hasTask; ++i) {
+    Queue& victim = *queues_[(workerNo + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      hasTask = true;
+    }
+  }
+
+  if (hasTask) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --numQueued_;
+  }
+
+  return hasTask;
+}
@@ -0,0 +1,58 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//-------------------------------------------------------------------------------------------------
+// ThreadPool
+//-------------------------------------------------------------------------------------------------
+
+// Fixed number of worker threads, each with its own task queue. A worker takes the newest task of
+// its own queue first and steals the oldest task of another queue once its own one runs dry, so
+// long and short tasks get balanced without a single contended queue.
+class ThreadPool {
+public:
+  using Task = std::function<void()>;
+
+  // Starts one worker per hardware thread if 'numThreads' is 0:
+  explicit ThreadPool(size_t numThreads = 0);
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator = (const ThreadPool&) = delete;
+  ~ThreadPool();
+
+  size_t numThreads() const                        { return threads_.size(); }
+
+  // Tasks submitted by a worker go to that worker's own queue, all others are spread round robin:
+  void submit(Task task);
+
+  // Blocks until all submitted tasks have finished. Must not be called by a worker:
+  void wait();
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void run(size_t workerNo);
+  bool popTask(size_t workerNo, Task& task);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  size_t nextQueueNo_{0};
+
+  std::mutex mutex_;
+  std::condition_variable taskAvailable_;
+  std::condition_variable allDone_;
+  size_t numQueued_{0};   // tasks waiting in any queue
+  size_t numPending_{0};  // tasks submitted but not finished yet
+  bool isStopping_{false};
+};
+
+#endif // _THREAD_POOL_H
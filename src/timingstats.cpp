@@ -0,0 +1,107 @@
+#include "timingstats.h"
+
+//-------------------------------------------------------------------------------------------------
+// SinkTimingTable
+//-------------------------------------------------------------------------------------------------
+
+void SinkTimingTable::update() {
+  const std::vector<std::unique_ptr<SinkTiming>>& sinkTimings = pPlaybackEngine_->sinkTimings();
+  rows_.resize(sinkTimings.size());
+
+  for (size_t i = 0; i < sinkTimings.size(); ++i) {
+    rows_[i].pTiming = sinkTimings[i].get();
+    rows_[i].lateness = sinkTimings[i]->lateness.stats();
+    rows_[i].sendDuration = sinkTimings[i]->sendDuration.stats();
+  }
+}
+
+wxString SinkTimingTable::GetValue(int row, int col) {
+  if (row < 0 || row >= GetNumberRows())
+    return "";
+
+  const Row& r = rows_[row];
+
+  switch (col) {
+    case Sink:        return r.pTiming->sinkName;
+    case Messages:    return wxString::Format("%llu", static_cast<unsigned long long>(r.lateness.count));
+    case LatenessP50: return wxString::Format("%llu", static_cast<unsigned long long>(r.lateness.p50Us));
+    case LatenessP99: return wxString::Format("%llu", static_cast<unsigned long long>(r.lateness.p99Us));
+    case LatenessMax: return wxString::Format("%llu", static_cast<unsigned long long>(r.lateness.maxUs));
+    case SendP50:     return wxString::Format("%llu", static_cast<unsigned long long>(r.sendDuration.p50Us));
+    case SendP99:     return wxString::Format("%llu", static_cast<unsigned long long>(r.sendDuration.p99Us));
+    case SendMax:     return wxString::Format("%llu", static_cast<unsigned long long>(r.sendDuration.maxUs));
+    default:          return "";
+  }
+}
+
+wxString SinkTimingTable::GetColLabelValue(int col) {
+  switch (col) {
+    case Sink:        return "Sink";
+    case Messages:    return "Messages";
+    case LatenessP50: return "Late p50";
+    case LatenessP99: return "Late p99";
+    case LatenessMax: return "Late max";
+    case SendP50:     return "Send p50";
+    case SendP99:     return "Send p99";
+    case SendMax:     return "Send max";
+    default:          return "";
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+// TimingStatsDialog
+//-------------------------------------------------------------------------------------------------
+
+TimingStatsDialog::TimingStatsDialog(wxWindow* pParent, PlaybackEngine* pPlaybackEngine)
+    : wxDialog(pParent, wxID_ANY, "Playback Timing (us)", wxDefaultPosition, wxSize(720, 200),
+          wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER),
+      refreshTimer_(this, RefreshTimerId), pPlaybackEngine_(pPlaybackEngine) {
+
+  pTable_ = new SinkTimingTable(pPlaybackEngine_);
+
+  pGrid_ = new wxGrid(this, wxID_ANY, wxDefaultPosition, wxDefaultSize);
+  pGrid_->SetTable(pTable_, true);
+  pGrid_->HideRowLabels();
+  pGrid_->SetSelectionMode(wxGrid::wxGridSelectionModes::wxGridSelectNone);
+  pGrid_->EnableEditing(false);
+  pGrid_->SetDefaultCellAlignment(wxALIGN_RIGHT, wxALIGN_TOP);
+  pGrid_->SetColLabelSize(pGrid_->GetCharHeight() + 4);
+
+  wxButton* pReset = new wxButton(this, ResetId, "&Reset");
+  wxButton* pClose = new wxButton(this, wxID_CLOSE, "&Close");
+
+  wxSizer* pButtonSizer = new wxBoxSizer(wxHORIZONTAL);
+  pButtonSizer->AddStretchSpacer();
+  pButtonSizer->Add(pReset);
+  pButtonSizer->Add(pClose);
+
+  wxSizer* pTopSizer = new wxBoxSizer(wxVERTICAL);
+  pTopSizer->Add(pGrid_, 1, wxEXPAND);
+  pTopSizer->Add(pButtonSizer, 0, wxEXPAND);
+
+  SetSizer(pTopSizer);
+
+  // Sinks can't change while the dialog is open, so the rows stay the same and only their values
+  // get refreshed:
+  refreshTimer_.Start(250);
+}
+
+void TimingStatsDialog::OnRefreshTimer(wxTimerEvent& event) {
+  pTable_->update();
+  pGrid_->ForceRefresh();
+}
+
+void TimingStatsDialog::OnReset(wxCommandEvent& event) {
+  pPlaybackEngine_->resetSinkTimings();
+}
+
+void TimingStatsDialog::OnClose(wxCommandEvent& event) {
+  refreshTimer_.Stop();
+  EndModal(wxID_CLOSE);
+}
+
+wxBEGIN_EVENT_TABLE(TimingStatsDialog, wxDialog)
+EVT_TIMER(RefreshTimerId, TimingStatsDialog::OnRefreshTimer)
+EVT_BUTTON(ResetId, TimingStatsDialog::OnReset)
+EVT_BUTTON(wxID_CLOSE, TimingStatsDialog::OnClose)
+wxEND_EVENT_TABLE()
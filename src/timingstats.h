@@ -0,0 +1,78 @@
+#ifndef _TIMING_STATS_H
+#define _TIMING_STATS_H
+
+#include <vector>
+
+#include <wx/wx.h>
+#include <wx/grid.h>
+
+#include "playbackengine.h"
+
+//-------------------------------------------------------------------------------------------------
+// SinkTimingTable
+//-------------------------------------------------------------------------------------------------
+
+// Read only grid model with one row per sink. Cells are formatted from a snapshot of the
+// histograms, which is only taken on update(), so painting never scans any histogram.
+class SinkTimingTable : public wxGridTableBase {
+public:
+  enum Column {
+    Sink,
+    Messages,
+    LatenessP50,
+    LatenessP99,
+    LatenessMax,
+    SendP50,
+    SendP99,
+    SendMax,
+    NumColumns
+  };
+
+  SinkTimingTable(const PlaybackEngine* pPlaybackEngine) : pPlaybackEngine_(pPlaybackEngine) { update(); }
+
+  void update();
+
+  int GetNumberRows() override                           { return static_cast<int>(rows_.size()); }
+  int GetNumberCols() override                           { return NumColumns; }
+  wxString GetValue(int row, int col) override;
+  void SetValue(int row, int col, const wxString& value) override {}
+  wxString GetColLabelValue(int col) override;
+
+private:
+  struct Row {
+    const SinkTiming* pTiming;
+    LatencyStats lateness;
+    LatencyStats sendDuration;
+  };
+
+  const PlaybackEngine* const pPlaybackEngine_;
+  std::vector<Row> rows_;
+};
+
+//-------------------------------------------------------------------------------------------------
+// TimingStatsDialog
+//-------------------------------------------------------------------------------------------------
+
+// Shows how far messages have been sent behind their schedule and how long every sink took to
+// take them, while the song keeps playing. All times are in microseconds.
+class TimingStatsDialog : public wxDialog {
+public:
+  TimingStatsDialog(wxWindow* pParent, PlaybackEngine* pPlaybackEngine);
+
+private:
+  static const int RefreshTimerId = wxID_HIGHEST + 15;
+  static const int ResetId = wxID_HIGHEST + 16;
+
+  void OnRefreshTimer(wxTimerEvent& event);
+  void OnReset(wxCommandEvent& event);
+  void OnClose(wxCommandEvent& event);
+
+  wxGrid* pGrid_{nullptr};
+  SinkTimingTable* pTable_{nullptr};
+  wxTimer refreshTimer_;
+  PlaybackEngine* const pPlaybackEngine_;
+
+  wxDECLARE_EVENT_TABLE();
+};
+
+#endif // _TIMING_STATS_H
@@ -1,23 +1,75 @@
+#include <algorithm>
+#include <limits>
+
 #include "trackeditor.h"
+#include "redrawscheduler.h"
+
+//-------------------------------------------------------------------------------------------------
+// TrackListTable
+//-------------------------------------------------------------------------------------------------
+
+wxString TrackListTable::GetValue(int row, int col) {
+  if (row < 0 || row >= GetNumberRows())
+    return "";
+
+  const ChannelTrack* pTrack = pSong_->track(row);
+
+  switch (col) {
+    case Selected:
+      return row == pSong_->currentSelectedTrackNo() ? "X" : "";
+
+    case Name:
+      return pTrack->name();
+
+    case Channel:
+      return wxString::Format("%d", pTrack->midiChannel() + 1);
+
+    case Duration: {
+      const uint64_t us = pTrack->durationUs();
+      const uint32_t m  = (us / 60) / 1000000;
+      const uint32_t s  = us / 1000000 - m * 60;
+      const uint32_t roundedMs = (us - m * 60 * 1000000 - s * 1000000 + 500) / 1000;
+
+      return wxString::Format("%02d:%02d:%03d", m, s, roundedMs);
+    }
+
+    default:
+      return "";
+  }
+}
+
+wxString TrackListTable::GetColLabelValue(int col) {
+  switch (col) {
+    case Selected: return "Selected";
+    case Name:     return "Track Name";
+    case Channel:  return "Channel";
+    case Duration: return "Duration";
+    case Preview:  return "Track Preview";
+    default:       return "";
+  }
+}
 
 //-------------------------------------------------------------------------------------------------
 // TrackEditorWindow
 //-------------------------------------------------------------------------------------------------
 
 TrackEditorWindow::TrackEditorWindow(wxWindow* pParent, Song* pSong)
-    : wxWindow(pParent, wxID_ANY, wxDefaultPosition, wxDefaultSize), pSong_(pSong) {
+    : wxWindow(pParent, wxID_ANY, wxDefaultPosition, wxDefaultSize), pSong_(pSong),
+      previewCache_(this, pSong, [this](int row) { refreshCells(row, TrackListTable::Preview, TrackListTable::Preview); }) {
+
+  pTrackListTable_ = new TrackListTable(pSong_);
 
   pTrackListGrid_ = new wxGrid(this, wxID_ANY, wxDefaultPosition, wxDefaultSize);
-  pTrackListGrid_->CreateGrid(pSong_->numberOfTracks(), 5);
+  pTrackListGrid_->SetTable(pTrackListTable_, true);
   pTrackListGrid_->HideRowLabels();
   pTrackListGrid_->ShowScrollbars(wxSHOW_SB_NEVER, wxSHOW_SB_NEVER);
   pTrackListGrid_->SetSelectionMode(wxGrid::wxGridSelectionModes::wxGridSelectNone);
+  pTrackListGrid_->EnableEditing(false);
+  pTrackListGrid_->SetDefaultCellAlignment(wxALIGN_CENTER, wxALIGN_TOP);
 
-  pTrackListGrid_->SetColLabelValue(0, "Selected");
-  pTrackListGrid_->SetColLabelValue(1, "Track Name");
-  pTrackListGrid_->SetColLabelValue(2, "Channel");
-  pTrackListGrid_->SetColLabelValue(3, "Duration");
-  pTrackListGrid_->SetColLabelValue(4, "Track Preview");
+  wxGridCellAttr* pPreviewAttr = new wxGridCellAttr;
+  pPreviewAttr->SetRenderer(new TrackPreviewRenderer(&previewCache_));
+  pTrackListGrid_->SetColAttr(TrackListTable::Preview, pPreviewAttr);
 
   pTrackListGrid_->SetColLabelSize(pTrackListGrid_->GetCharHeight() + 4);
   pTrackListGrid_->Bind(wxEVT_GRID_CELL_LEFT_DCLICK, &TrackEditorWindow::OnTrackListGridDoubleClick, this);
@@ -31,34 +83,74 @@ TrackEditorWindow::TrackEditorWindow(wxWindow* pParent, Song* pSong)
 }
 
 void TrackEditorWindow::updateTrackList() {
-  if (pTrackListGrid_->GetNumberRows())
-    pTrackListGrid_-> DeleteRows(0, pTrackListGrid_->GetNumberRows());
-
-  for (int trackNo = 0; trackNo < pSong_->numberOfTracks(); ++trackNo) {
-    pTrackListGrid_->AppendRows(1);
-    pTrackListGrid_->SetCellValue(trackNo, 0, trackNo == pSong_->currentSelectedTrackNo() ? "X" : "");
-    pTrackListGrid_->SetCellValue(trackNo, 1, pSong_->track(trackNo)->name());
-    pTrackListGrid_->SetCellValue(trackNo, 2, wxString::Format("%d", pSong_->track(trackNo)->midiChannel() + 1));
-
-    const uint64_t us = pSong_->track(trackNo)->durationUs();
-    const uint32_t m  = (us / 60) / 1000000;
-    const uint32_t s  = us / 1000000 - m * 60;
-    const uint32_t roundedMs = (us - m * 60 * 1000000 - s * 1000000 + 500) / 1000;
-
-    pTrackListGrid_->SetCellValue(trackNo, 3, wxString::Format("%02d:%02d:%03d", m, s, roundedMs));
-
-    for (int row = 0; row < pTrackListGrid_->GetNumberRows(); ++row) {
-      for (int col = 0; col < pTrackListGrid_->GetNumberCols(); ++col) {
-        pTrackListGrid_->SetReadOnly(row, col);
-        pTrackListGrid_->SetCellAlignment(row, col, wxALIGN_CENTER, 0);
-      }
+  syncRowCount();
+
+  // Only rows whose track or tempo map changed since the last update show different values:
+  for (int row = 0; row < static_cast<int>(rowRevisions_.size()); ++row) {
+    const uint64_t revision = rowRevision(row);
+
+    if (rowRevisions_[row] != revision) {
+      rowRevisions_[row] = revision;
+      refreshCells(row, TrackListTable::Selected, TrackListTable::NumColumns - 1);
     }
   }
 
-  GetParent()->Layout();
+  const int selectedRow = pSong_->currentSelectedTrackNo();
+
+  if (selectedRow != selectedRow_) {
+    refreshCells(selectedRow_, TrackListTable::Selected, TrackListTable::Selected);
+    refreshCells(selectedRow, TrackListTable::Selected, TrackListTable::Selected);
+    selectedRow_ = selectedRow;
+  }
+
+  // All previews share the length of the song as their horizontal scale:
+  if (pSong_->numTicks() != songTicks_) {
+    songTicks_ = pSong_->numTicks();
+
+    for (int row = 0; row < static_cast<int>(rowRevisions_.size()); ++row)
+      refreshCells(row, TrackListTable::Preview, TrackListTable::Preview);
+  }
+
   adjustTrackPreviewSize();
 }
 
+uint64_t TrackEditorWindow::rowRevision(int row) const {
+  return std::max(pSong_->track(row)->revision(), pSong_->tempoRevision());
+}
+
+void TrackEditorWindow::syncRowCount() {
+  const int numRows = pTrackListTable_->GetNumberRows();
+  const int numGridRows = pTrackListGrid_->GetNumberRows();
+
+  if (numRows == numGridRows)
+    return;
+
+  if (numRows > numGridRows) {
+    wxGridTableMessage msg(pTrackListTable_, wxGRIDTABLE_NOTIFY_ROWS_APPENDED, numRows - numGridRows);
+    pTrackListGrid_->ProcessTableMessage(msg);
+  }
+  else {
+    wxGridTableMessage msg(pTrackListTable_, wxGRIDTABLE_NOTIFY_ROWS_DELETED, numRows, numGridRows - numRows);
+    pTrackListGrid_->ProcessTableMessage(msg);
+  }
+
+  // Rows which have just been added always get refreshed once:
+  rowRevisions_.resize(numRows, std::numeric_limits<uint64_t>::max());
+
+  // The height of the track list depends on the number of rows:
+  GetParent()->Layout();
+}
+
+void TrackEditorWindow::refreshCells(int row, int firstCol, int lastCol) {
+  if (row < 0 || row >= pTrackListGrid_->GetNumberRows())
+    return;
+
+  const wxRect rect = pTrackListGrid_->BlockToDeviceRect(wxGridCellCoords(row, firstCol),
+      wxGridCellCoords(row, lastCol));
+
+  pTrackListGrid_->GetGridWindow()->RefreshRect(rect, false);
+}
+
 void TrackEditorWindow::adjustTrackPreviewSize() {
   const int numCols = pTrackListGrid_->GetNumberCols();
   int start = 0;
@@ -70,16 +162,16 @@ void TrackEditorWindow::adjustTrackPreviewSize() {
       const int size = GetParent()->GetSize().GetWidth();
       const int width = size - start - 20;
 
-      if (width > 0)
+      if (width > 0 && width != pTrackListGrid_->GetColSize(i))
         pTrackListGrid_->SetColSize(i, width);
     }
   }
 }
 
 void TrackEditorWindow::OnTrackListGridDoubleClick(wxGridEvent& event) {
-  if (event.GetCol() == 0) {
+  if (event.GetCol() == TrackListTable::Selected) {
     pSong_->setCurrentSelectedTrack(event.GetRow());
-    pSong_->requestGlobalRedraw(); // TODO: fix rendering so this works via 'GetParent()->Refresh()' instead
+    RedrawScheduler::request(this, RedrawScheduler::All);
   }
 }
 
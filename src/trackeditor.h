@@ -1,10 +1,42 @@
 #ifndef _TRACKEDITOR
 #define _TRACKEDITOR
 
+#include <vector>
+
 #include <wx/wx.h>
 #include <wx/grid.h>
 
 #include "song.h"
+#include "trackpreview.h"
+
+//-------------------------------------------------------------------------------------------------
+// TrackListTable
+//-------------------------------------------------------------------------------------------------
+
+// Read only grid model, which formats the cells directly from the song when they get painted.
+class TrackListTable : public wxGridTableBase {
+public:
+  enum Column {
+    Selected,
+    Name,
+    Channel,
+    Duration,
+    Preview,
+    NumColumns
+  };
+
+  TrackListTable(const Song* pSong) : pSong_(pSong) {}
+
+  int GetNumberRows() override                           { return static_cast<int>(pSong_->numberOfTracks()); }
+  int GetNumberCols() override                           { return NumColumns; }
+  bool IsEmptyCell(int row, int col) override            { return col == Preview; }
+  wxString GetValue(int row, int col) override;
+  void SetValue(int row, int col, const wxString& value) override {}
+  wxString GetColLabelValue(int col) override;
+
+private:
+  const Song* const pSong_;
+};
 
 //-------------------------------------------------------------------------------------------------
 // TrackEditorWindow
@@ -19,8 +51,18 @@ public:
 private:
   wxSizer* pTopSizer_{nullptr};
   wxGrid* pTrackListGrid_{nullptr};
+  TrackListTable* pTrackListTable_{nullptr};
   Song* const pSong_;
+  TrackPreviewCache previewCache_;
+
+  // State of the song the grid has last been refreshed for:
+  std::vector<uint64_t> rowRevisions_;
+  int selectedRow_{-1};
+  uint32_t songTicks_{0};
 
+  uint64_t rowRevision(int row) const;
+  void syncRowCount();
+  void refreshCells(int row, int firstCol, int lastCol);
   void adjustTrackPreviewSize();
   void OnTrackListGridDoubleClick(wxGridEvent& event);
 
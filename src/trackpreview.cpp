@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "trackpreview.h"
+
+//-------------------------------------------------------------------------------------------------
+// TrackPreviewCache
+//-------------------------------------------------------------------------------------------------
+
+bool TrackPreviewCache::Key::operator == (const Key& rhs) const {
+  return revision == rhs.revision && songTicks == rhs.songTicks && width == rhs.width && height == rhs.height;
+}
+
+TrackPreviewCache::TrackPreviewCache(wxEvtHandler* pOwner, const Song* pSong, ReadyCallback readyCallback)
+    : pOwner_(pOwner), pSong_(pSong), readyCallback_(readyCallback) {
+
+  worker_ = std::thread(&TrackPreviewCache::workerLoop, this);
+}
+
+TrackPreviewCache::~TrackPreviewCache() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    isStopping_ = true;
+    jobs_.clear();
+  }
+
+  jobAvailable_.notify_one();
+  worker_.join();
+}
+
+const wxBitmap* TrackPreviewCache::preview(int trackNo, const wxSize& size) {
+  if (trackNo < 0 || trackNo >= static_cast<int>(pSong_->numberOfTracks()) || size.GetWidth() <= 0 ||
+      size.GetHeight() <= 0)
+    return nullptr;
+
+  // Previews must not pull tracks out of a project file, they show up once a track got loaded:
+  if (!pSong_->track(trackNo)->isLoaded())
+    return nullptr;
+
+  if (trackNo >= static_cast<int>(entries_.size()))
+    entries_.resize(trackNo + 1);
+
+  Entry& entry = entries_[trackNo];
+
+  Key key;
+  key.revision = pSong_->track(trackNo)->revision();
+  key.songTicks = pSong_->numTicks();
+  key.width = size.GetWidth();
+  key.height = size.GetHeight();
+
+  if (entry.key != key && !(entry.isPending && entry.pendingKey == key)) {
+    schedule(trackNo, key);
+    entry.pendingKey = key;
+    entry.isPending = true;
+  }
+
+  if (!entry.bitmap.IsOk() || entry.key.width != key.width || entry.key.height != key.height)
+    return nullptr;
+
+  return &entry.bitmap;
+}
+
+void TrackPreviewCache::schedule(int trackNo, const Key& key) {
+  // The snapshot is taken on the UI thread, so the worker never touches the song:
+  const NoteArray& notes = pSong_->track(trackNo)->events().notes();
+
+  Job job;
+  job.trackNo = trackNo;
+  job.key = key;
+  job.startTicks = notes.startTicks();
+  job.numTicks = notes.numTicks();
+  job.notes = notes.notes();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // A queued job of the same track is outdated by now:
+    auto sameTrack = [trackNo](const Job& queued) { return queued.trackNo == trackNo; };
+    jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(), sameTrack), jobs_.end());
+    jobs_.push_back(std::move(job));
+  }
+
+  jobAvailable_.notify_one();
+}
+
+void TrackPreviewCache::workerLoop() {
+  for (;;) {
+    Job job;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      jobAvailable_.wait(lock, [this]() { return isStopping_ || !jobs_.empty(); });
+
+      if (isStopping_)
+        return;
+
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+
+    auto pResult = std::make_shared<Result>();
+    pResult->trackNo = job.trackNo;
+    pResult->key = job.key;
+    renderDensityMap(job, pResult->pixels);
+
+    // Bitmaps may only be created on the UI thread:
+    pOwner_->CallAfter([this, pResult]() { onResult(*pResult); });
+  }
+}
+
+void TrackPreviewCache::onResult(const Result& result) {
+  if (result.trackNo >= static_cast<int>(entries_.size()))
+    return;
+
+  Entry& entry = entries_[result.trackNo];
+
+  // Drop results which have been superseded while they were computed:
+  if (!entry.isPending || entry.pendingKey != result.key)
+    return;
+
+  // wxImage takes ownership of malloc'ed pixel data:
+  unsigned char* pPixels = static_cast<unsigned char*>(malloc(result.pixels.size()));
+  std::copy(result.pixels.begin(), result.pixels.end(), pPixels);
+
+  entry.bitmap = wxBitmap(wxImage(result.key.width, result.key.height, pPixels));
+  entry.key = result.key;
+  entry.isPending = false;
+
+  readyCallback_(result.trackNo);
+}
+
+void TrackPreviewCache::renderDensityMap(const Job& job, std::vector<unsigned char>& pixels) {
+  const int width = job.key.width;
+  const int height = job.key.height;
+
+  pixels.assign(static_cast<size_t>(width) * height * 3, 255);
+
+  if (job.notes.empty() || job.key.songTicks == 0)
+    return;
+
+  // Rows span the note range of the track, but at least an octave, so single notes don't fill the cell:
+  const uint8_t lowestNote = *std::min_element(job.notes.begin(), job.notes.end());
+  const uint8_t highestNote = *std::max_element(job.notes.begin(), job.notes.end());
+  const int numNotes = std::max(highestNote - lowestNote + 1, 12);
+  const int firstNote = std::max(0, std::min(lowestNote - (numNotes - (highestNote - lowestNote + 1)) / 2,
+      128 - numNotes));
+
+  // Per row difference arrays, which become the occupancy histogram after a prefix sum:
+  std::vector<int> occupancy(static_cast<size_t>(width + 1) * height, 0);
+  const uint64_t songTicks = job.key.songTicks;
+
+  for (size_t i = 0; i < job.notes.size(); ++i) {
+    const int row = height - 1 - ((job.notes[i] - firstNote) * height) / numNotes;
+    const uint64_t endTick = static_cast<uint64_t>(job.startTicks[i]) + job.numTicks[i];
+
+    const int x0 = static_cast<int>(std::min<uint64_t>((job.startTicks[i] * width) / songTicks, width - 1));
+    const int x1 = static_cast<int>(std::min<uint64_t>((endTick * width) / songTicks, width - 1));
+
+    int* pRow = &occupancy[static_cast<size_t>(row) * (width + 1)];
+    ++pRow[x0];
+    --pRow[x1 + 1];
+  }
+
+  // Blend from the cell background to the note block colour of the key editor:
+  const int maxLevel = 4;
+  const unsigned char noteColour[3] = {0, 160, 0};
+
+  for (int y = 0; y < height; ++y) {
+    const int* pRow = &occupancy[static_cast<size_t>(y) * (width + 1)];
+    unsigned char* pPixel = &pixels[static_cast<size_t>(y) * width * 3];
+    int count = 0;
+
+    for (int x = 0; x < width; ++x, pPixel += 3) {
+      count += pRow[x];
+
+      if (count <= 0)
+        continue;
+
+      const int level = std::min(count, maxLevel);
+
+      for (int c = 0; c < 3; ++c)
+        pPixel[c] = static_cast<unsigned char>(255 - ((255 - noteColour[c]) * level) / maxLevel);
+    }
+  }
+}
+
+//-------------------------------------------------------------------------------------------------
+// TrackPreviewRenderer
+//-------------------------------------------------------------------------------------------------
+
+void TrackPreviewRenderer::Draw(wxGrid& grid, wxGridCellAttr& attr, wxDC& dc, const wxRect& rect, int row,
+    int col, bool isSelected) {
+
+  // Clears the cell background:
+  wxGridCellRenderer::Draw(grid, attr, dc, rect, row, col, isSelected);
+
+  const wxRect previewRect = rect.Deflate(2);
+  const wxBitmap* pPreview = pCache_->preview(row, previewRect.GetSize());
+
+  if (pPreview)
+    dc.DrawBitmap(*pPreview, previewRect.GetX(), previewRect.GetY());
+}
+
+wxSize TrackPreviewRenderer::GetBestSize(wxGrid& grid, wxGridCellAttr& attr, wxDC& dc, int row, int col) {
+  // The preview adapts to whatever size the column has been stretched to:
+  return wxSize(0, 0);
+}
@@ -0,0 +1,103 @@
+#ifndef _TRACK_PREVIEW_H
+#define _TRACK_PREVIEW_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <wx/wx.h>
+#include <wx/grid.h>
+
+#include "song.h"
+
+//-------------------------------------------------------------------------------------------------
+// TrackPreviewCache
+//-------------------------------------------------------------------------------------------------
+
+// Miniature piano roll density maps of all tracks of a song. Maps are computed on a background
+// worker from a snapshot of the note blocks and cached per track revision, so painting a preview
+// on the UI thread is a lookup and a blit.
+class TrackPreviewCache {
+public:
+  using ReadyCallback = std::function<void(int trackNo)>;
+
+  TrackPreviewCache(wxEvtHandler* pOwner, const Song* pSong, ReadyCallback readyCallback);
+  ~TrackPreviewCache();
+
+  // Returns the preview of a track or nullptr, if none has been computed yet. A preview which is
+  // outdated but has the requested size is returned until its replacement is ready. Must only be
+  // called from the UI thread.
+  const wxBitmap* preview(int trackNo, const wxSize& size);
+
+private:
+  struct Key {
+    bool operator == (const Key& rhs) const;
+    bool operator != (const Key& rhs) const { return !(*this == rhs); }
+
+    uint64_t revision{0};
+    uint32_t songTicks{0};
+    int width{0};
+    int height{0};
+  };
+
+  struct Entry {
+    Key key;
+    Key pendingKey;
+    bool isPending{false};
+    wxBitmap bitmap;
+  };
+
+  struct Job {
+    int trackNo;
+    Key key;
+    std::vector<uint32_t> startTicks;
+    std::vector<uint32_t> numTicks;
+    std::vector<uint8_t> notes;
+  };
+
+  struct Result {
+    int trackNo;
+    Key key;
+    std::vector<unsigned char> pixels; // RGB
+  };
+
+  void schedule(int trackNo, const Key& key);
+  void workerLoop();
+  void onResult(const Result& result);
+  static void renderDensityMap(const Job& job, std::vector<unsigned char>& pixels);
+
+  wxEvtHandler* const pOwner_;
+  const Song* const pSong_;
+  ReadyCallback readyCallback_;
+  std::vector<Entry> entries_;
+
+  // Shared with the worker:
+  std::mutex mutex_;
+  std::condition_variable jobAvailable_;
+  std::deque<Job> jobs_;
+  bool isStopping_{false};
+  std::thread worker_;
+};
+
+//-------------------------------------------------------------------------------------------------
+// TrackPreviewRenderer
+//-------------------------------------------------------------------------------------------------
+
+class TrackPreviewRenderer : public wxGridCellRenderer {
+public:
+  TrackPreviewRenderer(TrackPreviewCache* pCache) : pCache_(pCache) {}
+
+  void Draw(wxGrid& grid, wxGridCellAttr& attr, wxDC& dc, const wxRect& rect, int row, int col,
+      bool isSelected) override;
+  wxSize GetBestSize(wxGrid& grid, wxGridCellAttr& attr, wxDC& dc, int row, int col) override;
+  wxGridCellRenderer* Clone() const override  { return new TrackPreviewRenderer(pCache_); }
+
+private:
+  TrackPreviewCache* const pCache_;
+};
+
+#endif // _TRACK_PREVIEW_H
@@ -1,47 +1,149 @@
 #include "transport.h"
 
+static wxString formatTime(uint64_t us, const char* pColour = "lime") {
+  uint32_t m  = (us / 60) / 1000000;
+  uint32_t s  = us        / 1000000 - m * 60;
+  uint32_t roundedMs = (us - m * 60 * 1000000 - s * 1000000 + 500) / 1000;
+
+  return wxString::Format(
+      "<span background='black' foreground='%s' size='%d'>%02d:%02d:%03d</span>", pColour, 30 * 1024, m, s, roundedMs);
+}
+
 //-------------------------------------------------------------------------------------------------
 // TransportWindow
 //-------------------------------------------------------------------------------------------------
 
-TransportWindow::TransportWindow(wxWindow* pParent, Song* pSong)
-    : wxWindow(pParent, wxID_ANY, wxDefaultPosition, wxDefaultSize), pSong_(pSong) {
-
-  wxButton* pRewind = new wxButton(this, wxID_ANY, "<<");
-  wxButton* pStop = new wxButton(this, wxID_ANY, "[ ]");
-  wxButton* pPlay = new wxButton(this, wxID_ANY, ">");
+TransportWindow::TransportWindow(wxWindow* pParent, Song* pSong, PlaybackEngine* pPlaybackEngine)
+    : wxWindow(pParent, wxID_ANY, wxDefaultPosition, wxDefaultSize), positionTimer_(this, PositionTimerId),
+      pSong_(pSong), pPlaybackEngine_(pPlaybackEngine) {
 
-  pRewind->Disable();
-  pStop->Disable();
-  pPlay->Disable();
+  wxButton* pRewind = new wxButton(this, RewindId, "<<");
+  wxButton* pStop = new wxButton(this, StopId, "[ ]");
+  wxButton* pPlay = new wxButton(this, PlayId, ">");
 
   wxSizer* pButtonSizer = new wxBoxSizer(wxHORIZONTAL);
   pButtonSizer->Add(pRewind);
   pButtonSizer->Add(pStop);
   pButtonSizer->Add(pPlay);
 
+  wxWindow* pPositionContainer = new wxWindow(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxBORDER_SUNKEN);
+  pPosition_ = new wxStaticText(pPositionContainer, wxID_ANY, "Undefined");
+
   wxWindow* pTxtContainer = new wxWindow(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxBORDER_SUNKEN);
   pTotalTime_ = new wxStaticText(pTxtContainer, wxID_ANY, "Undefined");
 
-  wxSizer* pTimeSizer = new wxBoxSizer(wxVERTICAL);
-  pTimeSizer->Add(pTxtContainer, wxSizerFlags().Right());
+  wxWindow* pDriveTimeContainer = new wxWindow(this, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxBORDER_SUNKEN);
+  pDriveTime_ = new wxStaticText(pDriveTimeContainer, wxID_ANY, "Undefined");
+  pDriveTime_->SetToolTip("Time on the drives, known once the song has been played");
+
+  wxSizer* pTimeSizer = new wxBoxSizer(wxHORIZONTAL);
+  pTimeSizer->Add(pPositionContainer);
+  pTimeSizer->Add(pTxtContainer);
+  pTimeSizer->Add(pDriveTimeContainer);
 
   pTopSizer_ = new wxBoxSizer(wxHORIZONTAL);
   pTopSizer_->Add(pButtonSizer, 0, wxALIGN_BOTTOM);
-  pTopSizer_->Add(pTimeSizer, 1, wxALIGN_CENTER);
+  pTopSizer_->AddStretchSpacer();
+  pTopSizer_->Add(pTimeSizer, 0, wxALIGN_CENTER);
 
   SetSizer(pTopSizer_);
 
   update();
+  updatePosition();
 }
 
 void TransportWindow::update() {
-  uint64_t us = pSong_->durationUs();
+  pTotalTime_->SetLabelMarkup(formatTime(pSong_->durationUs()));
+  updateDriveTime();
+}
 
-  uint32_t m  = (us / 60) / 1000000;
-  uint32_t s  = us        / 1000000 - m * 60;
-  uint32_t roundedMs = (us - m * 60 * 1000000 - s * 1000000 + 500) / 1000;
+void TransportWindow::setVoiceAllocation(const VoiceAllocationOptions* pOptions, bool hasPoolPerTrack) {
+  pAllocationOptions_.reset(pOptions ? new VoiceAllocationOptions(*pOptions) : nullptr);
+  hasPoolPerTrack_ = hasPoolPerTrack;
+  isScheduleOutdated_ = true;
+  updateDriveTime();
+}
+
+void TransportWindow::OnRewind(wxCommandEvent& event) {
+  pPlaybackEngine_->seek(0);
+  positionTimer_.Start(50);
+}
+
+void TransportWindow::OnStop(wxCommandEvent& event) {
+  pPlaybackEngine_->stop();
+  positionTimer_.Start(50);
+}
+
+void TransportWindow::OnPlay(wxCommandEvent& event) {
+  // Playback works on a compiled copy of the song, edits are picked up by the next play:
+  const PlaybackSchedule* pSchedule = pPlaybackEngine_->schedule();
 
-  pTotalTime_->SetLabelMarkup(wxString::Format(
-      "<span background='black' foreground='lime' size='%d'>%02d:%02d:%03d</span>", 30 * 1024, m, s, roundedMs));
+  if (isScheduleOutdated_ || !pSchedule || pSchedule->songRevision() != pSong_->revision()) {
+    std::shared_ptr<PlaybackSchedule> pNewSchedule = std::make_shared<PlaybackSchedule>();
+    HeadSimulationOptions simulationOptions;
+
+    if (pAllocationOptions_) {
+      simulationOptions.numDrives = pAllocationOptions_->numVoices;
+
+      if (hasPoolPerTrack_)
+        pAllocationOptions_->trackPools = VoiceAllocationOptions::evenPools(pSong_->numberOfTracks(), pAllocationOptions_->numVoices);
+
+      allocation_.allocate(*pSong_, *pAllocationOptions_);
+      pNewSchedule->build(*pSong_, &allocation_);
+    }
+    else {
+      pNewSchedule->build(*pSong_);
+    }
+
+    // The heads are simulated note by note, which is cheap next to building the schedule:
+    headSimulation_.simulate(*pNewSchedule, simulationOptions);
+
+    pPlaybackEngine_->setSchedule(pNewSchedule);
+    isScheduleOutdated_ = false;
+    updateDriveTime();
+  }
+
+  pPlaybackEngine_->play();
+  positionTimer_.Start(50);
 }
+
+void TransportWindow::OnPositionTimer(wxTimerEvent& event) {
+  updatePosition();
+
+  // The engine picks up commands within milliseconds, so the tick after a command shows its effect:
+  if (!pPlaybackEngine_->isPlaying())
+    positionTimer_.Stop();
+}
+
+void TransportWindow::updatePosition() {
+  pPosition_->SetLabelMarkup(formatTime(pPlaybackEngine_->positionUs()));
+}
+
+void TransportWindow::updateDriveTime() {
+  if (headSimulation_.drives().empty())
+    return;
+
+  // The heads are simulated along with the schedule, so edits since the last play grey it out:
+  const bool isCurrent = headSimulation_.songRevision() == pSong_->revision() && !isScheduleOutdated_;
+  pDriveTime_->SetLabelMarkup(formatTime(headSimulation_.driveTimeUs(), isCurrent ? "orange" : "gray"));
+
+  wxString summary = "Time on the drives, including the resets of their heads before and after the song";
+
+  for (size_t driveNo = 0; driveNo < headSimulation_.drives().size(); ++driveNo) {
+    const HeadSimulation::Drive& drive = headSimulation_.drives()[driveNo];
+
+    summary += wxString::Format("\nDrive %zu: %llu steps, %llu reversals, %.0f steps/s average, %u steps/s max., "
+        "%zu reset collisions", driveNo, static_cast<unsigned long long>(drive.numSteps),
+        static_cast<unsigned long long>(drive.numReversals), drive.averageStepsPerSecond(),
+        drive.maxStepsPerSecond(), drive.resetCollisions.size());
+  }
+
+  pDriveTime_->SetToolTip(summary);
+}
+
+wxBEGIN_EVENT_TABLE(TransportWindow, wxWindow)
+EVT_BUTTON(RewindId, TransportWindow::OnRewind)
+EVT_BUTTON(StopId, TransportWindow::OnStop)
+EVT_BUTTON(PlayId, TransportWindow::OnPlay)
+EVT_TIMER(PositionTimerId, TransportWindow::OnPositionTimer)
+wxEND_EVENT_TABLE()
@@ -1,9 +1,14 @@
 #ifndef _TRANSPORT
 #define _TRANSPORT
 
+#include <memory>
+
 #include <wx/wx.h>
 
+#include "headsimulator.h"
+#include "playbackengine.h"
 #include "song.h"
+#include "voiceallocator.h"
 
 //-------------------------------------------------------------------------------------------------
 // TransportWindow
@@ -11,14 +16,43 @@
 
 class TransportWindow : public wxWindow {
 public:
-  TransportWindow(wxWindow* pParent, Song* pSong);
+  TransportWindow(wxWindow* pParent, Song* pSong, PlaybackEngine* pPlaybackEngine);
 
   void update();
 
+  // Voices are allocated once per schedule, so edits are picked up by the next play. Without
+  // options, every track plays on the voice of its own number. With per track pools, the pools
+  // of the options are replaced by even pools fitting the song:
+  void setVoiceAllocation(const VoiceAllocationOptions* pOptions, bool hasPoolPerTrack = false);
+
 private:
+  static const int RewindId = wxID_HIGHEST + 10;
+  static const int StopId = wxID_HIGHEST + 11;
+  static const int PlayId = wxID_HIGHEST + 12;
+  static const int PositionTimerId = wxID_HIGHEST + 13;
+
+  void OnRewind(wxCommandEvent& event);
+  void OnStop(wxCommandEvent& event);
+  void OnPlay(wxCommandEvent& event);
+  void OnPositionTimer(wxTimerEvent& event);
+
+  void updatePosition();
+  void updateDriveTime();
+
   wxSizer* pTopSizer_{nullptr};
+  wxStaticText* pPosition_{nullptr};
   wxStaticText* pTotalTime_{nullptr};
+  wxStaticText* pDriveTime_{nullptr};
+  wxTimer positionTimer_;
+  std::unique_ptr<VoiceAllocationOptions> pAllocationOptions_;
+  bool hasPoolPerTrack_{false};
+  bool isScheduleOutdated_{false};
+  VoiceAllocation allocation_;
+  HeadSimulation headSimulation_;
   Song* const pSong_;
+  PlaybackEngine* const pPlaybackEngine_;
+
+  wxDECLARE_EVENT_TABLE();
 };
 
 #endif // _TRANSPORT
@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <functional>
+
+#include "song.h"
+#include "voiceallocator.h"
+
+const size_t VoiceAllocationOptions::MaxVoices;
+const int8_t VoiceAllocation::NoVoice;
+
+//-------------------------------------------------------------------------------------------------
+// VoiceAllocationOptions
+//-------------------------------------------------------------------------------------------------
+
+std::vector<uint64_t> VoiceAllocationOptions::evenPools(size_t numTracks, size_t numVoices) {
+  numVoices = std::min(std::max<size_t>(numVoices, 1), MaxVoices);
+  std::vector<uint64_t> pools(numTracks, 0);
+
+  for (size_t trackNo = 0; trackNo < numTracks; ++trackNo) {
+    const size_t firstVoice = trackNo * numVoices / numTracks;
+    const size_t endVoice = std::max(firstVoice + 1, (trackNo + 1) * numVoices / numTracks);
+
+    for (size_t voice = firstVoice; voice < endVoice; ++voice)
+      pools[trackNo] |= uint64_t(1) << voice;
+  }
+
+  return pools;
+}
+
+//-------------------------------------------------------------------------------------------------
+// VoiceAllocation
+//-------------------------------------------------------------------------------------------------
+
+namespace {
+  struct Block {
+    uint32_t startTick;
+    uint32_t endTick;
+    uint32_t index;
+    uint16_t trackNo;
+    uint8_t note;
+  };
+
+  struct Voice {
+    uint32_t startTick{0};
+    uint32_t endTick{0};
+    uint32_t serial{0}; // identifies the block currently playing, so stale heap entries are skipped
+    uint16_t trackNo{0};
+    uint32_t index{0};
+    uint8_t note{0};
+  };
+
+  struct PendingEnd {
+    bool operator > (const PendingEnd& rhs) const { return endTick > rhs.endTick; }
+
+    uint32_t endTick;
+    uint32_t serial;
+    uint8_t voice;
+  };
+}
+
+void VoiceAllocation::allocate(const Song& song, const VoiceAllocationOptions& options) {
+  using Policy = VoiceAllocationOptions::Policy;
+
+  numVoices_ = std::min(std::max<size_t>(options.numVoices, 1), VoiceAllocationOptions::MaxVoices);
+  numNotes_ = 0;
+  numStolen_ = 0;
+  numDropped_ = 0;
+  songRevision_ = song.revision();
+  tracks_.resize(song.numberOfTracks());
+
+  const uint64_t allVoices = numVoices_ == 64 ? ~uint64_t(0) : (uint64_t(1) << numVoices_) - 1;
+  std::vector<Block> blocks;
+
+  for (size_t trackNo = 0; trackNo < song.numberOfTracks(); ++trackNo) {
+    const NoteArray& notes = song.track(static_cast<int>(trackNo))->events().notes();
+    tracks_[trackNo].assign(notes.size(), {0, NoVoice});
+    numNotes_ += notes.size();
+
+    for (size_t i = 0; i < notes.size(); ++i) {
+      tracks_[trackNo][i].endTick = notes.endTick(i);
+
+      // Blocks without a length never sound, so they don't occupy a voice:
+      if (notes.numTicks(i) > 0)
+        blocks.push_back({notes.startTick(i), notes.endTick(i), static_cast<uint32_t>(i), static_cast<uint16_t>(trackNo), notes.note(i)});
+    }
+  }
+
+  // Every track is sorted already, so the tracks are merged by a stable sort. With the highest
+  // note policy, chords are visited top down, so their melody notes get voices first:
+  if (options.policy == Policy::HighestNote) {
+    std::stable_sort(blocks.begin(), blocks.end(), [](const Block& lhs, const Block& rhs) {
+      return lhs.startTick != rhs.startTick ? lhs.startTick < rhs.startTick : lhs.note > rhs.note;
+    });
+  }
+  else {
+    std::stable_sort(blocks.begin(), blocks.end(), [](const Block& lhs, const Block& rhs) {
+      return lhs.startTick < rhs.startTick;
+    });
+  }
+
+  std::vector<Voice> voices(numVoices_);
+  std::vector<PendingEnd> pendingEnds;
+  pendingEnds.reserve(numVoices_ * 2);
+  uint64_t freeVoices = allVoices;
+  uint32_t serial = 0;
+
+  for (const Block& block : blocks) {
+    // Release all voices whose note has ended by now:
+    while (!pendingEnds.empty() && pendingEnds.front().endTick <= block.startTick) {
+      std::pop_heap(pendingEnds.begin(), pendingEnds.end(), std::greater<PendingEnd>());
+      const PendingEnd end = pendingEnds.back();
+      pendingEnds.pop_back();
+
+      if (voices[end.voice].serial == end.serial)
+        freeVoices |= uint64_t(1) << end.voice;
+    }
+
+    uint64_t pool = allVoices;
+
+    if (block.trackNo < options.trackPools.size() && (options.trackPools[block.trackNo] & allVoices) != 0)
+      pool = options.trackPools[block.trackNo] & allVoices;
+
+    int voiceNo = -1;
+
+    if ((freeVoices & pool) != 0) {
+      // The lowest free voice of the pool:
+      for (voiceNo = 0; !(freeVoices & pool & (uint64_t(1) << voiceNo)); ++voiceNo) {}
+    }
+    else if (options.policy != Policy::Drop) {
+      // All voices of the pool are busy, look for a victim:
+      for (size_t v = 0; v < numVoices_; ++v) {
+        if (!(pool & (uint64_t(1) << v)))
+          continue;
+
+        const bool isBetter = voiceNo < 0 ||
+            (options.policy == Policy::StealOldest ? voices[v].startTick < voices[voiceNo].startTick
+                                                   : voices[v].note < voices[voiceNo].note);
+        if (isBetter)
+          voiceNo = static_cast<int>(v);
+      }
+
+      if (voiceNo >= 0 && options.policy == Policy::HighestNote && voices[voiceNo].note >= block.note)
+        voiceNo = -1;
+
+      if (voiceNo >= 0) {
+        const Voice& victim = voices[voiceNo];
+        tracks_[victim.trackNo][victim.index].endTick = block.startTick;
+
+        // A victim starting at the same tick never sounds at all:
+        if (victim.startTick == block.startTick) {
+          tracks_[victim.trackNo][victim.index].voice = NoVoice;
+          ++numDropped_;
+        }
+        else {
+          ++numStolen_;
+        }
+      }
+    }
+
+    if (voiceNo < 0) {
+      ++numDropped_;
+      continue;
+    }
+
+    Voice& voice = voices[voiceNo];
+    voice.startTick = block.startTick;
+    voice.endTick = block.endTick;
+    voice.serial = ++serial;
+    voice.trackNo = block.trackNo;
+    voice.index = block.index;
+    voice.note = block.note;
+
+    freeVoices &= ~(uint64_t(1) << voiceNo);
+    tracks_[block.trackNo][block.index].voice = static_cast<int8_t>(voiceNo);
+
+    pendingEnds.push_back({block.endTick, voice.serial, static_cast<uint8_t>(voiceNo)});
+    std::push_heap(pendingEnds.begin(), pendingEnds.end(), std::greater<PendingEnd>());
+  }
+}
+
+bool VoiceAllocation::isValidFor(const Song& song) const {
+  return songRevision_ == song.revision() && tracks_.size() == song.numberOfTracks();
+}
@@ -0,0 +1,77 @@
+#ifndef _VOICE_ALLOCATOR_H
+#define _VOICE_ALLOCATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class Song;
+
+//-------------------------------------------------------------------------------------------------
+// VoiceAllocationOptions
+//-------------------------------------------------------------------------------------------------
+
+struct VoiceAllocationOptions {
+  static const size_t MaxVoices = 64;
+
+  // What happens to a note which starts while all voices it may use are busy:
+  enum class Policy {
+    Drop,        // the new note is dropped
+    StealOldest, // the note which has been sounding the longest is cut off
+    HighestNote  // the lowest sounding note is cut off if it is lower than the new note, chords
+                 // are allocated from their top note down
+  };
+
+  size_t numVoices{8};
+  Policy policy{Policy::StealOldest};
+
+  // Bit mask of the voices every track may use, indexed by track number. Tracks without an entry
+  // or with an empty mask may use all voices:
+  std::vector<uint64_t> trackPools;
+
+  // Splits the voices into consecutive ranges of about the same size, one per track. With more
+  // tracks than voices, several tracks share a voice:
+  static std::vector<uint64_t> evenPools(size_t numTracks, size_t numVoices);
+};
+
+//-------------------------------------------------------------------------------------------------
+// VoiceAllocation
+//-------------------------------------------------------------------------------------------------
+
+// Assigns every note block of a song to one of a few monophonic voices, e.g. floppy drives. All
+// blocks of all tracks are sorted by their start once and then swept in order. Voices become free
+// again through a heap of pending note ends, so the sweep costs O(log n) per block plus a scan
+// over the bounded number of voices whenever one has to be stolen.
+//
+// The result annotates the blocks by their index inside their track, so it is only valid for the
+// revision of the song it has been computed for. Blocks which got stolen from end early.
+class VoiceAllocation {
+public:
+  static const int8_t NoVoice = -1;
+
+  void allocate(const Song& song, const VoiceAllocationOptions& options);
+  bool isValidFor(const Song& song) const;
+
+  int8_t voice(int trackNo, size_t noteIndex) const     { return tracks_[trackNo][noteIndex].voice; }
+  uint32_t endTick(int trackNo, size_t noteIndex) const { return tracks_[trackNo][noteIndex].endTick; }
+
+  size_t numVoices() const                              { return numVoices_; }
+  size_t numNotes() const                               { return numNotes_; }
+  size_t numStolen() const                              { return numStolen_; }
+  size_t numDropped() const                             { return numDropped_; }
+
+private:
+  struct Assignment {
+    uint32_t endTick;
+    int8_t voice;
+  };
+
+  std::vector<std::vector<Assignment>> tracks_;
+  uint64_t songRevision_{0};
+  size_t numVoices_{0};
+  size_t numNotes_{0};
+  size_t numStolen_{0};
+  size_t numDropped_{0};
+};
+
+#endif // _VOICE_ALLOCATOR_H